@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lowdown.h"
+#include "extern.h"
+
+/*
+ * Alignment of all non-text allocations.  This is large enough for any
+ * of the structures we put into the arena.
+ */
+#define	ARENA_ALIGN	16
+
+/*
+ * Smallest and largest size of a chunk.  Chunks grow geometrically
+ * between these as the arena fills, so the number of chunks (and thus
+ * the cost of releasing the arena) is logarithmic in its size.
+ */
+#define	ARENA_CHUNK_MIN	4096
+#define	ARENA_CHUNK_MAX	(1024 * 1024)
+
+struct	arena_chunk {
+	struct arena_chunk	*next; /* previous (full) chunk */
+	size_t			 size; /* size of data */
+	size_t			 used; /* bytes used in data */
+	char			*data; /* follows this structure */
+};
+
+/*
+ * Heap memory handed over to the arena with arena_adopt().
+ */
+struct	arena_ext {
+	struct arena_ext	*next; /* previously adopted */
+	void			*data; /* heap memory */
+};
+
+/*
+ * A bump allocator.  Memory is never freed piecemeal: it's all released
+ * at once with arena_free().
+ */
+struct	lowdown_arena {
+	struct arena_chunk	*head; /* current chunk */
+	struct arena_ext	*ext; /* adopted heap memory */
+	size_t			 next; /* size of next chunk */
+};
+
+/*
+ * Allocate a new chunk at the head of the list that's able to hold at
+ * least "sz" bytes.  Returns the chunk or NULL on memory failure.
+ */
+static struct arena_chunk *
+arena_chunk_new(struct lowdown_arena *a, size_t sz)
+{
+	struct arena_chunk	*c;
+	size_t			 csz, hsz;
+
+	csz = a->next;
+	if (csz < sz)
+		csz = sz;
+	if (a->next < ARENA_CHUNK_MAX)
+		a->next *= 2;
+
+	hsz = (sizeof(struct arena_chunk) + ARENA_ALIGN - 1) &
+		~(size_t)(ARENA_ALIGN - 1);
+	if ((c = malloc(hsz + csz)) == NULL)
+		return NULL;
+	c->data = (char *)c + hsz;
+	c->size = csz;
+	c->used = 0;
+	c->next = a->head;
+	a->head = c;
+	return c;
+}
+
+/*
+ * Create an arena.  The "hint" is the expected amount of memory used,
+ * which may be zero.  Returns NULL on memory failure.
+ */
+struct lowdown_arena *
+arena_new(size_t hint)
+{
+	struct lowdown_arena	*a;
+
+	if ((a = calloc(1, sizeof(struct lowdown_arena))) == NULL)
+		return NULL;
+	a->next = ARENA_CHUNK_MIN;
+	while (a->next < hint && a->next < ARENA_CHUNK_MAX)
+		a->next *= 2;
+	return a;
+}
+
+/*
+ * Release all memory in the arena.  Does nothing if "a" is NULL.
+ */
+void
+arena_free(struct lowdown_arena *a)
+{
+	struct arena_chunk	*c;
+	struct arena_ext	*e;
+
+	if (a == NULL)
+		return;
+	for (e = a->ext; e != NULL; e = e->next)
+		free(e->data);
+	while ((c = a->head) != NULL) {
+		a->head = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+/*
+ * Move all memory of the arena "from" into "a", then free "from".
+ * Allocation continues in the current chunk of "a".  Does nothing if
+ * "from" is NULL.
+ */
+void
+arena_merge(struct lowdown_arena *a, struct lowdown_arena *from)
+{
+	struct arena_chunk	*c;
+	struct arena_ext	*e;
+
+	if (from == NULL)
+		return;
+	if ((c = from->head) != NULL) {
+		while (c->next != NULL)
+			c = c->next;
+		if (a->head == NULL)
+			a->head = from->head;
+		else {
+			c->next = a->head->next;
+			a->head->next = from->head;
+		}
+	}
+	if ((e = from->ext) != NULL) {
+		while (e->next != NULL)
+			e = e->next;
+		e->next = a->ext;
+		a->ext = from->ext;
+	}
+	free(from);
+}
+
+/*
+ * Allocate "sz" bytes with the given alignment, which must be a power
+ * of two.  Returns NULL on memory failure.
+ */
+static void *
+arena_alloc_align(struct lowdown_arena *a, size_t sz, size_t align)
+{
+	struct arena_chunk	*c = a->head;
+	size_t			 off = 0;
+
+	if (c != NULL)
+		off = (c->used + align - 1) & ~(align - 1);
+	if (c == NULL || off > c->size || c->size - off < sz) {
+		if ((c = arena_chunk_new(a, sz)) == NULL)
+			return NULL;
+		off = 0;
+	}
+	c->used = off + sz;
+	return c->data + off;
+}
+
+/*
+ * Allocate zeroed memory for "nmemb" objects of size "sz" from the
+ * arena or, if "a" is NULL, from the heap.  Returns NULL on memory
+ * failure.
+ */
+void *
+arena_calloc(struct lowdown_arena *a, size_t nmemb, size_t sz)
+{
+	void	*p;
+
+	if (a == NULL)
+		return calloc(nmemb, sz);
+	if (sz && nmemb > SIZE_MAX / sz)
+		return NULL;
+	if ((p = arena_alloc_align(a, nmemb * sz, ARENA_ALIGN)) == NULL)
+		return NULL;
+	memset(p, 0, nmemb * sz);
+	return p;
+}
+
+/*
+ * Hand over heap memory "data" to the arena, which will free(3) it when
+ * the arena is freed.  On failure, the caller retains ownership.
+ * Returns FALSE on memory failure, TRUE on success.
+ */
+int
+arena_adopt(struct lowdown_arena *a, void *data)
+{
+	struct arena_ext	*e;
+
+	e = arena_alloc_align(a, sizeof(struct arena_ext), ARENA_ALIGN);
+	if (e == NULL)
+		return 0;
+	e->data = data;
+	e->next = a->ext;
+	a->ext = e;
+	return 1;
+}
+
+/*
+ * Copy "sz" bytes of "data" into the arena (or heap if "a" is NULL),
+ * NUL-terminating the result.  Returns NULL on memory failure.
+ */
+char *
+arena_strndup(struct lowdown_arena *a, const char *data, size_t sz)
+{
+	char	*p;
+
+	if (a == NULL)
+		return strndup(data, sz);
+	if ((p = arena_alloc_align(a, sz + 1, 1)) == NULL)
+		return NULL;
+	memcpy(p, data, sz);
+	p[sz] = '\0';
+	return p;
+}
+
+/*
+ * Append "datasz" bytes of "data" to a buffer whose data is within the
+ * arena.  If the buffer is the last allocation in the current chunk and
+ * there's room, it's extended in place; otherwise, it's copied into a
+ * new allocation.  The buffer is marked as read-only (zero unit), as it
+ * may not be reallocated.  Returns FALSE on memory failure, TRUE on
+ * success.
+ */
+int
+arena_buf_put(struct lowdown_arena *a, struct lowdown_buf *buf,
+    const char *data, size_t datasz)
+{
+	struct arena_chunk	*c = a->head;
+	char			*p;
+
+	if (datasz == 0)
+		return 1;
+
+	if (buf->size > 0 && c != NULL &&
+	    buf->data + buf->size == c->data + c->used &&
+	    c->size - c->used >= datasz) {
+		memcpy(buf->data + buf->size, data, datasz);
+		c->used += datasz;
+		buf->size += datasz;
+		buf->maxsize = buf->size;
+		return 1;
+	}
+
+	if ((p = arena_alloc_align(a, buf->size + datasz, 1)) == NULL)
+		return 0;
+	if (buf->size)
+		memcpy(p, buf->data, buf->size);
+	memcpy(p + buf->size, data, datasz);
+	buf->data = p;
+	buf->size += datasz;
+	buf->maxsize = buf->size;
+	buf->unit = 0;
+	buf->buffer_free = 0;
+	return 1;
+}
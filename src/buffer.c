@@ -34,6 +34,24 @@
 #include "lowdown.h"
 #include "extern.h"
 
+/*
+ * Output held by hbuf_flush() before it's written.
+ */
+#define	HBUF_FLUSH	(64 * 1024)
+
+/*
+ * Process-wide growth counters: see lowdown_buf_stats().  These are
+ * only for profiling, so the updates needn't be ordered.
+ */
+static struct lowdown_buf_stats hbuf_stats;
+
+#if defined(__GNUC__)
+# define HBUF_STAT(_v, _n) \
+	__atomic_fetch_add(&hbuf_stats._v, (_n), __ATOMIC_RELAXED)
+#else
+# define HBUF_STAT(_v, _n) (hbuf_stats._v += (_n))
+#endif
+
 static void
 hbuf_init(struct lowdown_buf *buf, size_t unit, int buffer_free)
 {
@@ -168,6 +186,11 @@ lowdown_buf_free(struct lowdown_buf *buf)
 	hbuf_free(buf);
 }
 
+/*
+ * Make sure "buf" can hold "neosz" bytes.  Allocations at least double
+ * so that appending is amortised linear, and are in whole units.
+ * Return zero on failure (memory), non-zero on success.
+ */
 int
 hbuf_grow(struct lowdown_buf *buf, size_t neosz)
 {
@@ -177,15 +200,92 @@ hbuf_grow(struct lowdown_buf *buf, size_t neosz)
 	if (buf->maxsize >= neosz)
 		return 1;
 
-	neoasz = (neosz/buf->unit + (neosz%buf->unit > 0)) * buf->unit;
+	neoasz = buf->maxsize > SIZE_MAX / 2 ? neosz : buf->maxsize * 2;
+	if (neoasz < neosz)
+		neoasz = neosz;
+	if (neoasz % buf->unit > 0) {
+		if (neoasz > SIZE_MAX - buf->unit)
+			return 0;
+		neoasz += buf->unit - neoasz % buf->unit;
+	}
 
 	if ((pp = realloc(buf->data, neoasz)) == NULL)
 		return 0;
+	HBUF_STAT(reallocs, 1);
+	HBUF_STAT(copied, buf->size);
 	buf->data = pp;
 	buf->maxsize = neoasz;
 	return 1;
 }
 
+/*
+ * Make sure "buf" has room for "sz" more bytes, usually as a hint of
+ * output size given the input.  Return zero on failure (memory),
+ * non-zero on success.
+ */
+int
+hbuf_reserve(struct lowdown_buf *buf, size_t sz)
+{
+
+	if (sz > SIZE_MAX - buf->size)
+		return 0;
+	return hbuf_grow(buf, buf->size + sz);
+}
+
+/*
+ * Insert "data" of length "sz" into "buf" at "pos", moving along what
+ * follows it.  Return zero on failure (memory), non-zero on success.
+ */
+int
+hbuf_insert(struct lowdown_buf *buf, size_t pos, const char *data,
+    size_t sz)
+{
+
+	assert(pos <= buf->size);
+	if (!hbuf_reserve(buf, sz))
+		return 0;
+	memmove(buf->data + pos + sz, buf->data + pos, buf->size - pos);
+	memcpy(buf->data + pos, data, sz);
+	buf->size += sz;
+	return 1;
+}
+
+/*
+ * Write "buf" to "sink" if it holds at least HBUF_FLUSH bytes or if
+ * "all" is set, emptying it.  Unless "all", the last byte is kept, as
+ * renderers look back at it to see whether they're at a new line.
+ * Return zero on failure (the sink's), non-zero on success.
+ */
+int
+hbuf_flush(struct lowdown_buf *buf, const struct lowdown_sink *sink,
+    int all)
+{
+	size_t	 sz;
+
+	if (buf->size == 0 || (!all && buf->size < HBUF_FLUSH))
+		return 1;
+	sz = all ? buf->size : buf->size - 1;
+	if (!sink->write(buf->data, sz, sink->arg))
+		return 0;
+	memmove(buf->data, buf->data + sz, buf->size - sz);
+	buf->size -= sz;
+	return 1;
+}
+
+void
+lowdown_buf_stats(struct lowdown_buf_stats *stats)
+{
+
+#if defined(__GNUC__)
+	stats->reallocs = __atomic_load_n
+		(&hbuf_stats.reallocs, __ATOMIC_RELAXED);
+	stats->copied = __atomic_load_n
+		(&hbuf_stats.copied, __ATOMIC_RELAXED);
+#else
+	*stats = hbuf_stats;
+#endif
+}
+
 int
 hbuf_putb(struct lowdown_buf *buf, const struct lowdown_buf *b)
 {
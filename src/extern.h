@@ -23,17 +23,57 @@ struct	hbuf_entry {
 
 TAILQ_HEAD(hbuf_entryq, hbuf_entry);
 
+/*
+ * Hashed index of metadata by case-folded key.  The metadata is owned
+ * by its queue, which must outlive the index.
+ */
+struct	metaidx {
+	const struct lowdown_meta **tab; /* open-addressed slots */
+	size_t			 tabsz; /* slots (zero or power of two) */
+	size_t			 len; /* occupied slots */
+};
+
+struct lowdown_arena
+		*arena_new(size_t);
+void		 arena_free(struct lowdown_arena *);
+void		 arena_merge(struct lowdown_arena *, struct lowdown_arena *);
+int		 arena_adopt(struct lowdown_arena *, void *);
+void		*arena_calloc(struct lowdown_arena *, size_t, size_t);
+char		*arena_strndup(struct lowdown_arena *, const char *, size_t);
+int		 arena_buf_put(struct lowdown_arena *, struct lowdown_buf *,
+			const char *, size_t);
+
+int		 metaidx_build(struct metaidx *,
+			const struct lowdown_metaq *);
+void		 metaidx_clear(struct metaidx *);
+void		 metaidx_del(struct metaidx *, const char *, size_t);
+void		 metaidx_free(struct metaidx *);
+const struct lowdown_meta
+		*metaidx_get(const struct metaidx *, const char *, size_t);
+int		 metaidx_put(struct metaidx *, const struct lowdown_meta *);
+
+int		 lowdown_html_rndr_sink(struct lowdown_buf *,
+			const struct lowdown_sink *, void *,
+			const struct lowdown_node *);
+void		 lowdown_html_rndr_start(void *,
+			const struct lowdown_sink *);
+int		 lowdown_html_rndr_next(struct lowdown_buf *, void *,
+			const struct lowdown_node *);
+int		 lowdown_html_rndr_end(struct lowdown_buf *, void *, int);
+
 int		 hbuf_eq(const struct lowdown_buf *, const struct lowdown_buf *);
 int		 hbuf_streq(const struct lowdown_buf *, const char *);
 int		 hbuf_strprefix(const struct lowdown_buf *, const char *);
 void		 hbuf_free(struct lowdown_buf *);
 int		 hbuf_grow(struct lowdown_buf *, size_t);
+int		 hbuf_insert(struct lowdown_buf *, size_t, const char *, size_t);
 int		 hbuf_clone(const struct lowdown_buf *, struct lowdown_buf *);
 struct lowdown_buf
 		*hbuf_dup(const struct lowdown_buf *);
 struct lowdown_buf
 		*hbuf_strndup(const char *, size_t);
 int		 hbuf_extract_text(struct lowdown_buf *, const struct lowdown_node *);
+int		 hbuf_flush(struct lowdown_buf *, const struct lowdown_sink *, int);
 const struct lowdown_buf
 		*hbuf_id(const struct lowdown_buf *, const struct lowdown_node *,
 			struct hbuf_entryq *);
@@ -52,6 +92,7 @@ int		 hbuf_putb(struct lowdown_buf *, const struct lowdown_buf *);
 int		 hbuf_putc(struct lowdown_buf *, char);
 int		 hbuf_putf(struct lowdown_buf *, FILE *);
 int		 hbuf_puts(struct lowdown_buf *, const char *);
+int		 hbuf_reserve(struct lowdown_buf *, size_t);
 int		 hbuf_strncasecmp(const struct lowdown_buf *, const char *);
 int		 hbuf_strncasecmpat(const struct lowdown_buf *, const char *, size_t);
 void		 hbuf_truncate(struct lowdown_buf *);
@@ -41,6 +41,9 @@ lowdown_gemini_esc(struct lowdown_buf *ob, const char *buf, size_t sz,
 	size_t	 	 i, start = 0;
 	unsigned char	 ch;
 
+	if (!hbuf_reserve(ob, sz))
+		return 0;
+
 	for (i = 0; i < sz; i++) {
 		ch = (unsigned char)buf[i];
 		if (ch == '\n' && oneline) {
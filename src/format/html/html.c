@@ -45,6 +45,10 @@ struct 	html {
 	struct lowdown_buf	**foots; /* footnotes */
 	size_t			  footsz; /* footnotes size  */
 	const char		 *templ; /* output template */
+	const struct lowdown_sink *sink; /* output sink or NULL */
+	size_t			  base; /* output start of parent node */
+	struct lowdown_metaq	  metaq; /* metadata being rendered */
+	int			  open; /* lowdown_html_rndr_next() begun */
 };
 
 /*
@@ -110,15 +114,35 @@ escape_attr(struct lowdown_buf *ob, const struct lowdown_buf *in)
 	return lowdown_html_esc_attr(ob, in->data, in->size);
 }
 
+/*
+ * Start a new line unless at the start of the output of the current
+ * node's parent or already at a new line.
+ */
 static int
-newline(struct lowdown_buf *ob)
+newline(struct lowdown_buf *ob, const struct html *st)
 {
-	if (ob->size > 0 && ob->data[ob->size - 1] != '\n' &&
+	if (ob->size > st->base && ob->data[ob->size - 1] != '\n' &&
 	    !hbuf_putc(ob, '\n'))
 		return 0;
 	return 1;
 }
 
+/*
+ * Point "buf" at the output in "ob" after "start", as written by a
+ * node's children.  It's only valid until "ob" is next changed.
+ */
+static void
+content_buf(struct lowdown_buf *buf, const struct lowdown_buf *ob,
+    size_t start)
+{
+
+	memset(buf, 0, sizeof(struct lowdown_buf));
+	if (ob->size > start) {
+		buf->data = ob->data + start;
+		buf->size = ob->size - start;
+	}
+}
+
 static int
 rndr_autolink(struct lowdown_buf *ob,
     const struct rndr_autolink *parm, const struct html *st)
@@ -159,7 +183,7 @@ static int
 rndr_blockcode(struct lowdown_buf *ob,
     const struct rndr_blockcode *parm, const struct html *st)
 {
-	if (!newline(ob))
+	if (!newline(ob, st))
 		return 0;
 
 	if (parm->lang.size) {
@@ -180,62 +204,37 @@ rndr_blockcode(struct lowdown_buf *ob,
 }
 
 static int
-rndr_definition_data(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
+rndr_definition_title(struct lowdown_buf *ob, size_t start)
 {
 
-	if (!HBUF_PUTSL(ob, "<dd>\n"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "\n</dd>\n");
-}
-
-static int
-rndr_definition_title(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-	size_t	 sz;
+	/* Cut off any trailing space. */
 
-	if (!HBUF_PUTSL(ob, "<dt>"))
-		return 0;
-	if ((sz = content->size) > 0) {
-		while (sz && content->data[sz - 1] == '\n')
-			sz--;
-		if (!hbuf_put(ob, content->data, sz))
-			return 0;
-	}
+	while (ob->size > start && ob->data[ob->size - 1] == '\n')
+		ob->size--;
 	return HBUF_PUTSL(ob, "</dt>\n");
 }
 
+/*
+ * Whether a blockquote is a callout <div> instead of a <blockquote>.
+ */
 static int
-rndr_definition(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
+blockquote_callout(const struct html *st,
+    const struct rndr_blockquote *param)
 {
 
-	if (!newline(ob))
-		return 0;
-	if (!HBUF_PUTSL(ob, "<dl>\n"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</dl>\n");
+	return param->type != BLOCKQUOTE_REGULAR && (st->flags &
+	    (LOWDOWN_HTML_CALLOUT_GFM|LOWDOWN_HTML_CALLOUT_MDN));
 }
 
 static int
-rndr_blockquote(const struct html *st,
-    const struct rndr_blockquote *param, struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
+rndr_blockquote_open(struct lowdown_buf *ob,
+    const struct rndr_blockquote *param, const struct html *st)
 {
-	size_t	 i;
 
-	if (!newline(ob))
+	if (!newline(ob, st))
 		return 0;
-	if (param->type == BLOCKQUOTE_REGULAR || !(st->flags &
-	    (LOWDOWN_HTML_CALLOUT_GFM|LOWDOWN_HTML_CALLOUT_MDN)))
-		return HBUF_PUTSL(ob, "<blockquote>\n") &&
-		    hbuf_putb(ob, content) &&
-		    HBUF_PUTSL(ob, "</blockquote>\n");
+	if (!blockquote_callout(st, param))
+		return HBUF_PUTSL(ob, "<blockquote>\n");
 
 	if (!HBUF_PUTSL(ob, "<div class=\""))
 		return 0;
@@ -262,25 +261,36 @@ rndr_blockquote(const struct html *st,
 			return 0;
 	}
 
-	if (!HBUF_PUTSL(ob, "\">\n"))
-		return 0;
+	return HBUF_PUTSL(ob, "\">\n");
+}
+
+static int
+rndr_blockquote(struct lowdown_buf *ob,
+    const struct rndr_blockquote *param, const struct html *st,
+    size_t start)
+{
+	size_t	 i;
+
+	if (!blockquote_callout(st, param))
+		return HBUF_PUTSL(ob, "</blockquote>\n");
 
 	/*
 	 * Weird: content callouts have their initial callout type
 	 * removed.  Fortunately, this is hard-coded, so we know its
-	 * exact length.  Remove the callout type and any extra spacing
-	 * that follows it.
+	 * exact length.  Replace the callout type and any extra spacing
+	 * that follows it with the paragraph start.
 	 */
 
-	if (param->admonition == ADMONITION_CALLOUT && content->size > 28) {
-		i = 28;
-		while (i < content->size && content->data[i] == ' ')
+	if (param->admonition == ADMONITION_CALLOUT &&
+	    ob->size - start > 28) {
+		i = start + 28;
+		while (i < ob->size && ob->data[i] == ' ')
 			i++;
-		if (!HBUF_PUTSL(ob, "<p>") ||
-		    !hbuf_put(ob, content->data + i, content->size - i))
-			return 0;
-	} else if (!hbuf_putb(ob, content))
-		return 0;
+		memcpy(ob->data + start, "<p>", 3);
+		memmove(ob->data + start + 3,
+			ob->data + i, ob->size - i);
+		ob->size -= i - start - 3;
+	}
 	return HBUF_PUTSL(ob, "</div>\n");
 }
 
@@ -296,54 +306,6 @@ rndr_codespan(struct lowdown_buf *ob,
 	return HBUF_PUTSL(ob, "</code>");
 }
 
-static int
-rndr_strikethrough(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-
-	if (!HBUF_PUTSL(ob, "<del>"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</del>");
-}
-
-static int
-rndr_double_emphasis(struct lowdown_buf *ob,
-	const struct lowdown_buf *content)
-{
-
-	if (!HBUF_PUTSL(ob, "<strong>"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</strong>");
-}
-
-static int
-rndr_emphasis(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-
-	if (!HBUF_PUTSL(ob, "<em>"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</em>");
-}
-
-static int
-rndr_highlight(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-
-	if (!HBUF_PUTSL(ob, "<mark>"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</mark>");
-}
-
 static int
 rndr_linebreak(struct lowdown_buf *ob)
 {
@@ -351,29 +313,34 @@ rndr_linebreak(struct lowdown_buf *ob)
 	return HBUF_PUTSL(ob, "<br/>\n");
 }
 
-static int
-rndr_header(struct lowdown_buf *ob, const struct lowdown_buf *content,
-    const struct lowdown_node *n, struct html *st)
+/*
+ * The <hN> level take into account shifteheadinglevelby metadata, so
+ * offset it here.  Bound us below <h6>.
+ */
+static ssize_t
+rndr_header_level(const struct lowdown_node *n, const struct html *st)
 {
-	ssize_t			   level;
-	const struct lowdown_buf  *buf;
-	const struct lowdown_attr *v;
-	size_t			   i;
-
-	/*
-	 * The <hN> level take into account shifteheadinglevelby
-	 * metadata, so offset it here.  Bound us below <h6>.
-	 */
+	ssize_t	 level;
 
 	level = (ssize_t)n->rndr_header.level + st->headers_offs;
 	if (level < 1)
 		level = 1;
 	else if (level > 6)
 		level = 6;
+	return level;
+}
+
+static int
+rndr_header_open(struct lowdown_buf *ob, const struct lowdown_node *n,
+    struct html *st)
+{
+	const struct lowdown_buf  *buf;
+	const struct lowdown_attr *v;
+	size_t			   i;
 
-	if (!newline(ob))
+	if (!newline(ob, st))
 		return 0;
-	if (!hbuf_printf(ob, "<h%zu", level))
+	if (!hbuf_printf(ob, "<h%zu", rndr_header_level(n, st)))
 		return 0;
 
 	/*
@@ -422,21 +389,17 @@ rndr_header(struct lowdown_buf *ob, const struct lowdown_buf *content,
 				return 0;
 		}
 
-	if (!HBUF_PUTSL(ob, ">"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return hbuf_printf(ob, "</h%zu>\n", level);
+	return HBUF_PUTSL(ob, ">");
 }
 
 /*
- * Print a link <a href="">content</a>, all Markdown attributes (e.g.,
- * title), and all extended attributes.
+ * Print the start of a link <a href="">, all Markdown attributes
+ * (e.g., title), and all extended attributes.
  * Return FALSE on failure (memory), TRUE on success.
  */
 static int
-rndr_link(struct lowdown_buf *ob, const struct lowdown_buf *content,
-    const struct rndr_link *param, const struct html *st)
+rndr_link_open(struct lowdown_buf *ob, const struct rndr_link *param,
+    const struct html *st)
 {
 	const struct lowdown_attr 	*v;
 	size_t				 i;
@@ -498,49 +461,58 @@ rndr_link(struct lowdown_buf *ob, const struct lowdown_buf *content,
 				return 0;
 		}
 
-	/* Close the link start, print the content, close the link. */
-
-	if (!HBUF_PUTSL(ob, ">") ||
-	    !hbuf_putb(ob, content) ||
-	    !HBUF_PUTSL(ob, "</a>"))
-		return 0;
+	/* Close the link start. */
 
-	return 1;
+	return HBUF_PUTSL(ob, ">");
 }
 
 static int
-rndr_list(struct lowdown_buf *ob, const struct lowdown_buf *content,
-    const struct rndr_list *param)
+rndr_list_open(struct lowdown_buf *ob, const struct rndr_list *param,
+    const struct html *st)
 {
 
-	if (!newline(ob))
-		return 0;
-	if (param->flags & HLIST_FL_ORDERED) {
-		if (param->start > 1) {
-			if (!hbuf_printf(ob,
-			    "<ol start=\"%zu\">\n", param->start))
-				return 0;
-		} else {
-			if (!HBUF_PUTSL(ob, "<ol>\n"))
-				return 0;
-		}
-	} else if (!HBUF_PUTSL(ob, "<ul>\n"))
+	if (!newline(ob, st))
 		return 0;
+	if (!(param->flags & HLIST_FL_ORDERED))
+		return HBUF_PUTSL(ob, "<ul>\n");
+	return param->start > 1 ?
+		hbuf_printf(ob, "<ol start=\"%zu\">\n", param->start) :
+		HBUF_PUTSL(ob, "<ol>\n");
+}
 
-	if (!hbuf_putb(ob, content))
+static int
+rndr_listitem_open(struct lowdown_buf *ob, const struct lowdown_node *n)
+{
+
+	/* Only emit <li> if we're not a <dl> list. */
+
+	if (!(n->rndr_listitem.flags & HLIST_FL_DEF) &&
+	    !HBUF_PUTSL(ob, "<li>"))
 		return 0;
 
-	return (param->flags & HLIST_FL_ORDERED) ?
-		HBUF_PUTSL(ob, "</ol>\n") :
-		HBUF_PUTSL(ob, "</ul>\n");
+	if (n->rndr_listitem.flags &
+	    (HLIST_FL_CHECKED|HLIST_FL_UNCHECKED))
+		HBUF_PUTSL(ob, "<input type=\"checkbox\" ");
+	if (n->rndr_listitem.flags & HLIST_FL_CHECKED)
+		HBUF_PUTSL(ob, "checked=\"checked\" ");
+	if (n->rndr_listitem.flags &
+	    (HLIST_FL_CHECKED|HLIST_FL_UNCHECKED))
+		HBUF_PUTSL(ob, "/>");
+	return 1;
 }
 
+/*
+ * Finish a list item whose output starts at "org" and whose children's
+ * output starts at "start".
+ */
 static int
-rndr_listitem(struct lowdown_buf *ob,
-    const struct lowdown_buf *content, const struct lowdown_node *n)
+rndr_listitem(struct lowdown_buf *ob, const struct lowdown_node *n,
+    size_t org, size_t start)
 {
-	size_t	 size;
-	int	 blk = 0;
+	struct lowdown_buf	 buf;
+	int			 blk = 0;
+
+	content_buf(&buf, ob, start);
 
 	/*
 	 * If we're in block mode (which can be assigned post factum in
@@ -558,44 +530,32 @@ rndr_listitem(struct lowdown_buf *ob,
 	     n->parent != NULL &&
 	     n->parent->type == LOWDOWN_LIST &&
 	     (n->parent->rndr_list.flags & HLIST_FL_BLOCK))) {
-		if (!(hbuf_strprefix(content, "<ul") ||
-		      hbuf_strprefix(content, "<ol") ||
-		      hbuf_strprefix(content, "<dl") ||
-		      hbuf_strprefix(content, "<div") ||
-		      hbuf_strprefix(content, "<table") ||
-		      hbuf_strprefix(content, "<blockquote") ||
-		      hbuf_strprefix(content, "<pre>") ||
-		      hbuf_strprefix(content, "<h") ||
-		      hbuf_strprefix(content, "<p>")))
+		if (!(hbuf_strprefix(&buf, "<ul") ||
+		      hbuf_strprefix(&buf, "<ol") ||
+		      hbuf_strprefix(&buf, "<dl") ||
+		      hbuf_strprefix(&buf, "<div") ||
+		      hbuf_strprefix(&buf, "<table") ||
+		      hbuf_strprefix(&buf, "<blockquote") ||
+		      hbuf_strprefix(&buf, "<pre>") ||
+		      hbuf_strprefix(&buf, "<h") ||
+		      hbuf_strprefix(&buf, "<p>")))
 			blk = 1;
 	}
 
-	/* Only emit <li> if we're not a <dl> list. */
+	/* The paragraph goes after any <li>, before any checkbox. */
 
-	if (!(n->rndr_listitem.flags & HLIST_FL_DEF) &&
-	    !HBUF_PUTSL(ob, "<li>"))
-		return 0;
-
-	if (blk && !HBUF_PUTSL(ob, "<p>"))
-		return 0;
-
-	if (n->rndr_listitem.flags &
-	    (HLIST_FL_CHECKED|HLIST_FL_UNCHECKED))
-		HBUF_PUTSL(ob, "<input type=\"checkbox\" ");
-	if (n->rndr_listitem.flags & HLIST_FL_CHECKED)
-		HBUF_PUTSL(ob, "checked=\"checked\" ");
-	if (n->rndr_listitem.flags &
-	    (HLIST_FL_CHECKED|HLIST_FL_UNCHECKED))
-		HBUF_PUTSL(ob, "/>");
+	if (!(n->rndr_listitem.flags & HLIST_FL_DEF))
+		org += 4;
+	if (blk) {
+		if (!hbuf_insert(ob, org, "<p>", 3))
+			return 0;
+		start += 3;
+	}
 
 	/* Cut off any trailing space. */
 
-	if ((size = content->size) > 0) {
-		while (size && content->data[size - 1] == '\n')
-			size--;
-		if (!hbuf_put(ob, content->data, size))
-			return 0;
-	}
+	while (ob->size > start && ob->data[ob->size - 1] == '\n')
+		ob->size--;
 
 	if (blk && !HBUF_PUTSL(ob, "</p>"))
 		return 0;
@@ -607,52 +567,71 @@ rndr_listitem(struct lowdown_buf *ob,
 }
 
 static int
-rndr_paragraph(struct lowdown_buf *ob,
-    const struct lowdown_buf *content, struct html *st)
+rndr_paragraph_open(struct lowdown_buf *ob, const struct html *st)
 {
-	size_t	i = 0, org;
 
-	if (content->size == 0)
-		return 1;
-	while (i < content->size &&
-	       isspace((unsigned char)content->data[i]))
+	return newline(ob, st) && HBUF_PUTSL(ob, "<p>");
+}
+
+/*
+ * Finish a paragraph whose output starts at "org" and whose children's
+ * output starts at "start".  Paragraphs without content are removed.
+ */
+static int
+rndr_paragraph(struct lowdown_buf *ob, const struct html *st,
+    size_t org, size_t start)
+{
+	struct lowdown_buf	*tmp;
+	size_t			 i = start, beg;
+	int			 rc = 0;
+
+	while (i < ob->size && isspace((unsigned char)ob->data[i]))
 		i++;
-	if (i == content->size)
+	if (i == ob->size) {
+		ob->size = org;
 		return 1;
+	}
 
-	if (!newline(ob))
-		return 0;
-	if (!HBUF_PUTSL(ob, "<p>"))
+	if (!(st->flags & LOWDOWN_HTML_HARD_WRAP)) {
+		if (i > start) {
+			memmove(ob->data + start,
+				ob->data + i, ob->size - i);
+			ob->size -= i - start;
+		}
+		return HBUF_PUTSL(ob, "</p>\n");
+	}
+
+	/* Line breaks lengthen the output, so work from a copy. */
+
+	if ((tmp = hbuf_new(64)) == NULL)
 		return 0;
+	if (!hbuf_put(tmp, ob->data + i, ob->size - i))
+		goto out;
+	ob->size = start;
 
-	if (st->flags & LOWDOWN_HTML_HARD_WRAP) {
-		for ( ; i < content->size; i++) {
-			org = i;
-			while (i < content->size &&
-			       content->data[i] != '\n')
-				i++;
+	for (i = 0; i < tmp->size; i++) {
+		beg = i;
+		while (i < tmp->size && tmp->data[i] != '\n')
+			i++;
 
-			if (i > org && !hbuf_put
-		   	    (ob, content->data + org, i - org))
-				return 0;
+		if (i > beg && !hbuf_put(ob, tmp->data + beg, i - beg))
+			goto out;
 
-			/*
-			 * Do not insert a line break if this newline is
-			 * the last character on the paragraph.
-			 */
+		/*
+		 * Do not insert a line break if this newline is the
+		 * last character on the paragraph.
+		 */
 
-			if (i >= content->size - 1)
-				break;
-			if (!rndr_linebreak(ob))
-				return 0;
-		}
-	} else {
-		if (!hbuf_put(ob,
-		    content->data + i, content->size - i))
-			return 0;
+		if (i >= tmp->size - 1)
+			break;
+		if (!rndr_linebreak(ob))
+			goto out;
 	}
 
-	return HBUF_PUTSL(ob, "</p>\n");
+	rc = HBUF_PUTSL(ob, "</p>\n");
+out:
+	hbuf_free(tmp);
+	return rc;
 }
 
 static int
@@ -682,7 +661,7 @@ rndr_raw_block(struct lowdown_buf *ob,
 	if (org >= sz)
 		return 1;
 
-	if (!newline(ob))
+	if (!newline(ob, st))
 		return 0;
 
 	if (!hbuf_put(ob, param->text.data + org, sz - org))
@@ -691,22 +670,10 @@ rndr_raw_block(struct lowdown_buf *ob,
 }
 
 static int
-rndr_triple_emphasis(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-
-	if (!HBUF_PUTSL(ob, "<strong><em>"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</em></strong>");
-}
-
-static int
-rndr_hrule(struct lowdown_buf *ob)
+rndr_hrule(struct lowdown_buf *ob, const struct html *st)
 {
 
-	if (!newline(ob))
+	if (!newline(ob, st))
 		return 0;
 	return hbuf_puts(ob, "<hr/>\n");
 }
@@ -846,64 +813,7 @@ rndr_raw_html(struct lowdown_buf *ob,
 }
 
 static int
-rndr_table(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-
-	if (!newline(ob))
-		return 0;
-	if (!HBUF_PUTSL(ob, "<table>\n"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</table>\n");
-}
-
-static int
-rndr_table_header(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-
-	if (!newline(ob))
-		return 0;
-	if (!HBUF_PUTSL(ob, "<thead>\n"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</thead>\n");
-}
-
-static int
-rndr_table_body(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-
-	if (content->size == 0)
-		return 1;
-	if (!newline(ob))
-		return 0;
-	if (!HBUF_PUTSL(ob, "<tbody>\n"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</tbody>\n");
-}
-
-static int
-rndr_table_row(struct lowdown_buf *ob,
-    const struct lowdown_buf *content)
-{
-
-	if (!HBUF_PUTSL(ob, "<tr>\n"))
-		return 0;
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return HBUF_PUTSL(ob, "</tr>\n");
-}
-
-static int
-rndr_tablecell(struct lowdown_buf *ob,
-    const struct lowdown_buf *content,
+rndr_tablecell_open(struct lowdown_buf *ob,
     const struct rndr_table_cell *param)
 {
 
@@ -934,25 +844,7 @@ rndr_tablecell(struct lowdown_buf *ob,
 		break;
 	}
 
-	if (!hbuf_putb(ob, content))
-		return 0;
-
-	return (param->flags & HTBL_FL_HEADER) ?
-		HBUF_PUTSL(ob, "</th>\n") :
-		HBUF_PUTSL(ob, "</td>\n");
-}
-
-static int
-rndr_superscript(struct lowdown_buf *ob,
-    const struct lowdown_buf *content, enum lowdown_rndrt type)
-{
-	const char	*elem;
-
-	elem = (type == LOWDOWN_SUPERSCRIPT) ? "sup" : "sub";
-
-	return hbuf_printf(ob, "<%s>", elem) &&
-	    hbuf_putb(ob, content) &&
-	    hbuf_printf(ob, "</%s>", elem);
+	return 1;
 }
 
 static int
@@ -1010,16 +902,16 @@ rndr_footnote_def(struct lowdown_buf *ob,
 }
 
 static int
-rndr_footnote_ref(struct lowdown_buf *ob,
-    const struct lowdown_buf *content, struct html *st)
+rndr_footnote_ref(struct lowdown_buf *ob, struct html *st, size_t start)
 {
-	void	*pp;
-	size_t	 num = st->footsz + 1;
+	struct lowdown_buf	 buf;
+	void			*pp;
+	size_t			 num = st->footsz + 1;
 
 	/*
-	 * Keep a reference to this footnote definition, as we're going
-	 * to print it out at the end of the document.  For now,
-	 * suppress printing of the content.
+	 * Keep a copy of this footnote definition, as we're going to
+	 * print it out at the end of the document.  For now, suppress
+	 * printing of the content.
 	 */
 
 	pp = recallocarray(st->foots, st->footsz,
@@ -1027,8 +919,11 @@ rndr_footnote_ref(struct lowdown_buf *ob,
 	if (pp == NULL)
 		return 0;
 	st->foots = pp;
-	if ((st->foots[st->footsz++] = hbuf_dup(content)) == NULL)
+	content_buf(&buf, ob, start);
+	st->foots[st->footsz++] = hbuf_strndup(buf.data, buf.size);
+	if (st->foots[st->footsz - 1] == NULL)
 		return 0;
+	ob->size = start;
 
 	return hbuf_printf(ob,
 		"<sup id=\"fnref%zu\">"
@@ -1067,7 +962,7 @@ rndr_doc_footer(struct lowdown_buf *ob, const struct html *st)
 	 * in that we may not have them all defined (?).
 	 */
 
-	if (!newline(ob))
+	if (!newline(ob, st))
 		return 0;
 	if (!HBUF_PUTSL(ob, "<div class=\"footnotes\">\n<hr/>\n<ol>\n"))
 		return 0;
@@ -1134,9 +1029,13 @@ rndr_meta_multi(const struct html *st, struct lowdown_buf *ob,
 	return 1;
 }
 
+/*
+ * Emit the start of a standalone document up to its body, which needs
+ * all of the metadata.
+ */
 static int
-rndr_root(struct lowdown_buf *ob, const struct lowdown_buf *content,
-    const struct lowdown_metaq *mq, const struct html *st)
+rndr_root_head(struct lowdown_buf *ob, const struct lowdown_metaq *mq,
+    const struct html *st)
 {
 	const struct lowdown_meta	*m;
 	const char			*author = NULL, *title = NULL,
@@ -1146,11 +1045,6 @@ rndr_root(struct lowdown_buf *ob, const struct lowdown_buf *content,
 					*script = NULL, *header = NULL,
 					*lang = NULL;
 
-	if (!(st->flags & LOWDOWN_STANDALONE))
-		return hbuf_putb(ob, content);
-	if (st->templ != NULL)
-		return lowdown_template(st->templ, content, ob, mq, 0);
-
 	TAILQ_FOREACH(m, mq, entries)
 		if (strcasecmp(m->key, "author") == 0)
 			author = m->value;
@@ -1262,13 +1156,7 @@ rndr_root(struct lowdown_buf *ob, const struct lowdown_buf *content,
 		    !HBUF_PUTSL(ob, "\n"))
 			return 0;
 	}
-	if (!HBUF_PUTSL(ob, "</head>\n<body>\n"))
-		return 0;
-
-	if (!hbuf_putb(ob, content))
-		return 0;
-
-	return HBUF_PUTSL(ob, "</body>\n</html>\n");
+	return HBUF_PUTSL(ob, "</head>\n<body>\n");
 }
 
 /*
@@ -1362,166 +1250,245 @@ rndr_doc_header(struct lowdown_buf *ob, const struct lowdown_metaq *mq,
 	return HBUF_PUTSL(ob, "</header>\n");
 }
 
+static int	rndr_root(struct lowdown_buf *, struct lowdown_metaq *,
+			struct html *, const struct lowdown_node *);
+
+/*
+ * Write what comes before the children of "n", if anything.
+ * Return zero on failure, non-zero on success.
+ */
 static int
-rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq, struct html *st,
+rndr_enter(struct lowdown_buf *ob, struct html *st,
     const struct lowdown_node *n)
 {
-	const struct lowdown_node	*child;
-	struct lowdown_buf		*tmp;
-	int32_t				 ent;
-	int				 ret = 1, rc = 1;
-
-	if ((tmp = hbuf_new(64)) == NULL)
-		return 0;
-
-	TAILQ_FOREACH(child, &n->children, entries)
-		if (!rndr(tmp, mq, st, child))
-			goto out;
 
-	/*
-	 * If we're in the doc header, don't emit any insert or delete,
-	 * as HTML doesn't allow them.
-	 */
+	switch (n->type) {
+	case LOWDOWN_BLOCKQUOTE:
+		return rndr_blockquote_open(ob, &n->rndr_blockquote, st);
+	case LOWDOWN_DEFINITION:
+		return newline(ob, st) && HBUF_PUTSL(ob, "<dl>\n");
+	case LOWDOWN_DEFINITION_TITLE:
+		return HBUF_PUTSL(ob, "<dt>");
+	case LOWDOWN_DEFINITION_DATA:
+		return HBUF_PUTSL(ob, "<dd>\n");
+	case LOWDOWN_HEADER:
+		return rndr_header_open(ob, n, st);
+	case LOWDOWN_LIST:
+		return rndr_list_open(ob, &n->rndr_list, st);
+	case LOWDOWN_LISTITEM:
+		return rndr_listitem_open(ob, n);
+	case LOWDOWN_PARAGRAPH:
+		return rndr_paragraph_open(ob, st);
+	case LOWDOWN_TABLE_BLOCK:
+		return newline(ob, st) && HBUF_PUTSL(ob, "<table>\n");
+	case LOWDOWN_TABLE_HEADER:
+		return newline(ob, st) && HBUF_PUTSL(ob, "<thead>\n");
+	case LOWDOWN_TABLE_BODY:
+		return newline(ob, st) && HBUF_PUTSL(ob, "<tbody>\n");
+	case LOWDOWN_TABLE_ROW:
+		return HBUF_PUTSL(ob, "<tr>\n");
+	case LOWDOWN_TABLE_CELL:
+		return rndr_tablecell_open(ob, &n->rndr_table_cell);
+	case LOWDOWN_DOUBLE_EMPHASIS:
+		return HBUF_PUTSL(ob, "<strong>");
+	case LOWDOWN_EMPHASIS:
+		return HBUF_PUTSL(ob, "<em>");
+	case LOWDOWN_HIGHLIGHT:
+		return HBUF_PUTSL(ob, "<mark>");
+	case LOWDOWN_LINK:
+		return rndr_link_open(ob, &n->rndr_link, st);
+	case LOWDOWN_TRIPLE_EMPHASIS:
+		return HBUF_PUTSL(ob, "<strong><em>");
+	case LOWDOWN_STRIKETHROUGH:
+		return HBUF_PUTSL(ob, "<del>");
+	case LOWDOWN_SUPERSCRIPT:
+		return HBUF_PUTSL(ob, "<sup>");
+	case LOWDOWN_SUBSCRIPT:
+		return HBUF_PUTSL(ob, "<sub>");
+	default:
+		break;
+	}
+	return 1;
+}
 
-	if (n->chng == LOWDOWN_CHNG_INSERT && n->type != LOWDOWN_META &&
-	    !HBUF_PUTSL(ob, "<ins>"))
-		goto out;
-	if (n->chng == LOWDOWN_CHNG_DELETE && n->type != LOWDOWN_META &&
-	   !HBUF_PUTSL(ob, "<del>"))
-		goto out;
+/*
+ * Write what comes after the children of "n", whose output starts at
+ * "org" and whose children's output starts at "start".  Nodes needing
+ * their children's output, such as paragraphs and footnotes, adjust it
+ * in place here.  Return zero on failure, non-zero on success.
+ */
+static int
+rndr_leave(struct lowdown_buf *ob, struct lowdown_metaq *mq,
+    struct html *st, const struct lowdown_node *n, size_t org,
+    size_t start)
+{
+	int32_t	 ent;
 
 	switch (n->type) {
-	case LOWDOWN_ROOT:
-		rc = rndr_doc_footer(tmp, st) &&
-			rndr_root(ob, tmp, mq, st);
-		break;
-	case LOWDOWN_BLOCKCODE:
-		rc = rndr_blockcode(ob, &n->rndr_blockcode, st);
-		break;
 	case LOWDOWN_BLOCKQUOTE:
-		rc = rndr_blockquote(st, &n->rndr_blockquote, ob, tmp);
-		break;
+		return rndr_blockquote(ob, &n->rndr_blockquote, st, start);
 	case LOWDOWN_DEFINITION:
-		rc = rndr_definition(ob, tmp);
-		break;
+		return HBUF_PUTSL(ob, "</dl>\n");
 	case LOWDOWN_DEFINITION_TITLE:
-		rc = rndr_definition_title(ob, tmp);
-		break;
+		return rndr_definition_title(ob, start);
 	case LOWDOWN_DEFINITION_DATA:
-		rc = rndr_definition_data(ob, tmp);
-		break;
-	case LOWDOWN_DOC_HEADER:
-		rc = rndr_doc_header(ob, mq, st);
-		break;
-	case LOWDOWN_META:
-		if (n->chng != LOWDOWN_CHNG_DELETE)
-			rc = rndr_meta(st, n, mq);
-		break;
+		return HBUF_PUTSL(ob, "\n</dd>\n");
 	case LOWDOWN_HEADER:
-		rc = rndr_header(ob, tmp, n, st);
-		break;
-	case LOWDOWN_HRULE:
-		rc = rndr_hrule(ob);
-		break;
+		return hbuf_printf(ob, "</h%zu>\n",
+			rndr_header_level(n, st));
 	case LOWDOWN_LIST:
-		rc = rndr_list(ob, tmp, &n->rndr_list);
-		break;
+		return (n->rndr_list.flags & HLIST_FL_ORDERED) ?
+			HBUF_PUTSL(ob, "</ol>\n") :
+			HBUF_PUTSL(ob, "</ul>\n");
 	case LOWDOWN_LISTITEM:
-		rc = rndr_listitem(ob, tmp, n);
-		break;
+		return rndr_listitem(ob, n, org, start);
 	case LOWDOWN_PARAGRAPH:
-		rc = rndr_paragraph(ob, tmp, st);
-		break;
+		return rndr_paragraph(ob, st, org, start);
 	case LOWDOWN_TABLE_BLOCK:
-		rc = rndr_table(ob, tmp);
-		break;
+		return HBUF_PUTSL(ob, "</table>\n");
 	case LOWDOWN_TABLE_HEADER:
-		rc = rndr_table_header(ob, tmp);
-		break;
+		return HBUF_PUTSL(ob, "</thead>\n");
 	case LOWDOWN_TABLE_BODY:
-		rc = rndr_table_body(ob, tmp);
-		break;
+		if (ob->size > start)
+			return HBUF_PUTSL(ob, "</tbody>\n");
+		ob->size = org;
+		return 1;
 	case LOWDOWN_TABLE_ROW:
-		rc = rndr_table_row(ob, tmp);
-		break;
+		return HBUF_PUTSL(ob, "</tr>\n");
 	case LOWDOWN_TABLE_CELL:
-		rc = rndr_tablecell(ob, tmp, &n->rndr_table_cell);
-		break;
-	case LOWDOWN_BLOCKHTML:
-		rc = rndr_raw_block(ob, &n->rndr_blockhtml, st);
-		break;
-	case LOWDOWN_LINK_AUTO:
-		rc = rndr_autolink(ob, &n->rndr_autolink, st);
-		break;
-	case LOWDOWN_CODESPAN:
-		rc = rndr_codespan(ob, &n->rndr_codespan, st);
-		break;
+		return (n->rndr_table_cell.flags & HTBL_FL_HEADER) ?
+			HBUF_PUTSL(ob, "</th>\n") :
+			HBUF_PUTSL(ob, "</td>\n");
 	case LOWDOWN_DOUBLE_EMPHASIS:
-		rc = rndr_double_emphasis(ob, tmp);
-		break;
+		return HBUF_PUTSL(ob, "</strong>");
 	case LOWDOWN_EMPHASIS:
-		rc = rndr_emphasis(ob, tmp);
-		break;
+		return HBUF_PUTSL(ob, "</em>");
 	case LOWDOWN_HIGHLIGHT:
-		rc = rndr_highlight(ob, tmp);
-		break;
-	case LOWDOWN_IMAGE:
-		rc = rndr_image(ob, &n->rndr_image, st);
-		break;
-	case LOWDOWN_LINEBREAK:
-		rc = rndr_linebreak(ob);
-		break;
+		return HBUF_PUTSL(ob, "</mark>");
 	case LOWDOWN_LINK:
-		rc = rndr_link(ob, tmp, &n->rndr_link, st);
-		break;
+		return HBUF_PUTSL(ob, "</a>");
 	case LOWDOWN_TRIPLE_EMPHASIS:
-		rc = rndr_triple_emphasis(ob, tmp);
-		break;
+		return HBUF_PUTSL(ob, "</em></strong>");
 	case LOWDOWN_STRIKETHROUGH:
-		rc = rndr_strikethrough(ob, tmp);
-		break;
+		return HBUF_PUTSL(ob, "</del>");
 	case LOWDOWN_SUPERSCRIPT:
-		rc = rndr_superscript(ob, tmp, n->type);
-		break;
+		return HBUF_PUTSL(ob, "</sup>");
 	case LOWDOWN_SUBSCRIPT:
-		rc = rndr_superscript(ob, tmp, n->type);
-		break;
+		return HBUF_PUTSL(ob, "</sub>");
 	case LOWDOWN_FOOTNOTE:
-		rc = rndr_footnote_ref(ob, tmp, st);
-		break;
+		return rndr_footnote_ref(ob, st, start);
+	case LOWDOWN_BLOCKCODE:
+	case LOWDOWN_DOC_HEADER:
+	case LOWDOWN_META:
+	case LOWDOWN_HRULE:
+	case LOWDOWN_BLOCKHTML:
+	case LOWDOWN_LINK_AUTO:
+	case LOWDOWN_CODESPAN:
+	case LOWDOWN_IMAGE:
+	case LOWDOWN_LINEBREAK:
 	case LOWDOWN_MATH_BLOCK:
-		rc = rndr_math(ob, &n->rndr_math, st);
-		break;
 	case LOWDOWN_RAW_HTML:
-		rc = rndr_raw_html(ob, &n->rndr_raw_html, st);
-		break;
 	case LOWDOWN_NORMAL_TEXT:
-		rc = rndr_normal_text(ob, &n->rndr_normal_text, st);
-		break;
 	case LOWDOWN_ENTITY:
-		if (!(st->flags & LOWDOWN_HTML_NUM_ENT)) {
-			rc = hbuf_putb(ob, &n->rndr_entity.text);
-			break;
-		}
+		break;
+	default:
+		return 1;
+	}
 
-		/*
-		 * Prefer numeric entities.
-		 * This is because we're emitting XML (XHTML5) and it's
-		 * not clear whether the processor can handle HTML
-		 * entities.
-		 */
+	/*
+	 * The remaining nodes don't show the output of any children,
+	 * which is made only for its side effects (e.g., metadata).
+	 */
 
-		ent = entity_find_iso(&n->rndr_entity.text);
-		rc = ent > 0 ?
-			hbuf_printf(ob, "&#%" PRId32 ";", ent) :
-			hbuf_putb(ob, &n->rndr_entity.text);
-		break;
+	ob->size = start;
+
+	switch (n->type) {
+	case LOWDOWN_BLOCKCODE:
+		return rndr_blockcode(ob, &n->rndr_blockcode, st);
+	case LOWDOWN_DOC_HEADER:
+		return rndr_doc_header(ob, mq, st);
+	case LOWDOWN_META:
+		if (n->chng != LOWDOWN_CHNG_DELETE)
+			return rndr_meta(st, n, mq);
+		return 1;
+	case LOWDOWN_HRULE:
+		return rndr_hrule(ob, st);
+	case LOWDOWN_BLOCKHTML:
+		return rndr_raw_block(ob, &n->rndr_blockhtml, st);
+	case LOWDOWN_LINK_AUTO:
+		return rndr_autolink(ob, &n->rndr_autolink, st);
+	case LOWDOWN_CODESPAN:
+		return rndr_codespan(ob, &n->rndr_codespan, st);
+	case LOWDOWN_IMAGE:
+		return rndr_image(ob, &n->rndr_image, st);
+	case LOWDOWN_LINEBREAK:
+		return rndr_linebreak(ob);
+	case LOWDOWN_MATH_BLOCK:
+		return rndr_math(ob, &n->rndr_math, st);
+	case LOWDOWN_RAW_HTML:
+		return rndr_raw_html(ob, &n->rndr_raw_html, st);
+	case LOWDOWN_NORMAL_TEXT:
+		return rndr_normal_text(ob, &n->rndr_normal_text, st);
 	default:
-		rc = hbuf_putb(ob, tmp);
 		break;
 	}
-	if (!rc)
-		goto out;
+
+	assert(n->type == LOWDOWN_ENTITY);
+	if (!(st->flags & LOWDOWN_HTML_NUM_ENT))
+		return hbuf_putb(ob, &n->rndr_entity.text);
+
+	/*
+	 * Prefer numeric entities.
+	 * This is because we're emitting XML (XHTML5) and it's
+	 * not clear whether the processor can handle HTML
+	 * entities.
+	 */
+
+	ent = entity_find_iso(&n->rndr_entity.text);
+	return ent > 0 ?
+		hbuf_printf(ob, "&#%" PRId32 ";", ent) :
+		hbuf_putb(ob, &n->rndr_entity.text);
+}
+
+/*
+ * Render "n" and its children directly into "ob".
+ * Return zero on failure, non-zero on success.
+ */
+static int
+rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq, struct html *st,
+    const struct lowdown_node *n)
+{
+	const struct lowdown_node	*child;
+	size_t				 org, start, base;
+
+	if (n->type == LOWDOWN_ROOT)
+		return rndr_root(ob, mq, st, n);
+
+	/*
+	 * If we're in the doc header, don't emit any insert or delete,
+	 * as HTML doesn't allow them.
+	 */
+
+	if (n->chng == LOWDOWN_CHNG_INSERT && n->type != LOWDOWN_META &&
+	    !HBUF_PUTSL(ob, "<ins>"))
+		return 0;
+	if (n->chng == LOWDOWN_CHNG_DELETE && n->type != LOWDOWN_META &&
+	   !HBUF_PUTSL(ob, "<del>"))
+		return 0;
+
+	org = ob->size;
+	if (!rndr_enter(ob, st, n))
+		return 0;
+
+	base = st->base;
+	start = st->base = ob->size;
+	TAILQ_FOREACH(child, &n->children, entries)
+		if (!rndr(ob, mq, st, child))
+			return 0;
+	st->base = base;
+
+	if (!rndr_leave(ob, mq, st, n, org, start))
+		return 0;
 
 	/*
 	 * If we're in the doc header, don't emit any insert or delete,
@@ -1532,31 +1499,121 @@ rndr(struct lowdown_buf *ob, struct lowdown_metaq *mq, struct html *st,
 	    n->parent != NULL &&
 	    n->parent->type != LOWDOWN_DOC_HEADER &&
 	    !HBUF_PUTSL(ob, "</ins>"))
-		goto out;
+		return 0;
 	if (n->chng == LOWDOWN_CHNG_DELETE && n->type != LOWDOWN_META &&
 	    !HBUF_PUTSL(ob, "</del>"))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Begin the document body after the document header "hdr", if not
+ * NULL, which is rendered first.  In a standalone document, the head
+ * is made once its metadata is known.  The standalone head ends with a
+ * newline, so the body needn't be marked apart from it; with a sink,
+ * all of "ob" is output.  Return zero on failure, non-zero on success.
+ */
+static int
+rndr_root_open(struct lowdown_buf *ob, struct lowdown_metaq *mq,
+    struct html *st, const struct lowdown_node *hdr)
+{
+	struct lowdown_buf	*tmp;
+	int			 rc;
+
+	st->base = (st->flags & LOWDOWN_STANDALONE) ||
+		st->sink != NULL ? 0 : ob->size;
+
+	if (!(st->flags & LOWDOWN_STANDALONE))
+		return hdr == NULL || rndr(ob, mq, st, hdr);
+
+	if ((tmp = hbuf_new(64)) == NULL)
+		return 0;
+	rc = (hdr == NULL || rndr(tmp, mq, st, hdr)) &&
+		rndr_root_head(ob, mq, st) && hbuf_putb(ob, tmp);
+	hbuf_free(tmp);
+	return rc;
+}
+
+/*
+ * End the document body.
+ * Return zero on failure, non-zero on success.
+ */
+static int
+rndr_root_close(struct lowdown_buf *ob, const struct html *st)
+{
+
+	if (!rndr_doc_footer(ob, st))
+		return 0;
+	return !(st->flags & LOWDOWN_STANDALONE) ||
+		HBUF_PUTSL(ob, "</body>\n</html>\n");
+}
+
+/*
+ * Render the document "n".  With a sink, write the output as each
+ * top-level block is finished.  Templates need the whole body, so are
+ * written at the end.  Return zero on failure, non-zero on success.
+ */
+static int
+rndr_root(struct lowdown_buf *ob, struct lowdown_metaq *mq,
+    struct html *st, const struct lowdown_node *n)
+{
+	const struct lowdown_node	*child, *hdr = NULL;
+	struct lowdown_buf		*tmp = NULL;
+	int				 rc = 0;
+
+	child = TAILQ_FIRST(&n->children);
+
+	if ((st->flags & LOWDOWN_STANDALONE) && st->templ != NULL) {
+		if ((tmp = hbuf_new(64)) == NULL)
+			return 0;
+		st->base = 0;
+		for ( ; child != NULL; child = TAILQ_NEXT(child, entries))
+			if (!rndr(tmp, mq, st, child))
+				goto out;
+		rc = rndr_doc_footer(tmp, st) &&
+			lowdown_template(st->templ, tmp, ob, mq, 0);
 		goto out;
+	}
 
-	ret = 1;
+	if (child != NULL && child->type == LOWDOWN_DOC_HEADER) {
+		hdr = child;
+		child = TAILQ_NEXT(child, entries);
+	}
+	if (!rndr_root_open(ob, mq, st, hdr))
+		goto out;
+	for ( ; child != NULL; child = TAILQ_NEXT(child, entries))
+		if (!rndr(ob, mq, st, child) ||
+		    (st->sink != NULL && !hbuf_flush(ob, st->sink, 0)))
+			goto out;
+	rc = rndr_root_close(ob, st);
 out:
 	hbuf_free(tmp);
-	return ret;
+	return rc;
 }
 
-int
-lowdown_html_rndr(struct lowdown_buf *ob, void *arg,
-    const struct lowdown_node *n)
+/*
+ * Ready "st" to render a document writing to "sink", if not NULL.
+ */
+static void
+rndr_reset(struct html *st, const struct lowdown_sink *sink)
 {
-	struct html		*st = arg;
-	struct lowdown_metaq	 metaq;
-	int			 rc;
-	size_t			 i;
 
 	TAILQ_INIT(&st->headers_used);
-	TAILQ_INIT(&metaq);
+	TAILQ_INIT(&st->metaq);
 	st->headers_offs = 1;
+	st->sink = sink;
+	st->base = 0;
+	st->open = 0;
+}
 
-	rc = rndr(ob, &metaq, st, n);
+/*
+ * Release what rendering a document left in "st".
+ */
+static void
+rndr_clear(struct html *st)
+{
+	size_t	 i;
 
 	for (i = 0; i < st->footsz; i++)
 		hbuf_free(st->foots[i]);
@@ -1564,11 +1621,94 @@ lowdown_html_rndr(struct lowdown_buf *ob, void *arg,
 	free(st->foots);
 	st->footsz = 0;
 	st->foots = NULL;
-	lowdown_metaq_free(&metaq);
+	st->sink = NULL;
+	st->open = 0;
+	lowdown_metaq_free(&st->metaq);
 	hbuf_entryq_clear(&st->headers_used);
+}
+
+/*
+ * Render "n" into "ob" and, if "sink" isn't NULL, write it there as it
+ * goes.
+ */
+int
+lowdown_html_rndr_sink(struct lowdown_buf *ob,
+    const struct lowdown_sink *sink, void *arg,
+    const struct lowdown_node *n)
+{
+	struct html	*st = arg;
+	int		 rc;
+
+	rndr_reset(st, sink);
+	rc = rndr(ob, &st->metaq, st, n);
+	if (rc && sink != NULL)
+		rc = hbuf_flush(ob, sink, 1);
+	rndr_clear(st);
 	return rc;
 }
 
+/*
+ * Start rendering a document given top-level node by node with
+ * lowdown_html_rndr_next() and written to "sink".  The output is the
+ * same as for the whole tree, except that templates aren't used.
+ */
+void
+lowdown_html_rndr_start(void *arg, const struct lowdown_sink *sink)
+{
+
+	rndr_reset(arg, sink);
+}
+
+/*
+ * Render the next top-level node "n" of the document into "ob",
+ * writing out what's finished.  Return zero on failure, non-zero on
+ * success.
+ */
+int
+lowdown_html_rndr_next(struct lowdown_buf *ob, void *arg,
+    const struct lowdown_node *n)
+{
+	struct html	*st = arg;
+
+	if (!st->open) {
+		st->open = 1;
+		if (n->type == LOWDOWN_DOC_HEADER)
+			return rndr_root_open(ob, &st->metaq, st, n) &&
+			    hbuf_flush(ob, st->sink, 0);
+		if (!rndr_root_open(ob, &st->metaq, st, NULL))
+			return 0;
+	}
+	return rndr(ob, &st->metaq, st, n) &&
+	    hbuf_flush(ob, st->sink, 0);
+}
+
+/*
+ * End the document started with lowdown_html_rndr_start() if "ok",
+ * writing out the rest, then release its state in any case.  Return
+ * zero on failure, non-zero on success.
+ */
+int
+lowdown_html_rndr_end(struct lowdown_buf *ob, void *arg, int ok)
+{
+	struct html	*st = arg;
+
+	if (ok)
+		ok = (st->open ||
+		    rndr_root_open(ob, &st->metaq, st, NULL)) &&
+		    rndr_root_close(ob, st) &&
+		    hbuf_flush(ob, st->sink, 1);
+	rndr_clear(st);
+	return ok;
+}
+
+int
+lowdown_html_rndr(struct lowdown_buf *ob, void *arg,
+    const struct lowdown_node *n)
+{
+
+	return lowdown_html_rndr_sink(ob, NULL, arg, n);
+}
+
 void *
 lowdown_html_new(const struct lowdown_opts *opts)
 {
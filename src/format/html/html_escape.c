@@ -271,6 +271,8 @@ lowdown_html_esc(struct lowdown_buf *ob, const char *data,
 
 	if (size == 0)
 		return 1;
+	if (!hbuf_reserve(ob, size))
+		return 0;
 
 	if (!literal && !secure)
 		max = ESC_TBL_OWASP_MAX;
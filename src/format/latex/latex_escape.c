@@ -36,6 +36,9 @@ lowdown_latex_esc(struct lowdown_buf *ob, const char *data, size_t sz)
 {
 	size_t	 i;
 
+	if (!hbuf_reserve(ob, sz))
+		return 0;
+
 	for (i = 0; i < sz; i++)
 		switch (data[i]) {
 		case '&':
@@ -50,6 +50,8 @@ lowdown_roff_esc(struct lowdown_buf *ob, const char *data, size_t size,
 
 	if (size == 0)
 		return 1;
+	if (!hbuf_reserve(ob, size))
+		return 0;
 
 	/* Strip leading whitespace. */
 
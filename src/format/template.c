@@ -126,7 +126,7 @@ struct op_out {
 	size_t				 depth;
 	struct lowdown_buf		*ob;
 	const struct lowdown_buf	*content;
-	const struct lowdown_metaq	*mq;
+	struct metaidx			 idx; /* metadata by key */
 };
 
 /* Forward declaration. */
@@ -968,13 +968,11 @@ op_eval_initial(struct op_out *out, const char *expr, size_t exprsz,
 			exprsz = argsz;
 		}
 
-		TAILQ_FOREACH(m, out->mq, entries)
-			if (strlen(m->key) == exprsz &&
-			    strncasecmp(m->key, expr, exprsz) == 0) {
-				v = m->value;
-				vsz = strlen(m->value);
-				break;
-			}
+		m = metaidx_get(&out->idx, expr, exprsz);
+		if (m != NULL) {
+			v = m->value;
+			vsz = strlen(m->value);
+		}
 	}
 
 	op_argq_free(&argq);
@@ -1238,6 +1236,7 @@ lowdown_template(const char *templ, const struct lowdown_buf *content,
 	size_t		 sz;
 	struct op_out	 out;
 
+	memset(&out, 0, sizeof(struct op_out));
 	TAILQ_INIT(&q);
 	if ((root = op_alloc(&q, OP_ROOT, NULL)) == NULL)
 		return 0;
@@ -1357,13 +1356,14 @@ lowdown_template(const char *templ, const struct lowdown_buf *content,
 	out.debug = dbg;
 	out.ob = ob;
 	out.content = content;
-	out.mq = mq;
 	out.depth = 0;
-	rc = op_exec(&out, root, NULL);
+	if (metaidx_build(&out.idx, mq))
+		rc = op_exec(&out, root, NULL);
 out:
 	while ((op = TAILQ_FIRST(&q)) != NULL) {
 		TAILQ_REMOVE(&q, op, _all);
 		free(op);
 	}
+	metaidx_free(&out.idx);
 	return rc;
 }
@@ -15,16 +15,20 @@
  */
 #include "config.h"
 
+#include <sys/mman.h>
 #if HAVE_SYS_QUEUE
 # include <sys/queue.h>
 #endif
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "lowdown.h"
 #include "extern.h"
@@ -41,97 +45,413 @@
 #define HBUF_START_SMALL 128
 
 /*
- * Return FALSE on failure, TRUE on success.
+ * Input of a descriptor: see lowdown_input().
+ */
+struct	lowdown_input {
+	const char		*data; /* input */
+	size_t			 size; /* length of data */
+	void			*map; /* mapping of data (or NULL) */
+	struct lowdown_buf	*buf; /* buffer of data (or NULL) */
+};
+
+/*
+ * Parse "data" with "doc" or, if the input is binary, load it.
+ * Return the tree or NULL on failure.
+ */
+static struct lowdown_node *
+lowdown_load(const struct lowdown_opts *opts, struct lowdown_doc *doc,
+	const char *data, size_t datasz, size_t *maxn,
+	struct lowdown_metaq *metaq)
+{
+
+	if (opts != NULL && (opts->feat & LOWDOWN_BINARY))
+		return lowdown_node_deserialize
+			(data, datasz, maxn, metaq);
+	return lowdown_doc_parse(doc, maxn, data, datasz, metaq);
+}
+
+/*
+ * A parser and the renderer for its output mode, kept across documents
+ * by lowdown_ctx_buf(), lowdown_ctx_write(), and lowdown_ctx_feed().
+ */
+struct	lowdown_ctx {
+	const struct lowdown_opts *opts; /* options (or NULL) */
+	enum lowdown_type	   type; /* output mode */
+	struct lowdown_doc	  *doc; /* parser */
+	void			  *rndr; /* renderer (or NULL) */
+	struct lowdown_buf	  *ob; /* lowdown_ctx_write() output */
+	struct lowdown_node	  *root; /* lowdown_ctx_feed() tree or NULL */
+	int			   stream; /* rendering nodes as fed */
+};
+
+/*
+ * Allocate the renderer for "opts" into "rndr", which is set to NULL
+ * if the output mode doesn't have one.  Return FALSE on failure, TRUE
+ * on success.
  */
 static int
-lowdown_render(const struct lowdown_opts *opts,
-	struct lowdown_buf *ob, const struct lowdown_node *n)
+lowdown_rndr_new(const struct lowdown_opts *opts, void **rndr)
+{
+
+	*rndr = NULL;
+	switch (opts == NULL ? LOWDOWN_HTML : opts->type) {
+	case LOWDOWN_GEMINI:
+		*rndr = lowdown_gemini_new(opts);
+		break;
+	case LOWDOWN_HTML:
+		*rndr = lowdown_html_new(opts);
+		break;
+	case LOWDOWN_LATEX:
+		*rndr = lowdown_latex_new(opts);
+		break;
+	case LOWDOWN_MAN:
+	case LOWDOWN_MDOC:
+	case LOWDOWN_MS:
+	case LOWDOWN_NROFF:
+		*rndr = lowdown_roff_new(opts);
+		break;
+	case LOWDOWN_FODT:
+		*rndr = lowdown_odt_new(opts);
+		break;
+	case LOWDOWN_TERM:
+		*rndr = lowdown_term_new(opts);
+		break;
+	default:
+		return 1;
+	}
+	return *rndr != NULL;
+}
+
+static void
+lowdown_rndr_free(const struct lowdown_opts *opts, void *rndr)
 {
-	void	*rndr;
-	int	 c = 0;
 
 	switch (opts == NULL ? LOWDOWN_HTML : opts->type) {
 	case LOWDOWN_GEMINI:
-		if ((rndr = lowdown_gemini_new(opts)) == NULL)
-			return 0;
-		c = lowdown_gemini_rndr(ob, rndr, n);
 		lowdown_gemini_free(rndr);
 		break;
 	case LOWDOWN_HTML:
-		if ((rndr = lowdown_html_new(opts)) == NULL)
-			return 0;
-		c = lowdown_html_rndr(ob, rndr, n);
 		lowdown_html_free(rndr);
 		break;
 	case LOWDOWN_LATEX:
-		if ((rndr = lowdown_latex_new(opts)) == NULL)
-			return 0;
-		c = lowdown_latex_rndr(ob, rndr, n);
 		lowdown_latex_free(rndr);
 		break;
 	case LOWDOWN_MAN:
 	case LOWDOWN_MDOC:
 	case LOWDOWN_MS:
 	case LOWDOWN_NROFF:
-		if ((rndr = lowdown_roff_new(opts)) == NULL)
-			return 0;
-		c = lowdown_roff_rndr(ob, rndr, n);
 		lowdown_roff_free(rndr);
 		break;
 	case LOWDOWN_FODT:
-		if ((rndr = lowdown_odt_new(opts)) == NULL)
-			return 0;
-		c = lowdown_odt_rndr(ob, rndr, n);
 		lowdown_odt_free(rndr);
 		break;
 	case LOWDOWN_TERM:
-		if ((rndr = lowdown_term_new(opts)) == NULL)
-			return 0;
-		c = lowdown_term_rndr(ob, rndr, n);
 		lowdown_term_free(rndr);
 		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Render "n" with "rndr" from lowdown_rndr_new() into "ob" and, if
+ * "sink" isn't NULL, write it out.  Only HTML is written as it's
+ * rendered: other modes are written once done.  The metadata "mq", which may be NULL, is
+ * only used for binary output.  Return FALSE on failure, TRUE on
+ * success.
+ */
+static int
+lowdown_rndr(const struct lowdown_opts *opts, void *rndr,
+	struct lowdown_buf *ob, const struct lowdown_sink *sink,
+	const struct lowdown_node *n, const struct lowdown_metaq *mq)
+{
+	int	 rc = 1;
+
+	switch (opts == NULL ? LOWDOWN_HTML : opts->type) {
+	case LOWDOWN_GEMINI:
+		rc = lowdown_gemini_rndr(ob, rndr, n);
+		break;
+	case LOWDOWN_HTML:
+		return lowdown_html_rndr_sink(ob, sink, rndr, n);
+	case LOWDOWN_LATEX:
+		rc = lowdown_latex_rndr(ob, rndr, n);
+		break;
+	case LOWDOWN_MAN:
+	case LOWDOWN_MDOC:
+	case LOWDOWN_MS:
+	case LOWDOWN_NROFF:
+		rc = lowdown_roff_rndr(ob, rndr, n);
+		break;
+	case LOWDOWN_FODT:
+		rc = lowdown_odt_rndr(ob, rndr, n);
+		break;
+	case LOWDOWN_TERM:
+		rc = lowdown_term_rndr(ob, rndr, n);
+		break;
 	case LOWDOWN_TREE:
-		c = lowdown_tree_rndr(ob, n, opts);
+		rc = lowdown_tree_rndr(ob, n, opts);
+		break;
+	case LOWDOWN_BIN:
+		rc = lowdown_node_serialize(ob, n, mq);
 		break;
 	default:
-		c = 1;
 		break;
 	}
+	if (rc && sink != NULL)
+		rc = hbuf_flush(ob, sink, 1);
+	return rc;
+}
 
-	return c;
+struct lowdown_ctx *
+lowdown_ctx_new(const struct lowdown_opts *opts)
+{
+	struct lowdown_ctx	*ctx;
+
+	if ((ctx = calloc(1, sizeof(struct lowdown_ctx))) == NULL)
+		return NULL;
+	ctx->opts = opts;
+	ctx->type = opts == NULL ? LOWDOWN_HTML : opts->type;
+	if ((ctx->doc = lowdown_doc_new(opts)) == NULL ||
+	    !lowdown_rndr_new(opts, &ctx->rndr)) {
+		lowdown_ctx_free(ctx);
+		return NULL;
+	}
+	return ctx;
 }
 
-int
-lowdown_buf(const struct lowdown_opts *opts,
-	const char *data, size_t datasz,
-	char **res, size_t *rsz,
+/*
+ * Discard the document being given to lowdown_ctx_feed(), if any.
+ */
+static void
+lowdown_ctx_drop(struct lowdown_ctx *ctx)
+{
+
+	if (ctx->root == NULL)
+		return;
+	if (ctx->stream)
+		lowdown_html_rndr_end(ctx->ob, ctx->rndr, 0);
+	lowdown_node_free(ctx->root);
+	ctx->root = NULL;
+	ctx->stream = 0;
+}
+
+void
+lowdown_ctx_free(struct lowdown_ctx *ctx)
+{
+
+	if (ctx == NULL)
+		return;
+	lowdown_ctx_drop(ctx);
+	if (ctx->rndr != NULL)
+		lowdown_rndr_free(ctx->opts, ctx->rndr);
+	lowdown_doc_free(ctx->doc);
+	hbuf_free(ctx->ob);
+	free(ctx);
+}
+
+/*
+ * Parse and render into "ob", which is first emptied, and write it to
+ * "sink" if not NULL.  Return FALSE on failure, TRUE on success.
+ */
+static int
+lowdown_ctx_run(struct lowdown_ctx *ctx, const char *data, size_t datasz,
+	struct lowdown_buf *ob, const struct lowdown_sink *sink,
 	struct lowdown_metaq *metaq)
 {
-	struct lowdown_buf	*ob = NULL;
-	struct lowdown_doc	*doc;
-	size_t			 maxn;
-	enum lowdown_type	 t;
+	struct lowdown_metaq	 mq;
 	struct lowdown_node	*n = NULL;
+	size_t			 maxn;
 	int			 rc = 0;
 
-	t = opts == NULL ? LOWDOWN_HTML : opts->type;
+	/* Binary output always carries the metadata. */
 
-	if ((doc = lowdown_doc_new(opts)) == NULL)
-		goto err;
+	TAILQ_INIT(&mq);
+	if (metaq == NULL && ctx->type == LOWDOWN_BIN)
+		metaq = &mq;
+	lowdown_ctx_drop(ctx);
+
+	/*
+	 * Output is usually at least as long as the input, but written
+	 * output needn't be held all at once.
+	 */
 
-	n = lowdown_doc_parse(doc, &maxn, data, datasz, metaq);
+	hbuf_truncate(ob);
+	if (ctx->type != LOWDOWN_NULL && sink == NULL &&
+	    !hbuf_reserve(ob, datasz))
+		goto out;
+	n = lowdown_load(ctx->opts, ctx->doc, data, datasz, &maxn, metaq);
 	if (n == NULL)
-		goto err;
+		goto out;
 	assert(n->type == LOWDOWN_ROOT);
 
-    	if (opts != NULL && (opts->oflags & LOWDOWN_SMARTY)) 
-		if (!smarty(n, maxn, t))
-			goto err;
+	/* Binary output is of the tree as parsed. */
+
+	if (ctx->opts != NULL && (ctx->opts->oflags & LOWDOWN_SMARTY) &&
+	    ctx->type != LOWDOWN_BIN)
+		if (!smarty(n, maxn, ctx->type))
+			goto out;
+
+	rc = lowdown_rndr(ctx->opts, ctx->rndr, ob, sink, n, metaq);
+out:
+	lowdown_node_free(n);
+	lowdown_metaq_free(&mq);
+	return rc;
+}
+
+int
+lowdown_ctx_buf(struct lowdown_ctx *ctx, const char *data, size_t datasz,
+	struct lowdown_buf *ob, struct lowdown_metaq *metaq)
+{
+
+	return lowdown_ctx_run(ctx, data, datasz, ob, NULL, metaq);
+}
+
+int
+lowdown_ctx_write(struct lowdown_ctx *ctx, const char *data,
+	size_t datasz, const struct lowdown_sink *sink,
+	struct lowdown_metaq *metaq)
+{
+
+	if (ctx->ob == NULL &&
+	    (ctx->ob = hbuf_new(HBUF_START_BIG)) == NULL)
+		return 0;
+	return lowdown_ctx_run(ctx, data, datasz, ctx->ob, sink, metaq);
+}
+
+/*
+ * When streaming, render the first top-level node held by the root,
+ * then free it.  The HTML renderer doesn't use node identifiers, so
+ * those of entities added by smarty() needn't be unique.  Return FALSE
+ * on failure, TRUE on success.
+ */
+static int
+lowdown_ctx_flush(struct lowdown_ctx *ctx)
+{
+	struct lowdown_node	*n;
+	int			 rc;
+
+	if ((n = TAILQ_FIRST(&ctx->root->children)) == NULL)
+		return 1;
+	rc = (!(ctx->opts != NULL &&
+	      (ctx->opts->oflags & LOWDOWN_SMARTY)) ||
+	      smarty_top(n, n->id + 1, ctx->type)) &&
+	    lowdown_html_rndr_next(ctx->ob, ctx->rndr, n);
+	TAILQ_REMOVE(&ctx->root->children, n, entries);
+	lowdown_node_free(n);
+	return rc;
+}
+
+/*
+ * Take the top-level node "n" from lowdown_doc_feed() and add it to the
+ * tree.  If streaming, the node before it is now rendered: smarty()
+ * looks at the next node for word breaks, so each node is held until
+ * the next arrives or the document is finished.  Return FALSE on
+ * failure, TRUE on success.
+ */
+static int
+lowdown_ctx_node(struct lowdown_node *n, void *arg)
+{
+	struct lowdown_ctx	*ctx = arg;
+
+	n->parent = ctx->root;
+	TAILQ_INSERT_TAIL(&ctx->root->children, n, entries);
+	return !ctx->stream ||
+	    TAILQ_FIRST(&ctx->root->children) == n ||
+	    lowdown_ctx_flush(ctx);
+}
+
+int
+lowdown_ctx_feed(struct lowdown_ctx *ctx, const char *data,
+	size_t datasz, const struct lowdown_sink *sink)
+{
+
+	if (ctx->opts != NULL && (ctx->opts->feat & LOWDOWN_BINARY))
+		return 0;
+
+	/*
+	 * Start a new document.  Only HTML without a template can be
+	 * written as it's parsed: otherwise, the tree is rendered once
+	 * finished.
+	 */
+
+	if (ctx->root == NULL) {
+		if (ctx->ob == NULL &&
+		    (ctx->ob = hbuf_new(HBUF_START_BIG)) == NULL)
+			return 0;
+		hbuf_truncate(ctx->ob);
+		ctx->root = calloc(1, sizeof(struct lowdown_node));
+		if (ctx->root == NULL)
+			return 0;
+		ctx->root->type = LOWDOWN_ROOT;
+		TAILQ_INIT(&ctx->root->children);
+		ctx->stream = ctx->type == LOWDOWN_HTML &&
+			(ctx->opts == NULL ||
+			 !(ctx->opts->oflags & LOWDOWN_STANDALONE) ||
+			 ctx->opts->templ == NULL);
+		if (ctx->stream)
+			lowdown_html_rndr_start(ctx->rndr, sink);
+	}
+
+	if (!lowdown_doc_feed(ctx->doc, data, datasz,
+	    lowdown_ctx_node, ctx)) {
+		lowdown_ctx_drop(ctx);
+		return 0;
+	}
+	return 1;
+}
+
+int
+lowdown_ctx_finish(struct lowdown_ctx *ctx,
+	const struct lowdown_sink *sink, struct lowdown_metaq *metaq)
+{
+	struct lowdown_metaq	 mq;
+	size_t			 maxn;
+	int			 rc;
+
+	if (ctx->root == NULL &&
+	    !lowdown_ctx_feed(ctx, NULL, 0, sink))
+		return 0;
+
+	/* Binary output always carries the metadata. */
+
+	TAILQ_INIT(&mq);
+	if (metaq == NULL && ctx->type == LOWDOWN_BIN)
+		metaq = &mq;
+
+	rc = lowdown_doc_finish(ctx->doc, &maxn, metaq,
+		lowdown_ctx_node, ctx);
+	if (ctx->stream) {
+		rc = lowdown_html_rndr_end(ctx->ob, ctx->rndr,
+			rc && lowdown_ctx_flush(ctx));
+		ctx->stream = 0;
+	} else if (rc) {
+		if (ctx->opts != NULL &&
+		    (ctx->opts->oflags & LOWDOWN_SMARTY) &&
+		    ctx->type != LOWDOWN_BIN)
+			rc = smarty(ctx->root, maxn, ctx->type);
+		rc = rc && lowdown_rndr(ctx->opts, ctx->rndr,
+			ctx->ob, sink, ctx->root, metaq);
+	}
+	lowdown_ctx_drop(ctx);
+	lowdown_metaq_free(&mq);
+	return rc;
+}
 
+int
+lowdown_buf(const struct lowdown_opts *opts,
+	const char *data, size_t datasz,
+	char **res, size_t *rsz,
+	struct lowdown_metaq *metaq)
+{
+	struct lowdown_ctx	*ctx;
+	struct lowdown_buf	*ob = NULL;
+	int			 rc = 0;
+
+	if ((ctx = lowdown_ctx_new(opts)) == NULL)
+		return 0;
 	if ((ob = lowdown_buf_new(HBUF_START_BIG)) == NULL)
 		goto err;
-
-	if (!lowdown_render(opts, ob, n))
+	if (!lowdown_ctx_buf(ctx, data, datasz, ob, metaq))
 		goto err;
 
 	*res = ob->data;
@@ -140,8 +460,7 @@ lowdown_buf(const struct lowdown_opts *opts,
 	rc = 1;
 err:
 	lowdown_buf_free(ob);
-	lowdown_node_free(n);
-	lowdown_doc_free(doc);
+	lowdown_ctx_free(ctx);
 	return rc;
 }
 
@@ -157,6 +476,7 @@ lowdown_buf_diff(const struct lowdown_opts *opts,
 	struct lowdown_node 	*nnew = NULL, *nold = NULL, 
 				*ndiff = NULL;
 	size_t			 maxn;
+	void			*rndr;
 	int			 rc = 0;
 
 	t = opts == NULL ? LOWDOWN_HTML : opts->type;
@@ -164,23 +484,29 @@ lowdown_buf_diff(const struct lowdown_opts *opts,
 	if ((doc = lowdown_doc_new(opts)) == NULL)
 		goto err;
 
-	nnew = lowdown_doc_parse(doc, NULL, new, newsz, NULL);
+	nnew = lowdown_load(opts, doc, new, newsz, NULL, NULL);
 	if (nnew == NULL)
 		goto err;
-	nold = lowdown_doc_parse(doc, NULL, old, oldsz, NULL);
+	nold = lowdown_load(opts, doc, old, oldsz, NULL, NULL);
 	if (nold == NULL)
 		goto err;
 
 	ndiff = lowdown_diff(nold, nnew, &maxn);
 
-    	if (opts != NULL && (opts->oflags & LOWDOWN_SMARTY)) 
+    	if (opts != NULL && (opts->oflags & LOWDOWN_SMARTY) &&
+	    t != LOWDOWN_BIN)
 		if (!smarty(ndiff, maxn, t))
 			goto err;
 
 	if ((ob = lowdown_buf_new(HBUF_START_BIG)) == NULL)
 		goto err;
 
-	if (!lowdown_render(opts, ob, ndiff))
+	if (!lowdown_rndr_new(opts, &rndr))
+		goto err;
+	rc = lowdown_rndr(opts, rndr, ob, NULL, ndiff, NULL);
+	if (rndr != NULL)
+		lowdown_rndr_free(opts, rndr);
+	if (!rc)
 		goto err;
 
 	*res = ob->data;
@@ -245,3 +571,110 @@ out:
 	return rc;
 }
 
+/*
+ * Get all input of "fd" into "in".  Regular files read from the start
+ * are mapped, so they're parsed from the page cache without a copy.
+ * Anything else (pipes, terminals, or a mapping failure) is read into a
+ * buffer, sized by the file if possible, otherwise doubling as needed.
+ * Return FALSE on failure, TRUE on success.  In either case, the input
+ * must be freed with lowdown_input_free().
+ */
+static int
+lowdown_input(struct lowdown_input *in, int fd)
+{
+	struct stat	 st;
+	size_t		 sz = HBUF_START_BIG;
+	ssize_t		 ssz;
+	off_t		 off = -1;
+	int		 reg;
+
+	memset(in, 0, sizeof(struct lowdown_input));
+	in->data = "";
+
+	reg = fstat(fd, &st) != -1 && S_ISREG(st.st_mode) &&
+		(uintmax_t)st.st_size < SIZE_MAX &&
+		(off = lseek(fd, 0, SEEK_CUR)) != -1 && off <= st.st_size;
+
+	if (reg && off == 0 && st.st_size > 0) {
+		in->map = mmap(NULL, (size_t)st.st_size,
+			PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in->map != MAP_FAILED) {
+			in->data = in->map;
+			in->size = (size_t)st.st_size;
+			return 1;
+		}
+		in->map = NULL;
+	}
+
+	/* Leave room for reading the end of file. */
+
+	if (reg && (size_t)(st.st_size - off) >= sz)
+		sz = (size_t)(st.st_size - off) + 1;
+	if ((in->buf = hbuf_new(HBUF_START_BIG)) == NULL ||
+	    !hbuf_grow(in->buf, sz))
+		return 0;
+
+	for (;;) {
+		if (in->buf->size == in->buf->maxsize &&
+		    !hbuf_reserve(in->buf, HBUF_START_BIG))
+			return 0;
+		ssz = read(fd, in->buf->data + in->buf->size,
+			in->buf->maxsize - in->buf->size);
+		if (ssz == -1 && errno == EINTR)
+			continue;
+		if (ssz == -1)
+			return 0;
+		if (ssz == 0)
+			break;
+		in->buf->size += (size_t)ssz;
+	}
+
+	in->data = in->buf->data;
+	in->size = in->buf->size;
+	return 1;
+}
+
+static void
+lowdown_input_free(struct lowdown_input *in)
+{
+
+	if (in->map != NULL)
+		munmap(in->map, in->size);
+	hbuf_free(in->buf);
+}
+
+int
+lowdown_fd(const struct lowdown_opts *opts, int fd,
+	char **res, size_t *rsz, struct lowdown_metaq *metaq)
+{
+	struct lowdown_input	 in;
+	int			 rc = 0;
+
+	if (lowdown_input(&in, fd))
+		rc = lowdown_buf(opts,
+			in.data, in.size, res, rsz, metaq);
+	lowdown_input_free(&in);
+	return rc;
+}
+
+int
+lowdown_fd_diff(const struct lowdown_opts *opts,
+	int fdnew, int fdold, char **res, size_t *rsz)
+{
+	struct lowdown_input	 innew, inold;
+	int			 rc = 0;
+
+	/* Get both, so both may be freed. */
+
+	rc = lowdown_input(&inold, fdold);
+	if (lowdown_input(&innew, fdnew) && rc)
+		rc = lowdown_buf_diff(opts,
+			innew.data, innew.size,
+			inold.data, inold.size, res, rsz);
+	else
+		rc = 0;
+	lowdown_input_free(&inold);
+	lowdown_input_free(&innew);
+	return rc;
+}
+
@@ -26,6 +26,8 @@
 
 int
 smarty(struct lowdown_node *, size_t, enum lowdown_type);
+int
+smarty_top(struct lowdown_node *, size_t, enum lowdown_type);
 
 
 #endif /* !SMARTY_H */
@@ -171,9 +171,13 @@ smarty_entity(struct lowdown_node *n, size_t *maxn,
 
 	assert(n->type == LOWDOWN_NORMAL_TEXT);
 
-	/* Allocate the subsequent entity. */
+	/*
+	 * Allocate the subsequent entity.  New nodes come from the same
+	 * arena as the text node, if any, so the tree is released at
+	 * once.
+	 */
 
-	nent = calloc(1, sizeof(struct lowdown_node));
+	nent = arena_calloc(n->arena, 1, sizeof(struct lowdown_node));
 	if (nent == NULL)
 		return 0;
 	TAILQ_INSERT_AFTER(&n->parent->children, n, nent, entries);
@@ -181,8 +185,10 @@ smarty_entity(struct lowdown_node *n, size_t *maxn,
 	nent->id = (*maxn)++;
 	nent->type = LOWDOWN_ENTITY;
 	nent->parent = n->parent;
+	nent->arena = n->arena;
 	TAILQ_INIT(&nent->children);
-	nent->rndr_entity.text.data = strdup(ents[entity]);
+	nent->rndr_entity.text.data = arena_strndup
+		(n->arena, ents[entity], strlen(ents[entity]));
 	if (nent->rndr_entity.text.data == NULL)
 		return 0;
 	nent->rndr_entity.text.size = strlen(ents[entity]);
@@ -190,7 +196,7 @@ smarty_entity(struct lowdown_node *n, size_t *maxn,
 	/* Allocate the remaining bits, if applicable. */
 
 	if (n->rndr_normal_text.text.size - end > 0) {
-		nn = calloc(1, sizeof(struct lowdown_node));
+		nn = arena_calloc(n->arena, 1, sizeof(struct lowdown_node));
 		if (nn == NULL)
 			return 0;
 		TAILQ_INSERT_AFTER(&n->parent->children, 
@@ -199,11 +205,12 @@ smarty_entity(struct lowdown_node *n, size_t *maxn,
 		nn->id = (*maxn)++;
 		nn->type = LOWDOWN_NORMAL_TEXT;
 		nn->parent = n->parent;
+		nn->arena = n->arena;
 		TAILQ_INIT(&nn->children);
 		nn->rndr_normal_text.text.size = 
 			n->rndr_normal_text.text.size - end;
-		nn->rndr_normal_text.text.data = 
-			malloc(nn->rndr_normal_text.text.size);
+		nn->rndr_normal_text.text.data = arena_calloc
+			(n->arena, 1, nn->rndr_normal_text.text.size);
 		if (nn->rndr_normal_text.text.data == NULL)
 			return 0;
 		memcpy(nn->rndr_normal_text.text.data,
@@ -501,3 +508,17 @@ smarty(struct lowdown_node *n, size_t maxn, enum lowdown_type type)
 	assert(types[n->type] == TYPE_ROOT);
 	return smarty_block(n, &maxn, type);
 }
+
+/*
+ * Like smarty(), but only for the top-level node "n" of the tree.  Word
+ * breaks at its end look at the next top-level node, which must already
+ * be in the tree if there is one.
+ */
+int
+smarty_top(struct lowdown_node *n, size_t maxn, enum lowdown_type type)
+{
+
+	assert(n->parent != NULL && types[n->parent->type] == TYPE_ROOT);
+	return types[n->type] != TYPE_BLOCK ||
+	    smarty_block(n, &maxn, type);
+}
@@ -54,7 +54,8 @@ enum	lowdown_type {
 	LOWDOWN_FODT,
 	LOWDOWN_TERM,
 	LOWDOWN_TREE,
-	LOWDOWN_NULL
+	LOWDOWN_NULL,
+	LOWDOWN_BIN
 };
 
 enum	lowdown_rndrt {
@@ -105,6 +106,24 @@ struct	lowdown_buf {
 	int 		 buffer_free; /* obj should be freed */
 };
 
+/*
+ * Destination of output written as it's rendered: see
+ * lowdown_ctx_write().
+ */
+struct	lowdown_sink {
+	int		(*write)(const char *, size_t, void *);
+	void		*arg;	/* passed to write */
+};
+
+/*
+ * Counts of buffer growth since the process started: see
+ * lowdown_buf_stats().
+ */
+struct	lowdown_buf_stats {
+	size_t		 reallocs; /* allocations and reallocations */
+	size_t		 copied; /* bytes held when reallocated */
+};
+
 TAILQ_HEAD(lowdown_nodeq, lowdown_node);
 
 enum 	htbl_flags {
@@ -289,6 +308,8 @@ struct rndr_math {
 	int blockmode;
 };
 
+struct	lowdown_arena;
+
 /*
  * Node parsed from input document.
  * Each node is part of the parse tree.
@@ -322,6 +343,36 @@ struct	lowdown_node {
 	struct lowdown_node *parent;
 	struct lowdown_nodeq children;
 	TAILQ_ENTRY(lowdown_node) entries;
+	struct lowdown_arena *arena; /* owning arena (or NULL) */
+};
+
+/*
+ * Compact form of a parse tree made by lowdown_flat_new().  Nodes are
+ * in preorder, so the children of a node follow it, each after the
+ * descendants of the one before.
+ */
+#define	LOWDOWN_FLAT_NONE	((unsigned int)-1)
+
+struct	lowdown_flat_node {
+	unsigned int		 id; /* unique identifier */
+	unsigned int		 parent; /* parent or LOWDOWN_FLAT_NONE */
+	unsigned int		 end; /* index after last descendant */
+	unsigned int		 text; /* offset of text in text */
+	unsigned int		 textsz; /* size of text */
+	unsigned int		 ext; /* offset in exts or LOWDOWN_FLAT_NONE */
+	unsigned short		 type; /* enum lowdown_rndrt */
+	unsigned char		 chng; /* enum lowdown_chng */
+	unsigned char		 flags; /* text flags or math block mode */
+};
+
+struct	lowdown_flat {
+	struct lowdown_flat_node *nodes; /* nodes in preorder */
+	size_t			  nodesz; /* number of nodes */
+	char			 *text; /* text of all nodes */
+	size_t			  textsz; /* size of text */
+	void			 *exts; /* other type-specific fields */
+	size_t			  extsz; /* size of exts */
+	struct lowdown_arena	 *arena; /* memory of exts */
 };
 
 struct	lowdown_opts_odt {
@@ -375,6 +426,10 @@ struct	lowdown_opts {
 #define	LOWDOWN_MANTITLE	  0x100000
 #define LOWDOWN_CALLOUTS	  0x200000
 #define LOWDOWN_SUPER_SHORT	  0x400000
+#define LOWDOWN_ARENA		  0x800000 /* arena-allocate tree */
+#define LOWDOWN_REPARSE		  0x1000000 /* lowdown_doc_reparse() */
+#define LOWDOWN_PARALLEL	  0x2000000 /* parse with threads */
+#define LOWDOWN_BINARY		  0x4000000 /* input is lowdown_node_serialize() */
 	unsigned int		  oflags;
 #define LOWDOWN_SKIP_HTML	  0x01 /* skip all HTML */
 #define LOWDOWN_HTML_ESCAPE	  0x02 /* escape HTML (if not skip) */
@@ -420,6 +475,7 @@ struct	lowdown_opts {
 };
 
 
+struct lowdown_ctx;
 struct lowdown_doc;
 
 __BEGIN_DECLS
@@ -439,6 +495,22 @@ int	 lowdown_file(const struct lowdown_opts *,
 		FILE *, char **, size_t *, struct lowdown_metaq *);
 int	 lowdown_file_diff(const struct lowdown_opts *, FILE *, 
 		FILE *, char **, size_t *);
+int	 lowdown_fd(const struct lowdown_opts *, int,
+		char **, size_t *, struct lowdown_metaq *);
+int	 lowdown_fd_diff(const struct lowdown_opts *, int, int,
+		char **, size_t *);
+
+struct lowdown_ctx
+	*lowdown_ctx_new(const struct lowdown_opts *);
+int	 lowdown_ctx_buf(struct lowdown_ctx *, const char *, size_t,
+		struct lowdown_buf *, struct lowdown_metaq *);
+int	 lowdown_ctx_write(struct lowdown_ctx *, const char *, size_t,
+		const struct lowdown_sink *, struct lowdown_metaq *);
+int	 lowdown_ctx_feed(struct lowdown_ctx *, const char *, size_t,
+		const struct lowdown_sink *);
+int	 lowdown_ctx_finish(struct lowdown_ctx *,
+		const struct lowdown_sink *, struct lowdown_metaq *);
+void	 lowdown_ctx_free(struct lowdown_ctx *);
 
 /* 
  * Low-level functions.
@@ -449,12 +521,22 @@ int	 lowdown_file_diff(const struct lowdown_opts *, FILE *,
 struct lowdown_buf
 	*lowdown_buf_new(size_t) __attribute__((malloc));
 void	 lowdown_buf_free(struct lowdown_buf *);
+void	 lowdown_buf_stats(struct lowdown_buf_stats *);
 
 struct lowdown_doc
 	*lowdown_doc_new(const struct lowdown_opts *);
 struct lowdown_node
 	*lowdown_doc_parse(struct lowdown_doc *, size_t *,
 		const char *, size_t, struct lowdown_metaq *);
+struct lowdown_node
+	*lowdown_doc_reparse(struct lowdown_doc *,
+		struct lowdown_node *, size_t *, size_t, size_t,
+		const char *, size_t);
+int	 lowdown_doc_feed(struct lowdown_doc *, const char *, size_t,
+		int (*)(struct lowdown_node *, void *), void *);
+int	 lowdown_doc_finish(struct lowdown_doc *, size_t *,
+		struct lowdown_metaq *,
+		int (*)(struct lowdown_node *, void *), void *);
 struct lowdown_node
 	*lowdown_diff(const struct lowdown_node *,
 		const struct lowdown_node *, size_t *);
@@ -463,6 +545,18 @@ void	 lowdown_metaq_free(struct lowdown_metaq *);
 
 void 	 lowdown_node_free(struct lowdown_node *);
 
+struct lowdown_flat
+	*lowdown_flat_new(const struct lowdown_node *);
+struct lowdown_node
+	*lowdown_flat_tree(const struct lowdown_flat *, size_t *);
+void	 lowdown_flat_free(struct lowdown_flat *);
+
+int	 lowdown_node_serialize(struct lowdown_buf *,
+		const struct lowdown_node *, const struct lowdown_metaq *);
+struct lowdown_node
+	*lowdown_node_deserialize(const char *, size_t, size_t *,
+		struct lowdown_metaq *);
+
 void	 lowdown_html_free(void *);
 void	*lowdown_html_new(const struct lowdown_opts *);
 int 	 lowdown_html_rndr(struct lowdown_buf *, void *, 
@@ -24,9 +24,14 @@
 # include <sys/capsicum.h>
 #endif
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
 
 #include <assert.h>
+#include <dirent.h>
 #if HAVE_ERR
 # include <err.h>
 #endif
@@ -35,9 +40,14 @@
 #include <getopt.h>
 #include <limits.h> /* INT_MAX */
 #include <locale.h> /* set_locale() */
+#if HAVE_MD5
+# include <md5.h>
+#endif
+#include <pthread.h>
 #if HAVE_SANDBOX_INIT
 # include <sandbox.h>
 #endif
+#include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -52,31 +62,40 @@
 /*
  * Start with all of the sandboxes.
  * The sandbox_pre() happens before we open our input file for reading,
- * while the sandbox_post() happens afterward.
+ * while the sandbox_post() happens afterward.  When serving on a socket,
+ * sandbox_serve() replaces sandbox_post() once it's listening.
  */
 
 #if HAVE_PLEDGE
 
 static void
-sandbox_post(int fdin, int fddin, int fdout)
+sandbox_post(int fdin, int fddin, int fdout, int fdcache)
 {
 
 	if (pledge("stdio", NULL) == -1)
 		err(1, "pledge");
 }
 
+static void
+sandbox_serve(int fd)
+{
+
+	if (pledge("stdio unix", NULL) == -1)
+		err(1, "pledge");
+}
+
 static void
 sandbox_pre(void)
 {
 
-	if (pledge("stdio rpath wpath cpath", NULL) == -1)
+	if (pledge("stdio rpath wpath cpath unix", NULL) == -1)
 		err(1, "pledge");
 }
 
 #elif HAVE_SANDBOX_INIT
 
 static void
-sandbox_post(int fdin, int fddin, int fdout)
+sandbox_post(int fdin, int fddin, int fdout, int fdcache)
 {
 	char	*ep;
 	int	 rc;
@@ -110,6 +129,13 @@ sandbox_post(int fdin, int fddin, int fdout)
 	errx(1, "sandbox_init: %s", ep);
 }
 
+static void
+sandbox_serve(int fd)
+{
+
+	/* Do nothing: the profiles don't allow accepting connections. */
+}
+
 static void
 sandbox_pre(void)
 {
@@ -120,19 +146,22 @@ sandbox_pre(void)
 #elif HAVE_CAPSICUM
 
 static void
-sandbox_post(int fdin, int fddin, int fdout)
+sandbox_post(int fdin, int fddin, int fdout, int fdcache)
 {
 	cap_rights_t	 rights;
 
 	cap_rights_init(&rights);
 
-	cap_rights_init(&rights, CAP_EVENT, CAP_READ, CAP_FSTAT);
+	/* Inputs may be mapped: see lowdown_fd(). */
+
+	cap_rights_init(&rights,
+		CAP_EVENT, CAP_MMAP_R, CAP_FSTAT);
 	if (cap_rights_limit(fdin, &rights) < 0)
  		err(1, "cap_rights_limit");
 
 	if (fddin != -1) {
 		cap_rights_init(&rights, 
-			CAP_EVENT, CAP_READ, CAP_FSTAT);
+			CAP_EVENT, CAP_MMAP_R, CAP_FSTAT);
 		if (cap_rights_limit(fddin, &rights) < 0)
 			err(1, "cap_rights_limit");
 	}
@@ -145,6 +174,32 @@ sandbox_post(int fdin, int fddin, int fdout)
 	if (cap_rights_limit(fdout, &rights) < 0)
  		err(1, "cap_rights_limit");
 
+	if (fdcache != -1) {
+		cap_rights_init(&rights, CAP_WRITE, CAP_FSTAT);
+		if (cap_rights_limit(fdcache, &rights) < 0)
+			err(1, "cap_rights_limit");
+	}
+
+	if (cap_enter())
+		err(1, "cap_enter");
+}
+
+static void
+sandbox_serve(int fd)
+{
+	cap_rights_t	 rights;
+
+	/* Accepted connections inherit these rights. */
+
+	cap_rights_init(&rights, CAP_ACCEPT,
+		CAP_EVENT, CAP_READ, CAP_WRITE, CAP_FSTAT);
+	if (cap_rights_limit(fd, &rights) < 0)
+		err(1, "cap_rights_limit");
+
+	cap_rights_init(&rights, CAP_EVENT, CAP_WRITE, CAP_FSTAT);
+	if (cap_rights_limit(STDERR_FILENO, &rights) < 0)
+ 		err(1, "cap_rights_limit");
+
 	if (cap_enter())
 		err(1, "cap_enter");
 }
@@ -171,7 +226,14 @@ sandbox_pre(void)
 #endif
 
 static void
-sandbox_post(int fdin, int fddin, int fdout)
+sandbox_post(int fdin, int fddin, int fdout, int fdcache)
+{
+
+	/* Do nothing. */
+}
+
+static void
+sandbox_serve(int fd)
 {
 
 	/* Do nothing. */
@@ -204,10 +266,11 @@ get_columns(void)
  * Recognise the metadata format of "foo = bar" and "foo: bar".
  * Translates from the former into the latter.
  * This way "foo = : bar" -> "foo : : bar", etc.
- * Errors out if the metadata is malformed (no colon or equal sign).
+ * Returns the pair or NULL if the metadata is malformed (no colon or
+ * equal sign).  Exits on memory failure.
  */
-static void
-metadata_parse(char opt, char ***vals, size_t *valsz, const char *arg)
+static char *
+metadata_pair(const char *arg)
 {
 	const char	*loceq, *loccol;
 	char		*cp;
@@ -220,25 +283,68 @@ metadata_parse(char opt, char ***vals, size_t *valsz, const char *arg)
 		if (asprintf(&cp, "%.*s: %s\n",
 		    (int)(loceq - arg), arg, loceq + 1) == -1)
 			err(1, NULL);
-		*vals = reallocarray(*vals, *valsz + 1, sizeof(char *));
-		if (*vals == NULL)
-			err(1, NULL);
-		(*vals)[*valsz] = cp;
-		(*valsz)++;
-		return;
+		return cp;
 	}
 	if ((loccol != NULL && loceq == NULL) ||
 	    (loccol != NULL && loceq != NULL && loccol < loceq)) {
 		if (asprintf(&cp, "%s\n", arg) == -1)
 			err(1, NULL);
-		*vals = reallocarray(*vals, *valsz + 1, sizeof(char *));
-		if (*vals == NULL)
-			err(1, NULL);
-		(*vals)[*valsz] = cp;
-		(*valsz)++;
-		return;
+		return cp;
 	}
-	errx(1, "-%c: malformed metadata", opt);
+	return NULL;
+}
+
+/*
+ * Append the metadata_pair() of "arg" to "vals" of size "valsz".
+ * Errors out if the metadata is malformed.
+ */
+static void
+metadata_parse(char opt, char ***vals, size_t *valsz, const char *arg)
+{
+	char	*cp;
+
+	if ((cp = metadata_pair(arg)) == NULL)
+		errx(1, "-%c: malformed metadata", opt);
+	*vals = reallocarray(*vals, *valsz + 1, sizeof(char *));
+	if (*vals == NULL)
+		err(1, NULL);
+	(*vals)[*valsz] = cp;
+	(*valsz)++;
+}
+
+/*
+ * Set "type" to the output mode named by "arg".  Returns zero if it's
+ * unknown, non-zero on success.
+ */
+static int
+type_parse(const char *arg, enum lowdown_type *type)
+{
+
+	if (strcasecmp(arg, "ms") == 0)
+		*type = LOWDOWN_MS;
+	else if (strcasecmp(arg, "gemini") == 0)
+		*type = LOWDOWN_GEMINI;
+	else if (strcasecmp(arg, "html") == 0)
+		*type = LOWDOWN_HTML;
+	else if (strcasecmp(arg, "latex") == 0)
+		*type = LOWDOWN_LATEX;
+	else if (strcasecmp(arg, "man") == 0)
+		*type = LOWDOWN_MAN;
+	else if (strcasecmp(arg, "mdoc") == 0)
+		*type = LOWDOWN_MDOC;
+	else if (strcasecmp(arg, "fodt") == 0)
+		*type = LOWDOWN_FODT;
+	else if (strcasecmp(arg, "term") == 0)
+		*type = LOWDOWN_TERM;
+	else if (strcasecmp(arg, "tree") == 0)
+		*type = LOWDOWN_TREE;
+	else if (strcasecmp(arg, "null") == 0)
+		*type = LOWDOWN_NULL;
+	else if (strcasecmp(arg, "bin") == 0)
+		*type = LOWDOWN_BIN;
+	else
+		return 0;
+	return 1;
 }
 
 /*
@@ -276,6 +382,1190 @@ readfile(const char *fn)
 	return orig;
 }
 
+/*
+ * Read all of the stream "f" into the NUL-terminated return pointer,
+ * setting its length in "sz".  Returns NULL on read failure (exits on
+ * memory failure).
+ */
+static char *
+readstream(FILE *f, size_t *sz)
+{
+	char	*buf = NULL, *nbuf;
+	size_t	 bufsz = 0, ssz;
+
+	*sz = 0;
+	do {
+		if (*sz + 1 >= bufsz) {
+			bufsz = bufsz == 0 ? 8192 : bufsz * 2;
+			if ((nbuf = realloc(buf, bufsz)) == NULL)
+				err(1, NULL);
+			buf = nbuf;
+		}
+		ssz = fread(buf + *sz, 1, bufsz - *sz - 1, f);
+		*sz += ssz;
+	} while (ssz > 0);
+
+	if (ferror(f)) {
+		free(buf);
+		return NULL;
+	}
+	buf[*sz] = '\0';
+	return buf;
+}
+
+/*
+ * Input read by input_get().
+ */
+struct	input {
+	char		*data; /* contents */
+	size_t		 size; /* length of data */
+	int		 map; /* whether data is mapped */
+};
+
+/*
+ * Get all of "f" into "in".  Regular files read from their start are
+ * mapped instead of copied; anything else goes through readstream().
+ * Returns zero on read failure (exits on memory failure).  On success,
+ * the input must be freed with input_free().
+ */
+static int
+input_get(FILE *f, struct input *in)
+{
+	struct stat	 st;
+	void		*map;
+
+	memset(in, 0, sizeof(struct input));
+	if (fstat(fileno(f), &st) != -1 && S_ISREG(st.st_mode) &&
+	    st.st_size > 0 && (uint64_t)st.st_size < SIZE_MAX &&
+	    ftello(f) == 0 && lseek(fileno(f), 0, SEEK_CUR) == 0) {
+		map = mmap(NULL, (size_t)st.st_size,
+			PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (map != MAP_FAILED) {
+			in->data = map;
+			in->size = (size_t)st.st_size;
+			in->map = 1;
+			return 1;
+		}
+	}
+	return (in->data = readstream(f, &in->size)) != NULL;
+}
+
+static void
+input_free(struct input *in)
+{
+
+	if (in->map)
+		munmap(in->data, in->size);
+	else
+		free(in->data);
+}
+
+/*
+ * Output of lowdown_ctx_write() to a stream.  The error of a failed
+ * write is kept to tell it from a failed parse.
+ */
+struct	sink_out {
+	FILE		*f; /* output stream */
+	int		 err; /* errno of failed write or zero */
+};
+
+/*
+ * Output sink of lowdown_ctx_write() to the sink_out "arg".
+ */
+static int
+sink_write(const char *buf, size_t sz, void *arg)
+{
+	struct sink_out	*out = arg;
+
+	errno = 0;
+	if (fwrite(buf, 1, sz, out->f) == sz)
+		return 1;
+	out->err = errno != 0 ? errno : EIO;
+	return 0;
+}
+
+/*
+ * Parse the stream "f" with "ctx" in parts as it's read, writing the
+ * output to "sink", so memory needn't grow with the input.  Return -1
+ * on read failure, zero on parse or write failure, one on success.
+ */
+static int
+input_feed(FILE *f, struct lowdown_ctx *ctx,
+    const struct lowdown_sink *sink)
+{
+	char	 buf[8192];
+	size_t	 sz;
+
+	while ((sz = fread(buf, 1, sizeof(buf), f)) > 0)
+		if (!lowdown_ctx_feed(ctx, buf, sz, sink))
+			return 0;
+	if (ferror(f))
+		return -1;
+	return lowdown_ctx_finish(ctx, sink, NULL);
+}
+
+/*
+ * The render cache (--cache-dir) holds rendered output in files named
+ * by the MD5 of the input and everything affecting its output.  Each
+ * file starts with CACHE_MAGIC, the output's length as 8 little-endian
+ * bytes, and the output's MD5, which are checked when it's read.
+ */
+#define	CACHE_MAGIC	"LDCACHE1"
+#define	CACHE_HEADSZ	(8 + 8 + MD5_DIGEST_LENGTH)
+#define	CACHE_MAX	(64 * 1024 * 1024)
+
+struct	cache_ent {
+	char		 name[MD5_DIGEST_STRING_LENGTH];
+	off_t		 size;
+	time_t		 mtime;
+};
+
+static void
+cache_hash_num(MD5_CTX *ctx, uint64_t v)
+{
+	uint8_t	 b[8];
+	size_t	 i;
+
+	for (i = 0; i < 8; i++)
+		b[i] = (v >> (i * 8)) & 0xff;
+	MD5Update(ctx, b, sizeof(b));
+}
+
+/*
+ * Hash a string "s" of length "sz", which may be NULL, such that no
+ * sequence of strings hashes like another.
+ */
+static void
+cache_hash_str(MD5_CTX *ctx, const char *s, size_t sz)
+{
+
+	if (s == NULL) {
+		cache_hash_num(ctx, UINT64_MAX);
+		return;
+	}
+	cache_hash_num(ctx, sz);
+	MD5Update(ctx, (const uint8_t *)s, sz);
+}
+
+static void
+cache_hash_strs(MD5_CTX *ctx, char **s, size_t sz)
+{
+	size_t	 i;
+
+	cache_hash_num(ctx, sz);
+	for (i = 0; i < sz; i++)
+		cache_hash_str(ctx, s[i], strlen(s[i]));
+}
+
+static void
+cache_hash_cstr(MD5_CTX *ctx, const char *s)
+{
+
+	cache_hash_str(ctx, s, s == NULL ? 0 : strlen(s));
+}
+
+/*
+ * Fill in "key" with the cache key of "in" of length "insz" rendered
+ * with "opts".  This covers the version, all options (including file
+ * contents like the template), and the locale, which affects the
+ * width of terminal and Gemini output.
+ */
+static void
+cache_key(char *key, const struct lowdown_opts *opts,
+	const char *in, size_t insz)
+{
+	MD5_CTX	 ctx;
+
+	MD5Init(&ctx);
+	cache_hash_cstr(&ctx, VERSION);
+	cache_hash_num(&ctx, opts->type);
+	cache_hash_num(&ctx, opts->maxdepth);
+	cache_hash_num(&ctx, opts->feat);
+	cache_hash_num(&ctx, opts->oflags);
+
+	switch (opts->type) {
+	case LOWDOWN_FODT:
+		cache_hash_cstr(&ctx, opts->odt.sty);
+		break;
+	case LOWDOWN_MAN:
+	case LOWDOWN_MDOC:
+	case LOWDOWN_MS:
+	case LOWDOWN_NROFF:
+		cache_hash_cstr(&ctx, opts->nroff.cr);
+		cache_hash_cstr(&ctx, opts->nroff.cb);
+		cache_hash_cstr(&ctx, opts->nroff.ci);
+		cache_hash_cstr(&ctx, opts->nroff.cbi);
+		break;
+	case LOWDOWN_TERM:
+		cache_hash_num(&ctx, opts->term.cols);
+		cache_hash_num(&ctx, opts->term.width);
+		cache_hash_num(&ctx, opts->term.hmargin);
+		cache_hash_num(&ctx, opts->term.hpadding);
+		cache_hash_num(&ctx, opts->term.vmargin);
+		cache_hash_num(&ctx, opts->term.centre);
+		break;
+	default:
+		break;
+	}
+
+	cache_hash_strs(&ctx, opts->meta, opts->metasz);
+	cache_hash_strs(&ctx, opts->metaovr, opts->metaovrsz);
+	cache_hash_cstr(&ctx, opts->templ);
+	cache_hash_cstr(&ctx, setlocale(LC_CTYPE, NULL));
+	cache_hash_str(&ctx, in, insz);
+	MD5End(&ctx, key);
+}
+
+/*
+ * Look up the output for "key" in the cache directory "dir".  If found
+ * and intact, set "res" and "ressz" to a copy of it, mark it as recently
+ * used, and return TRUE.  Otherwise return FALSE.
+ */
+static int
+cache_get(const char *dir, const char *key, char **res, size_t *ressz)
+{
+	char		 path[PATH_MAX], *buf = NULL, *cp;
+	uint8_t		 md[MD5_DIGEST_LENGTH];
+	MD5_CTX		 ctx;
+	struct stat	 st;
+	uint64_t	 sz = 0;
+	size_t		 i, left;
+	ssize_t		 ssz;
+	int		 fd, rc = 0;
+
+	if ((size_t)snprintf(path, sizeof(path),
+	    "%s/%s", dir, key) >= sizeof(path))
+		errx(1, "%s: path too long", dir);
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		if (errno != ENOENT)
+			warn("%s", path);
+		return 0;
+	}
+	if (fstat(fd, &st) == -1) {
+		warn("%s", path);
+		goto out;
+	}
+	if (st.st_size < CACHE_HEADSZ ||
+	    (uint64_t)st.st_size > SIZE_MAX - 1)
+		goto out;
+	if ((buf = malloc((size_t)st.st_size + 1)) == NULL)
+		err(1, NULL);
+	for (cp = buf, left = (size_t)st.st_size; left > 0; ) {
+		if ((ssz = read(fd, cp, left)) == -1) {
+			warn("%s", path);
+			goto out;
+		} else if (ssz == 0)
+			goto out;
+		cp += ssz;
+		left -= (size_t)ssz;
+	}
+
+	/* Check the magic, length, and checksum. */
+
+	if (memcmp(buf, CACHE_MAGIC, 8) != 0)
+		goto out;
+	for (i = 0; i < 8; i++)
+		sz |= (uint64_t)(unsigned char)buf[8 + i] << (i * 8);
+	if (sz != (uint64_t)st.st_size - CACHE_HEADSZ)
+		goto out;
+	MD5Init(&ctx);
+	MD5Update(&ctx, (const uint8_t *)buf + CACHE_HEADSZ, sz);
+	MD5Final(md, &ctx);
+	if (memcmp(md, buf + 16, MD5_DIGEST_LENGTH) != 0)
+		goto out;
+
+	if (futimens(fd, NULL) == -1)
+		warn("%s", path);
+	memmove(buf, buf + CACHE_HEADSZ, sz);
+	buf[sz] = '\0';
+	*res = buf;
+	*ressz = sz;
+	buf = NULL;
+	rc = 1;
+out:
+	free(buf);
+	close(fd);
+	return rc;
+}
+
+static int
+cache_ent_cmp(const void *p1, const void *p2)
+{
+	const struct cache_ent	*e1 = p1, *e2 = p2;
+
+	if (e1->mtime != e2->mtime)
+		return e1->mtime < e2->mtime ? -1 : 1;
+	return strcmp(e1->name, e2->name);
+}
+
+/*
+ * Remove the least recently used entries from the cache directory "dir"
+ * until it holds at most "max" bytes.  Errors are not fatal.
+ */
+static void
+cache_evict(const char *dir, long long max)
+{
+	DIR			*dp;
+	struct dirent		*dent;
+	struct stat		 st;
+	struct cache_ent	*ents = NULL, *nents;
+	char			 path[PATH_MAX];
+	size_t			 i, entsz = 0, entmax = 0;
+	long long		 total = 0;
+
+	if ((dp = opendir(dir)) == NULL) {
+		warn("%s", dir);
+		return;
+	}
+	while ((dent = readdir(dp)) != NULL) {
+		if (strlen(dent->d_name) != MD5_DIGEST_STRING_LENGTH - 1 ||
+		    strspn(dent->d_name, "0123456789abcdef") !=
+		    MD5_DIGEST_STRING_LENGTH - 1)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, dent->d_name);
+		if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+			continue;
+		if (entsz == entmax) {
+			entmax = entmax == 0 ? 64 : entmax * 2;
+			nents = reallocarray(ents, entmax,
+				sizeof(struct cache_ent));
+			if (nents == NULL)
+				err(1, NULL);
+			ents = nents;
+		}
+		strlcpy(ents[entsz].name, dent->d_name,
+			sizeof(ents[entsz].name));
+		ents[entsz].size = st.st_size;
+		ents[entsz].mtime = st.st_mtime;
+		total += st.st_size;
+		entsz++;
+	}
+	closedir(dp);
+
+	if (total > max) {
+		qsort(ents, entsz, sizeof(struct cache_ent), cache_ent_cmp);
+		for (i = 0; i < entsz && total > max; i++) {
+			snprintf(path, sizeof(path),
+				"%s/%s", dir, ents[i].name);
+			if (unlink(path) == -1 && errno != ENOENT)
+				warn("%s", path);
+			else
+				total -= ents[i].size;
+		}
+	}
+	free(ents);
+}
+
+/*
+ * Create the entry for "key" in the cache directory "dir" after making
+ * room if "max" is non-zero.  This happens before the sandbox, so the
+ * entry is put in place empty and filled in afterward by cache_put():
+ * until then, it fails the checks of cache_get().  Returns the open
+ * entry or -1 on failure, which is not fatal.
+ */
+static int
+cache_new(const char *dir, const char *key, long long max)
+{
+	char	 path[PATH_MAX], tmp[PATH_MAX];
+	int	 fd;
+
+	if (max > 0)
+		cache_evict(dir, max);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, key);
+	if ((size_t)snprintf(tmp, sizeof(tmp),
+	    "%s/.tmp.XXXXXXXXXX", dir) >= sizeof(tmp))
+		errx(1, "%s: path too long", dir);
+	if ((fd = mkstemp(tmp)) == -1) {
+		warn("%s", tmp);
+		return -1;
+	}
+	if (rename(tmp, path) == -1) {
+		warn("%s", path);
+		unlink(tmp);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Write all of "buf" of length "sz" to "fd".  Return FALSE on failure,
+ * TRUE on success.
+ */
+static int
+writeall(int fd, const char *buf, size_t sz)
+{
+	ssize_t	 ssz;
+
+	while (sz > 0) {
+		if ((ssz = write(fd, buf, sz)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		buf += ssz;
+		sz -= (size_t)ssz;
+	}
+	return 1;
+}
+
+/*
+ * Write the output "buf" of length "sz" into the entry "fd" opened by
+ * cache_new(), then close it.  Errors are not fatal.
+ */
+static void
+cache_put(int fd, const char *buf, size_t sz)
+{
+	char	 head[CACHE_HEADSZ];
+	MD5_CTX	 ctx;
+	size_t	 i;
+
+	memcpy(head, CACHE_MAGIC, 8);
+	for (i = 0; i < 8; i++)
+		head[8 + i] = ((uint64_t)sz >> (i * 8)) & 0xff;
+	MD5Init(&ctx);
+	MD5Update(&ctx, (const uint8_t *)buf, sz);
+	MD5Final((uint8_t *)head + 16, &ctx);
+
+	if (!writeall(fd, head, sizeof(head)) ||
+	    !writeall(fd, buf, sz))
+		warn("cache");
+	close(fd);
+}
+
+/*
+ * An input of batch mode (--outdir) and its output file.
+ */
+struct	batch_job {
+	const char		*fn; /* input file */
+	char			*out; /* output file */
+};
+
+/*
+ * State shared by the batch_worker() threads.
+ */
+struct	batch {
+	pthread_mutex_t		 mutex; /* protects "next" and "rc" */
+	const struct lowdown_opts *opts; /* shared output options */
+	const char		*cachedir; /* cache directory or NULL */
+	struct batch_job	*jobs; /* inputs */
+	size_t			 jobsz; /* number of inputs */
+	size_t			 next; /* next input to render */
+	int			 rc; /* zero if any input failed */
+};
+
+/*
+ * The file name suffix of output for "type" or NULL if none is written.
+ */
+static const char *
+batch_suffix(enum lowdown_type type)
+{
+
+	switch (type) {
+	case LOWDOWN_BIN:
+		return "bin";
+	case LOWDOWN_FODT:
+		return "fodt";
+	case LOWDOWN_GEMINI:
+		return "gmi";
+	case LOWDOWN_HTML:
+		return "html";
+	case LOWDOWN_LATEX:
+		return "tex";
+	case LOWDOWN_MAN:
+		return "man";
+	case LOWDOWN_MDOC:
+		return "mdoc";
+	case LOWDOWN_MS:
+		return "ms";
+	case LOWDOWN_TERM:
+		return "txt";
+	case LOWDOWN_TREE:
+		return "tree";
+	default:
+		break;
+	}
+	return NULL;
+}
+
+static int
+batch_job_cmp(const void *p1, const void *p2)
+{
+	const struct batch_job	*j1 = p1, *j2 = p2;
+
+	return strcmp(j1->out, j2->out);
+}
+
+/*
+ * Render the input of "job" into its output file with the worker's
+ * context "ctx" and output buffer "ob", using the cache if configured.
+ * Errors are reported but not fatal.  Returns zero on failure, non-zero
+ * on success.
+ */
+static int
+batch_render(const struct batch *b, struct lowdown_ctx *ctx,
+    struct lowdown_buf *ob, const struct batch_job *job)
+{
+	FILE		*f;
+	struct input	 in;
+	char		*cached = NULL, key[MD5_DIGEST_STRING_LENGTH];
+	const char	*ret;
+	size_t		 retsz = 0;
+	int		 c, fd, cachefd = -1, rc = 0;
+
+	if ((f = fopen(job->fn, "r")) == NULL) {
+		warn("%s", job->fn);
+		return 0;
+	}
+	c = input_get(f, &in);
+	fclose(f);
+	if (!c) {
+		warn("%s", job->fn);
+		return 0;
+	}
+
+	if (b->cachedir != NULL) {
+		cache_key(key, b->opts, in.data, in.size);
+		if (!cache_get(b->cachedir, key, &cached, &retsz))
+			cachefd = cache_new(b->cachedir, key, 0);
+	}
+	if ((ret = cached) == NULL) {
+		if (!lowdown_ctx_buf(ctx, in.data, in.size, ob, NULL)) {
+			warnx("%s: failed parse", job->fn);
+			if (cachefd != -1)
+				close(cachefd);
+			goto out;
+		}
+		ret = ob->data;
+		retsz = ob->size;
+		if (cachefd != -1)
+			cache_put(cachefd, ret, retsz);
+	}
+
+	if (job->out == NULL) {
+		rc = 1;
+		goto out;
+	}
+	if ((fd = open(job->out,
+	    O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+		warn("%s", job->out);
+		goto out;
+	}
+	if (!writeall(fd, ret, retsz))
+		warn("%s", job->out);
+	else
+		rc = 1;
+	if (close(fd) == -1 && rc) {
+		warn("%s", job->out);
+		rc = 0;
+	}
+out:
+	free(cached);
+	input_free(&in);
+	return rc;
+}
+
+/*
+ * Render inputs until none are left.  The parser, renderer, and output
+ * buffer are kept from one input to the next.  Exits on memory failure.
+ */
+static void *
+batch_worker(void *arg)
+{
+	struct batch		*b = arg;
+	struct lowdown_ctx	*ctx;
+	struct lowdown_buf	*ob;
+	size_t			 i;
+
+	if ((ctx = lowdown_ctx_new(b->opts)) == NULL ||
+	    (ob = lowdown_buf_new(4096)) == NULL)
+		err(1, NULL);
+
+	for (;;) {
+		pthread_mutex_lock(&b->mutex);
+		i = b->next < b->jobsz ? b->next++ : b->jobsz;
+		pthread_mutex_unlock(&b->mutex);
+		if (i == b->jobsz)
+			break;
+		if (!batch_render(b, ctx, ob, &b->jobs[i])) {
+			pthread_mutex_lock(&b->mutex);
+			b->rc = 0;
+			pthread_mutex_unlock(&b->mutex);
+		}
+	}
+
+	lowdown_buf_free(ob);
+	lowdown_ctx_free(ctx);
+	return NULL;
+}
+
+/*
+ * Batch mode (--outdir): render each of the "filesz" inputs in "files"
+ * (or, if none, those named one per line on standard input) into the
+ * directory "outdir" with "threads" threads, or one per processor if
+ * zero.  Each output is named by the input's base name, stripped of its
+ * last suffix, with the suffix of the output type.  Returns zero if any
+ * input failed, non-zero on success.
+ */
+static int
+batch(const struct lowdown_opts *opts, const char *outdir,
+    char **files, size_t filesz, const char *cachedir,
+    long long cachemax, size_t threads)
+{
+	struct batch	 b;
+	pthread_t	*tids = NULL;
+	const char	*suffix, *base, *dot;
+	char		*line = NULL;
+	size_t		 i, linesz = 0, jobmax = 0, nw;
+	ssize_t		 len;
+	long		 ncpu;
+	void		*pp;
+
+	memset(&b, 0, sizeof(struct batch));
+	b.opts = opts;
+	b.cachedir = cachedir;
+	b.rc = 1;
+
+	/* Collect the inputs from the arguments or standard input. */
+
+	if (filesz > 0) {
+		if ((b.jobs = calloc(filesz,
+		    sizeof(struct batch_job))) == NULL)
+			err(1, NULL);
+		for (i = 0; i < filesz; i++)
+			b.jobs[i].fn = files[i];
+		b.jobsz = filesz;
+	} else {
+		while ((len = getline(&line, &linesz, stdin)) != -1) {
+			if (len > 0 && line[len - 1] == '\n')
+				line[--len] = '\0';
+			if (len == 0)
+				continue;
+			if (b.jobsz == jobmax) {
+				jobmax = jobmax == 0 ? 64 : jobmax * 2;
+				pp = reallocarray(b.jobs, jobmax,
+					sizeof(struct batch_job));
+				if (pp == NULL)
+					err(1, NULL);
+				b.jobs = pp;
+			}
+			if ((b.jobs[b.jobsz].fn = strdup(line)) == NULL)
+				err(1, NULL);
+			b.jobs[b.jobsz++].out = NULL;
+		}
+		if (ferror(stdin))
+			err(1, "<stdin>");
+		free(line);
+	}
+
+	/*
+	 * Name the outputs, making sure that no two inputs would write
+	 * to the same file.
+	 */
+
+	if ((suffix = batch_suffix(opts->type)) != NULL) {
+		if (mkdir(outdir, 0777) == -1 && errno != EEXIST)
+			err(1, "%s", outdir);
+		for (i = 0; i < b.jobsz; i++) {
+			if ((base = strrchr(b.jobs[i].fn, '/')) != NULL)
+				base++;
+			else
+				base = b.jobs[i].fn;
+			if ((dot = strrchr(base, '.')) == NULL ||
+			    dot == base)
+				dot = base + strlen(base);
+			if (asprintf(&b.jobs[i].out, "%s/%.*s.%s", outdir,
+			    (int)(dot - base), base, suffix) == -1)
+				err(1, NULL);
+		}
+		qsort(b.jobs, b.jobsz,
+			sizeof(struct batch_job), batch_job_cmp);
+		for (i = 1; i < b.jobsz; i++)
+			if (strcmp(b.jobs[i - 1].out, b.jobs[i].out) == 0)
+				errx(1, "%s: output of both %s and %s",
+					b.jobs[i].out, b.jobs[i - 1].fn,
+					b.jobs[i].fn);
+	}
+
+	if (cachedir != NULL) {
+		if (mkdir(cachedir, 0777) == -1 && errno != EEXIST)
+			err(1, "%s", cachedir);
+		if (cachemax > 0)
+			cache_evict(cachedir, cachemax);
+	}
+
+	/* Run the workers, the first of which is this thread. */
+
+	if ((nw = threads) == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nw = ncpu < 1 ? 1 : (size_t)ncpu;
+	}
+	if (nw > b.jobsz)
+		nw = b.jobsz;
+
+	if (pthread_mutex_init(&b.mutex, NULL) != 0)
+		errx(1, "pthread_mutex_init");
+	if (nw > 1 && (tids = calloc(nw, sizeof(pthread_t))) == NULL)
+		err(1, NULL);
+	for (i = 1; i < nw; i++)
+		if (pthread_create(&tids[i], NULL, batch_worker, &b) != 0)
+			break;
+	nw = i;
+	batch_worker(&b);
+	for (i = 1; i < nw; i++)
+		pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&b.mutex);
+
+	for (i = 0; i < b.jobsz; i++) {
+		free(b.jobs[i].out);
+		if (filesz == 0)
+			free((char *)b.jobs[i].fn);
+	}
+	free(b.jobs);
+	free(tids);
+	return b.rc;
+}
+
+/*
+ * The resident server (--serve) reads requests and writes responses as
+ * frames: a 4-byte big-endian length, then that many bytes.  Within a
+ * frame, numbers are also 4-byte big-endian and strings are a number
+ * (the length) followed by the bytes.  A request is the number of
+ * options, the options as strings, then the document string.  A
+ * response is a status, zero on success, then the number of metadata
+ * pairs, each pair's key and value strings, then the output string.
+ * On failure, the status is non-zero and followed by an error message
+ * string.
+ */
+#define	SERVE_MAX	(64 * 1024 * 1024)
+
+/*
+ * State shared by the serve_worker() threads.
+ */
+struct	serve {
+	const struct lowdown_opts *opts; /* options for all requests */
+	struct lowdown_opts_term  term; /* term options for -tterm */
+	struct lowdown_opts_nroff nroff; /* roff options for -tman, etc. */
+	struct lowdown_opts_odt	  odt; /* odt options for -tfodt */
+	int			  fd; /* listening socket */
+};
+
+/*
+ * Fill in "buf" of length "sz" from "fd" until end of file.  Returns the
+ * number of bytes read, which is less than "sz" only at end of file, or
+ * -1 on failure.
+ */
+static ssize_t
+readall(int fd, char *buf, size_t sz)
+{
+	ssize_t	 ssz;
+	size_t	 off = 0;
+
+	while (off < sz) {
+		if ((ssz = read(fd, buf + off, sz - off)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ssz == 0)
+			break;
+		off += (size_t)ssz;
+	}
+	return off;
+}
+
+static uint32_t
+serve_get32(const char *buf)
+{
+	const unsigned char	*cp = (const unsigned char *)buf;
+
+	return (uint32_t)cp[0] << 24 | (uint32_t)cp[1] << 16 |
+		(uint32_t)cp[2] << 8 | (uint32_t)cp[3];
+}
+
+static char *
+serve_put32(char *buf, uint32_t v)
+{
+
+	buf[0] = (v >> 24) & 0xff;
+	buf[1] = (v >> 16) & 0xff;
+	buf[2] = (v >> 8) & 0xff;
+	buf[3] = v & 0xff;
+	return buf + 4;
+}
+
+static char *
+serve_putstr(char *buf, const char *s, size_t sz)
+{
+
+	buf = serve_put32(buf, sz);
+	if (sz > 0)
+		memcpy(buf, s, sz);
+	return buf + sz;
+}
+
+/*
+ * Read a string from the request "buf" of length "sz" at "*pos",
+ * advancing it.  Returns zero if the request is too short, non-zero on
+ * success.
+ */
+static int
+serve_getstr(const char *buf, size_t sz, size_t *pos,
+    const char **s, size_t *ssz)
+{
+
+	if (sz - *pos < 4)
+		return 0;
+	*ssz = serve_get32(buf + *pos);
+	*pos += 4;
+	if (sz - *pos < *ssz)
+		return 0;
+	*s = buf + *pos;
+	*pos += *ssz;
+	return 1;
+}
+
+/*
+ * Make the response frame "res" of length "ressz" for a failure with
+ * the message "msg".
+ */
+static void
+serve_error(char **res, size_t *ressz, const char *msg)
+{
+	char	*cp;
+	size_t	 sz = strlen(msg);
+
+	*ressz = 4 + 4 + 4 + sz;
+	if ((*res = cp = malloc(*ressz)) == NULL)
+		err(1, NULL);
+	cp = serve_put32(cp, *ressz - 4);
+	cp = serve_put32(cp, 1);
+	serve_putstr(cp, msg, sz);
+}
+
+/*
+ * Select the options of the output mode of "opts".
+ */
+static void
+serve_mode(const struct serve *s, struct lowdown_opts *opts)
+{
+
+	switch (opts->type) {
+	case LOWDOWN_TERM:
+		opts->term = s->term;
+		break;
+	case LOWDOWN_MAN:
+	case LOWDOWN_MDOC:
+	case LOWDOWN_MS:
+		opts->nroff = s->nroff;
+		break;
+	case LOWDOWN_FODT:
+		opts->odt = s->odt;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Render the request "req" of length "reqsz" into the response frame
+ * "res" of length "ressz", using the connection's context "ctx" and
+ * output buffer "ob".  Options in the request may change the output
+ * mode (-t), make output standalone (-s), and add metadata (-m and -M)
+ * for this request only, in which case a context is made for it.
+ * Request errors are reported in the response.  Exits on memory
+ * failure.
+ */
+static void
+serve_request(const struct serve *s, struct lowdown_ctx *ctx,
+    struct lowdown_buf *ob, const char *req, size_t reqsz,
+    char **res, size_t *ressz)
+{
+	struct lowdown_opts	 opts;
+	struct lowdown_metaq	 mq;
+	struct lowdown_meta	*m;
+	struct lowdown_ctx	*rctx = NULL;
+	const char		*arg, *doc;
+	char			*cp, *opt = NULL, **meta = NULL,
+				**metaovr = NULL, ***vals, msg[128];
+	size_t			 i, pos = 0, argc, argsz, docsz,
+				 metasz = 0, metaovrsz = 0, sz, nmeta = 0,
+				*valsz;
+
+	TAILQ_INIT(&mq);
+	opts = *s->opts;
+	*msg = '\0';
+
+	if (reqsz < 4) {
+		strlcpy(msg, "malformed request", sizeof(msg));
+		goto out;
+	}
+	argc = serve_get32(req);
+	pos = 4;
+
+	for (i = 0; i < argc; i++) {
+		if (!serve_getstr(req, reqsz, &pos, &arg, &argsz)) {
+			strlcpy(msg, "malformed request", sizeof(msg));
+			goto out;
+		}
+		free(opt);
+		if ((opt = strndup(arg, argsz)) == NULL)
+			err(1, NULL);
+		if (strcmp(opt, "-s") == 0) {
+			opts.oflags |= LOWDOWN_STANDALONE;
+			continue;
+		}
+		if (strncmp(opt, "-t", 2) == 0 ||
+		    strncmp(opt, "-T", 2) == 0) {
+			if (type_parse(opt + 2, &opts.type))
+				continue;
+		} else if (strncmp(opt, "-m", 2) == 0 ||
+		    strncmp(opt, "-M", 2) == 0) {
+			if ((cp = metadata_pair(opt + 2)) != NULL) {
+				vals = opt[1] == 'm' ? &meta : &metaovr;
+				valsz = opt[1] == 'm' ? &metasz : &metaovrsz;
+				*vals = reallocarray(*vals,
+					*valsz + 1, sizeof(char *));
+				if (*vals == NULL)
+					err(1, NULL);
+				(*vals)[(*valsz)++] = cp;
+				continue;
+			}
+		}
+		snprintf(msg, sizeof(msg), "%.64s: bad option", opt);
+		goto out;
+	}
+	if (!serve_getstr(req, reqsz, &pos, &doc, &docsz) ||
+	    pos != reqsz) {
+		strlcpy(msg, "malformed request", sizeof(msg));
+		goto out;
+	}
+
+	/*
+	 * Request metadata follows that of the command line, so -M
+	 * overrides it, and the mode's own options are selected.
+	 */
+
+	if (metasz > 0) {
+		opts.meta = reallocarray(NULL,
+			s->opts->metasz + metasz, sizeof(char *));
+		if (opts.meta == NULL)
+			err(1, NULL);
+		for (i = 0; i < s->opts->metasz; i++)
+			opts.meta[i] = s->opts->meta[i];
+		for (i = 0; i < metasz; i++)
+			opts.meta[s->opts->metasz + i] = meta[i];
+		opts.metasz = s->opts->metasz + metasz;
+	}
+	if (metaovrsz > 0) {
+		opts.metaovr = reallocarray(NULL,
+			s->opts->metaovrsz + metaovrsz, sizeof(char *));
+		if (opts.metaovr == NULL)
+			err(1, NULL);
+		for (i = 0; i < s->opts->metaovrsz; i++)
+			opts.metaovr[i] = s->opts->metaovr[i];
+		for (i = 0; i < metaovrsz; i++)
+			opts.metaovr[s->opts->metaovrsz + i] = metaovr[i];
+		opts.metaovrsz = s->opts->metaovrsz + metaovrsz;
+	}
+
+	if (argc > 0) {
+		serve_mode(s, &opts);
+		if ((ctx = rctx = lowdown_ctx_new(&opts)) == NULL)
+			err(1, NULL);
+	}
+	if (!lowdown_ctx_buf(ctx, doc, docsz, ob, &mq)) {
+		strlcpy(msg, "failed parse", sizeof(msg));
+		goto out;
+	}
+
+	/* Size, then fill in the response. */
+
+	sz = 4 + 4 + 4 + 4 + ob->size;
+	TAILQ_FOREACH(m, &mq, entries) {
+		sz += 4 + strlen(m->key) + 4 + strlen(m->value);
+		nmeta++;
+	}
+	if (sz - 4 > UINT32_MAX) {
+		strlcpy(msg, "output too long", sizeof(msg));
+		goto out;
+	}
+	*ressz = sz;
+	if ((*res = cp = malloc(sz)) == NULL)
+		err(1, NULL);
+	cp = serve_put32(cp, sz - 4);
+	cp = serve_put32(cp, 0);
+	cp = serve_put32(cp, nmeta);
+	TAILQ_FOREACH(m, &mq, entries) {
+		cp = serve_putstr(cp, m->key, strlen(m->key));
+		cp = serve_putstr(cp, m->value, strlen(m->value));
+	}
+	serve_putstr(cp, ob->data, ob->size);
+out:
+	if (*msg != '\0')
+		serve_error(res, ressz, msg);
+	if (opts.meta != s->opts->meta)
+		free(opts.meta);
+	if (opts.metaovr != s->opts->metaovr)
+		free(opts.metaovr);
+	for (i = 0; i < metasz; i++)
+		free(meta[i]);
+	for (i = 0; i < metaovrsz; i++)
+		free(metaovr[i]);
+	free(meta);
+	free(metaovr);
+	free(opt);
+	lowdown_ctx_free(rctx);
+	lowdown_metaq_free(&mq);
+}
+
+/*
+ * Answer requests read from "rfd" on "wfd" until end of file.  Requests
+ * without options share one parser, renderer, and output buffer.
+ * Returns zero on failure (a malformed frame or i/o error, which are
+ * reported), non-zero on success.  Exits on memory failure.
+ */
+static int
+serve_conn(const struct serve *s, int rfd, int wfd)
+{
+	struct lowdown_opts	 opts;
+	struct lowdown_ctx	*ctx;
+	struct lowdown_buf	*ob;
+	char			 head[4], *req, *res;
+	size_t			 reqsz, ressz;
+	ssize_t			 ssz;
+	int			 c, rc = 0;
+
+	opts = *s->opts;
+	serve_mode(s, &opts);
+	if ((ctx = lowdown_ctx_new(&opts)) == NULL ||
+	    (ob = lowdown_buf_new(4096)) == NULL)
+		err(1, NULL);
+
+	for (;;) {
+		if ((ssz = readall(rfd, head, sizeof(head))) == 0) {
+			rc = 1;
+			break;
+		} else if (ssz == -1) {
+			warn("read");
+			break;
+		} else if ((size_t)ssz < sizeof(head)) {
+			warnx("short request");
+			break;
+		}
+		if ((reqsz = serve_get32(head)) > SERVE_MAX) {
+			warnx("request too long");
+			break;
+		}
+		if ((req = malloc(reqsz + 1)) == NULL)
+			err(1, NULL);
+		if ((ssz = readall(rfd, req, reqsz)) == -1 ||
+		    (size_t)ssz < reqsz) {
+			if (ssz == -1)
+				warn("read");
+			else
+				warnx("short request");
+			free(req);
+			break;
+		}
+		serve_request(s, ctx, ob, req, reqsz, &res, &ressz);
+		free(req);
+		c = writeall(wfd, res, ressz);
+		free(res);
+		if (!c) {
+			warn("write");
+			break;
+		}
+	}
+
+	lowdown_buf_free(ob);
+	lowdown_ctx_free(ctx);
+	return rc;
+}
+
+/*
+ * Accept connections and answer their requests in turn.
+ */
+static void *
+serve_worker(void *arg)
+{
+	const struct serve	*s = arg;
+	int			 fd;
+
+	for (;;) {
+		if ((fd = accept(s->fd, NULL, NULL)) == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno == EMFILE || errno == ENFILE) {
+				warn("accept");
+				sleep(1);
+				continue;
+			}
+			err(1, "accept");
+		}
+		serve_conn(s, fd, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+/*
+ * Server mode (--serve): answer requests on standard input and output
+ * if "path" is NULL, otherwise on connections to the UNIX-domain socket
+ * "path", with "threads" threads (or one per processor if zero), each
+ * handling one connection at a time.  Returns zero on failure, non-zero
+ * on success.  With a socket, only returns on failure.
+ */
+static int
+serve(struct serve *s, const char *path, size_t threads)
+{
+	struct sockaddr_un	 sun;
+	struct stat		 st;
+	pthread_t		 tid;
+	size_t			 i, nw;
+	long			 ncpu;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (path == NULL) {
+		sandbox_post(STDIN_FILENO, -1, STDOUT_FILENO, -1);
+		return serve_conn(s, STDIN_FILENO, STDOUT_FILENO);
+	}
+
+	memset(&sun, 0, sizeof(struct sockaddr_un));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, path,
+	    sizeof(sun.sun_path)) >= sizeof(sun.sun_path))
+		errx(1, "%s: path too long", path);
+
+	/* Replace a stale socket, but nothing else. */
+
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+	    unlink(path) == -1)
+		err(1, "%s", path);
+	if ((s->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		err(1, "socket");
+	if (bind(s->fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		err(1, "%s", path);
+	if (listen(s->fd, SOMAXCONN) == -1)
+		err(1, "%s", path);
+
+	sandbox_serve(s->fd);
+
+	if ((nw = threads) == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nw = ncpu < 1 ? 1 : (size_t)ncpu;
+	}
+	for (i = 1; i < nw; i++) {
+		if (pthread_create(&tid, NULL, serve_worker, s) != 0)
+			break;
+		pthread_detach(tid);
+	}
+	serve_worker(s);
+	return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -285,19 +1575,37 @@ main(int argc, char *argv[])
 	      	 		*fndin = NULL, *extract = NULL, *er,
 				*mainopts = "LM:m:sT:t:o:X:h",
 				*diffopts = "M:m:sT:t:o:h",
-				*templfn = NULL, *odtstylefn = NULL;
+				*templfn = NULL, *odtstylefn = NULL,
+				*cachedir = NULL, *outdir = NULL,
+				*servepath = NULL;
 	struct lowdown_opts_term topts;
+	struct lowdown_opts_nroff nroff;
+	struct lowdown_opts_odt	 odt;
 	struct lowdown_opts 	 opts;
+	struct serve		 srv;
 	int			 c, diff = 0, status = 1, afl = 0,
-				 rfl = 0, aifl = 0, rifl = 0, list = 0;
+				 rfl = 0, aifl = 0, rifl = 0, list = 0,
+				 cachefd = -1, cached = 0, serving = 0;
 	char			*ret = NULL, *cp, *templptr = NULL,
 				*nroffcodefn = NULL,
-				*odtstyleptr = NULL;
-	size_t		 	 i, retsz = 0;
+				*odtstyleptr = NULL,
+				 key[MD5_DIGEST_STRING_LENGTH];
+	size_t		 	 i, retsz = 0, jobs = 0;
+	struct input		 in;
+	struct lowdown_ctx	*ctx;
+	struct lowdown_sink	 sink;
+	struct sink_out		 sinkout;
+	struct stat		 st;
+	long long		 cachemax = CACHE_MAX;
 	struct lowdown_meta 	*m;
 	struct lowdown_metaq	 mq;
 	struct option 		 lo[] = {
 		{ "template",		required_argument, NULL, 8 },
+		{ "cache-dir",		required_argument, NULL, 12 },
+		{ "cache-size",		required_argument, NULL, 13 },
+		{ "outdir",		required_argument, NULL, 14 },
+		{ "jobs",		required_argument, NULL, 15 },
+		{ "serve",		optional_argument, NULL, 16 },
 		{ "version",		no_argument,	NULL, 10 },
 		{ "help",		no_argument,	NULL, 11 },
 		{ "out-no-smarty",	no_argument,	&rfl, LOWDOWN_SMARTY },
@@ -359,6 +1667,8 @@ main(int argc, char *argv[])
 		{ "parse-no-super",	no_argument,	&rifl, LOWDOWN_SUPER },
 		{ "parse-super-short",	no_argument,	&aifl, LOWDOWN_SUPER_SHORT },
 		{ "parse-math",		no_argument,	&aifl, LOWDOWN_MATH },
+		{ "parse-parallel",	no_argument,	&aifl, LOWDOWN_PARALLEL },
+		{ "parse-binary",	no_argument,	&aifl, LOWDOWN_BINARY },
 		{ "parse-no-mantitle",	no_argument,	&rifl, LOWDOWN_MANTITLE },
 		{ "parse-no-codeindent",no_argument,	&aifl, LOWDOWN_NOCODEIND },
 		{ "parse-no-intraemph",	no_argument,	&aifl, LOWDOWN_NOINTEM },
@@ -370,6 +1680,7 @@ main(int argc, char *argv[])
 		{ "parse-no-ext-attrs",	no_argument,	&rifl, LOWDOWN_ATTRS },
 		{ "parse-no-tasklists",	no_argument,	&rifl, LOWDOWN_TASKLIST },
 		{ "parse-no-callouts",	no_argument,	&rifl, LOWDOWN_CALLOUTS },
+		{ "parse-no-arena",	no_argument,	&rifl, LOWDOWN_ARENA },
 		{ "parse-maxdepth",	required_argument, NULL, 5 },
 
 		/*
@@ -438,6 +1749,7 @@ main(int argc, char *argv[])
 		{ "parse-super",	no_argument,	&aifl, LOWDOWN_SUPER },
 		{ "parse-no-super-short",no_argument,	&rifl, LOWDOWN_SUPER_SHORT },
 		{ "parse-no-math",	no_argument,	&rifl, LOWDOWN_MATH },
+		{ "parse-no-parallel",	no_argument,	&rifl, LOWDOWN_PARALLEL },
 		{ "parse-mantitle",	no_argument,	&aifl, LOWDOWN_MANTITLE },
 		{ "parse-codeindent",	no_argument,	&rifl, LOWDOWN_NOCODEIND },
 		{ "parse-intraemph",	no_argument,	&rifl, LOWDOWN_NOINTEM },
@@ -448,6 +1760,7 @@ main(int argc, char *argv[])
 		{ "parse-ext-attrs",	no_argument,	&aifl, LOWDOWN_ATTRS },
 		{ "parse-tasklists",	no_argument,	&aifl, LOWDOWN_TASKLIST },
 		{ "parse-callouts",	no_argument,	&aifl, LOWDOWN_CALLOUTS },
+		{ "parse-arena",	no_argument,	&aifl, LOWDOWN_ARENA },
 
 		/*
 		 * Some options re-hyphenated for consistency.
@@ -462,6 +1775,8 @@ main(int argc, char *argv[])
 	/* Get the real number of columns or 72. */
 
 	memset(&topts, 0, sizeof(struct lowdown_opts_term));
+	memset(&nroff, 0, sizeof(struct lowdown_opts_nroff));
+	memset(&odt, 0, sizeof(struct lowdown_opts_odt));
 	topts.cols = get_columns();
 	topts.hpadding = 4;
 
@@ -469,10 +1784,12 @@ main(int argc, char *argv[])
 
 	TAILQ_INIT(&mq);
 	memset(&opts, 0, sizeof(struct lowdown_opts));
+	memset(&in, 0, sizeof(struct input));
 
 	opts.maxdepth = 128;
 	opts.type = LOWDOWN_HTML;
 	opts.feat =
+		LOWDOWN_ARENA |
 		LOWDOWN_ATTRS |
 		LOWDOWN_AUTOLINK |
 		LOWDOWN_COMMONMARK |
@@ -520,27 +1837,7 @@ main(int argc, char *argv[])
 		case 't':
 			/* FALLTHROUGH */
 		case 'T':
-			if (strcasecmp(optarg, "ms") == 0)
-				opts.type = LOWDOWN_MS;
-			else if (strcasecmp(optarg, "gemini") == 0)
-				opts.type = LOWDOWN_GEMINI;
-			else if (strcasecmp(optarg, "html") == 0)
-				opts.type = LOWDOWN_HTML;
-			else if (strcasecmp(optarg, "latex") == 0)
-				opts.type = LOWDOWN_LATEX;
-			else if (strcasecmp(optarg, "man") == 0)
-				opts.type = LOWDOWN_MAN;
-			else if (strcasecmp(optarg, "mdoc") == 0)
-				opts.type = LOWDOWN_MDOC;
-			else if (strcasecmp(optarg, "fodt") == 0)
-				opts.type = LOWDOWN_FODT;
-			else if (strcasecmp(optarg, "term") == 0)
-				opts.type = LOWDOWN_TERM;
-			else if (strcasecmp(optarg, "tree") == 0)
-				opts.type = LOWDOWN_TREE;
-			else if (strcasecmp(optarg, "null") == 0)
-				opts.type = LOWDOWN_NULL;
-			else
+			if (!type_parse(optarg, &opts.type))
 				goto usage;
 			break;
 		case 'X':
@@ -636,6 +1933,26 @@ main(int argc, char *argv[])
 			 */
 			status = 0;
 			goto usage;
+		case 12:
+			cachedir = optarg;
+			break;
+		case 13:
+			cachemax = strtonum(optarg, 0, LLONG_MAX, &er);
+			if (er == NULL)
+				break;
+			errx(1, "--cache-size: %s", er);
+		case 14:
+			outdir = optarg;
+			break;
+		case 15:
+			jobs = strtonum(optarg, 1, INT_MAX, &er);
+			if (er == NULL)
+				break;
+			errx(1, "--jobs: %s", er);
+		case 16:
+			serving = 1;
+			servepath = optarg;
+			break;
 		default:
 			/*
 			 * Bad argument: exit with failure.
@@ -649,7 +1966,7 @@ main(int argc, char *argv[])
 	argv += optind;
 
 	if (opts.type == LOWDOWN_TERM ||
- 	    opts.type == LOWDOWN_GEMINI)
+ 	    opts.type == LOWDOWN_GEMINI || serving)
 		setlocale(LC_CTYPE, "");
 
 	if (opts.type == LOWDOWN_TERM)
@@ -658,10 +1975,20 @@ main(int argc, char *argv[])
 	/* 
 	 * Diff mode takes two arguments: the first is mandatory (the
 	 * old file) and the second (the new one) is optional.
-	 * Non-diff mode takes an optional single argument.
+	 * Non-diff mode takes an optional single argument.  Batch mode
+	 * takes any number of inputs, which are opened later, and only
+	 * writes into its output directory.  Server mode takes none.
 	 */
 
-	if ((diff && (argc == 0 || argc > 2)) || (!diff && argc > 1))
+	if (serving) {
+		if (diff || extract != NULL || list || fnout != NULL ||
+		    outdir != NULL || argc > 0)
+			goto usage;
+	} else if (outdir != NULL) {
+		if (diff || extract != NULL || list || fnout != NULL)
+			goto usage;
+	} else if ((diff && (argc == 0 || argc > 2)) ||
+	    (!diff && argc > 1))
 		goto usage;
 
 	if (diff) {
@@ -673,7 +2000,7 @@ main(int argc, char *argv[])
 		fndin = argv[0];
 		if ((din = fopen(fndin, "r")) == NULL)
 			err(1, "%s", fndin);
-	} else {
+	} else if (outdir == NULL) {
 		if (argc && strcmp(argv[0], "-")) {
 			fnin = argv[0];
 			if ((fin = fopen(fnin, "r")) == NULL)
@@ -693,11 +2020,14 @@ main(int argc, char *argv[])
 	 * DEPRECATED: use --template instead.
 	 */
 
-	if (opts.type == LOWDOWN_FODT && odtstylefn != NULL)
-		opts.odt.sty = odtstyleptr = readfile(odtstylefn);
+	if ((opts.type == LOWDOWN_FODT || serving) && odtstylefn != NULL)
+		odt.sty = odtstyleptr = readfile(odtstylefn);
+	if (opts.type == LOWDOWN_FODT)
+		opts.odt = odt;
 
 	/*
-	 * If specified and in -tman or -tms, parse the constant width
+	 * If specified and in -tman or -tms (or serving, where requests
+	 * may change the mode), parse the constant width
 	 * fonts.  As mentioned in nroff.c, the code font "C" is not
 	 * portable, so let the user override it.  This comes as a
 	 * comma-separated sequence of R[,B[,I[,BI]]].  Any of these may
@@ -707,50 +2037,50 @@ main(int argc, char *argv[])
 
 	if ((opts.type == LOWDOWN_MAN ||
 	     opts.type == LOWDOWN_MDOC ||
-	     opts.type == LOWDOWN_MS) &&
+	     opts.type == LOWDOWN_MS || serving) &&
 	    nroffcodefn != NULL && *nroffcodefn != '\0') {
-		opts.nroff.cr = cp = nroffcodefn;
+		nroff.cr = cp = nroffcodefn;
 		while (*cp != '\0' && *cp != ',')
 			cp++;
 		if (*cp != '\0') {
 			*cp++ = '\0';
-			opts.nroff.cb = cp;
+			nroff.cb = cp;
 			while (*cp != '\0' && *cp != ',')
 				cp++;
 			if (*cp != '\0') {
 				*cp++ = '\0';
-				opts.nroff.ci = cp;
+				nroff.ci = cp;
 				while (*cp != '\0' && *cp != ',')
 					cp++;
 				if (*cp != '\0') {
 					*cp++ = '\0';
-					opts.nroff.cbi = cp;
+					nroff.cbi = cp;
 					while (*cp != '\0' && *cp != ',')
 						cp++;
 				}
 			}
 		}
-		if (opts.nroff.cr != NULL && *opts.nroff.cr == '\0')
-			opts.nroff.cr = NULL;
-		if (opts.nroff.cb != NULL && *opts.nroff.cb == '\0')
-			opts.nroff.cb = NULL;
-		if (opts.nroff.ci != NULL && *opts.nroff.ci == '\0')
-			opts.nroff.ci = NULL;
-		if (opts.nroff.cbi != NULL && *opts.nroff.cbi == '\0')
-			opts.nroff.cbi = NULL;
+		if (nroff.cr != NULL && *nroff.cr == '\0')
+			nroff.cr = NULL;
+		if (nroff.cb != NULL && *nroff.cb == '\0')
+			nroff.cb = NULL;
+		if (nroff.ci != NULL && *nroff.ci == '\0')
+			nroff.ci = NULL;
+		if (nroff.cbi != NULL && *nroff.cbi == '\0')
+			nroff.cbi = NULL;
 	}
 
+	if (opts.type == LOWDOWN_MAN ||
+	    opts.type == LOWDOWN_MDOC ||
+	    opts.type == LOWDOWN_MS)
+		opts.nroff = nroff;
+
 	/* Configure the output file. */
 
 	if (fnout != NULL && strcmp(fnout, "-") &&
 	    (fout = fopen(fnout, "w")) == NULL)
 		err(1, "%s", fnout);
 
-	sandbox_post(fileno(fin), din == NULL ? 
-		-1 : fileno(din), fileno(fout));
-
-	/* We're now completely sandboxed. */
-
 	/* Require metadata when extracting. */
 
 	if (extract || list)
@@ -764,15 +2094,107 @@ main(int argc, char *argv[])
 	if (getenv("NO_COLOR") != NULL ||
 	    getenv("NO_COLOUR") != NULL)
 		opts.oflags |= LOWDOWN_TERM_NOCOLOUR;
+	if (diff)
+		opts.oflags &= ~LOWDOWN_TERM_NOCOLOUR;
+
+	/*
+	 * Server mode sandboxes itself once it's ready for requests.
+	 */
+
+	if (serving) {
+		memset(&srv, 0, sizeof(struct serve));
+		srv.opts = &opts;
+		srv.term = topts;
+		srv.nroff = nroff;
+		srv.odt = odt;
+		if (!serve(&srv, servepath, jobs))
+			status = 1;
+		goto out;
+	}
+
+	/*
+	 * Batch mode opens and writes its files from its worker
+	 * threads, so it can't drop the privileges to do so.
+	 */
+
+	if (outdir != NULL) {
+		if (!batch(&opts, outdir, argv, (size_t)argc,
+		    cachedir, cachemax, jobs))
+			status = 1;
+		goto out;
+	}
+
+	/*
+	 * Look up the output in the cache, if given, now that all
+	 * options are known.  A miss creates the entry to be filled in
+	 * after rendering, as the sandbox disallows creating files.
+	 * This doesn't apply to metadata queries or diffs.
+	 */
+
+	if (cachedir != NULL && !diff && extract == NULL && !list) {
+		if (mkdir(cachedir, 0777) == -1 && errno != EEXIST)
+			err(1, "%s", cachedir);
+		if (!input_get(fin, &in))
+			err(1, "%s", fnin);
+		cache_key(key, &opts, in.data, in.size);
+		if (cache_get(cachedir, key, &ret, &retsz))
+			cached = 1;
+		else
+			cachefd = cache_new(cachedir, key, cachemax);
+	}
+
+	sandbox_post(fileno(fin), din == NULL ? 
+		-1 : fileno(din), fileno(fout), cachefd);
+
+	/* We're now completely sandboxed. */
 
 	if (diff) {
-		opts.oflags &= ~LOWDOWN_TERM_NOCOLOUR;
-		if (!lowdown_file_diff
-		    (&opts, fin, din, &ret, &retsz))
+		if (!lowdown_fd_diff(&opts, fileno(fin),
+		    fileno(din), &ret, &retsz))
 			errx(1, "%s: failed parse", fnin);
-	} else {
-		if (!lowdown_file(&opts, fin, &ret, &retsz, &mq))
+	} else if (in.data != NULL) {
+		if (!cached && !lowdown_buf(&opts,
+		    in.data, in.size, &ret, &retsz, &mq))
 			errx(1, "%s: failed parse", fnin);
+		if (cachefd != -1)
+			cache_put(cachefd, ret, retsz);
+	} else if (extract != NULL || list) {
+		if (!lowdown_fd(&opts, fileno(fin), &ret, &retsz, &mq))
+			errx(1, "%s: failed parse", fnin);
+	} else {
+		/* Write output as it's rendered. */
+
+		sinkout.f = fout;
+		sinkout.err = 0;
+		sink.write = sink_write;
+		sink.arg = &sinkout;
+		if ((ctx = lowdown_ctx_new(&opts)) == NULL)
+			err(1, NULL);
+
+		/*
+		 * Pipes and the like are parsed as they're read; files
+		 * are read (or mapped) whole.
+		 */
+
+		if (!(opts.feat & LOWDOWN_BINARY) &&
+		    fstat(fileno(fin), &st) != -1 &&
+		    !S_ISREG(st.st_mode)) {
+			if ((c = input_feed(fin, ctx, &sink)) < 0)
+				err(1, "%s", fnin);
+		} else {
+			if (!input_get(fin, &in))
+				err(1, "%s", fnin);
+			c = lowdown_ctx_write(ctx,
+				in.data, in.size, &sink, NULL);
+		}
+		if (!c) {
+			if (sinkout.err == 0)
+				errx(1, "%s: failed parse", fnin);
+			errno = sinkout.err;
+			err(1, "%s", fout == stdout ?
+				"<stdout>" : fnout);
+		}
+		lowdown_ctx_free(ctx);
 	}
 
 	if (extract != NULL) {
@@ -790,10 +2212,11 @@ main(int argc, char *argv[])
 		assert(!diff);
 		TAILQ_FOREACH(m, &mq, entries)
 			fprintf(fout, "%s\n", m->key);
-	} else
+	} else if (retsz > 0)
 		fwrite(ret, 1, retsz, fout);
-
+out:
 	free(ret);
+	input_free(&in);
 	free(nroffcodefn);
 	free(templptr);
 	free(odtstyleptr);
@@ -821,7 +2244,15 @@ usage:
 			"usage: lowdown [-hLs] [input_options] "
 			"[output_options] [-M metadata]\n"
 			"               [-m metadata] "
-			"[-o output] [-t mode] [-X keyword] [file]\n");
+			"[-o output] [-t mode] [-X keyword] [file]\n"
+			"       lowdown [-s] [input_options] "
+			"[output_options] [-M metadata]\n"
+			"               [-m metadata] [-t mode] "
+			"--outdir=dir [file ...]\n"
+			"       lowdown [-s] [input_options] "
+			"[output_options] [-M metadata]\n"
+			"               [-m metadata] [-t mode] "
+			"--serve[=socket]\n");
 	} else
 		fprintf(stderr, 
 			"usage: lowdown-diff [-hs] [input_options] "
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "lowdown.h"
+#include "extern.h"
+
+/*
+ * Smallest table size.  Must be a power of two.
+ */
+#define	METAIDX_MIN	16
+
+/*
+ * Case-folded FNV-1a hash of the key "key" of length "sz".
+ */
+static size_t
+metaidx_hash(const char *key, size_t sz)
+{
+	uint32_t	 h = 2166136261U;
+	size_t		 i;
+
+	for (i = 0; i < sz; i++) {
+		h ^= (unsigned char)tolower((unsigned char)key[i]);
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Find the slot for "key" of length "sz": either the one holding it or
+ * the empty one where it would go.  The table must not be empty.
+ */
+static const struct lowdown_meta **
+metaidx_slot(const struct metaidx *idx, const char *key, size_t sz)
+{
+	const struct lowdown_meta	*m;
+	size_t				 i, mask = idx->tabsz - 1;
+
+	for (i = metaidx_hash(key, sz) & mask;
+	     (m = idx->tab[i]) != NULL; i = (i + 1) & mask)
+		if (strncasecmp(m->key, key, sz) == 0 && m->key[sz] == '\0')
+			break;
+	return &idx->tab[i];
+}
+
+/*
+ * Make sure there's room for one more key, keeping the table at most
+ * half full.  Returns zero on memory failure, non-zero on success.
+ */
+static int
+metaidx_grow(struct metaidx *idx)
+{
+	const struct lowdown_meta	**tab, **otab = idx->tab;
+	size_t				  i, otabsz = idx->tabsz;
+
+	if ((idx->len + 1) * 2 <= idx->tabsz)
+		return 1;
+
+	idx->tabsz = otabsz == 0 ? METAIDX_MIN : otabsz * 2;
+	if ((tab = calloc(idx->tabsz, sizeof(*tab))) == NULL) {
+		idx->tabsz = otabsz;
+		return 0;
+	}
+	idx->tab = tab;
+	for (i = 0; i < otabsz; i++)
+		if (otab[i] != NULL)
+			*metaidx_slot(idx, otab[i]->key,
+			    strlen(otab[i]->key)) = otab[i];
+	free(otab);
+	return 1;
+}
+
+/*
+ * Look up the metadata with key "key" of length "sz", ignoring case.
+ * Returns the metadata or NULL if not found.
+ */
+const struct lowdown_meta *
+metaidx_get(const struct metaidx *idx, const char *key, size_t sz)
+{
+
+	if (idx->len == 0)
+		return NULL;
+	return *metaidx_slot(idx, key, sz);
+}
+
+/*
+ * Add "m" to the index, replacing any metadata with the same key.
+ * Returns zero on memory failure, non-zero on success.
+ */
+int
+metaidx_put(struct metaidx *idx, const struct lowdown_meta *m)
+{
+	const struct lowdown_meta	**slot;
+
+	if (!metaidx_grow(idx))
+		return 0;
+	slot = metaidx_slot(idx, m->key, strlen(m->key));
+	if (*slot == NULL)
+		idx->len++;
+	*slot = m;
+	return 1;
+}
+
+/*
+ * Remove the metadata with key "key" of length "sz", if found.  This
+ * must be called before the metadata is freed.
+ */
+void
+metaidx_del(struct metaidx *idx, const char *key, size_t sz)
+{
+	const struct lowdown_meta	**slot;
+	size_t				  i, j, k, mask = idx->tabsz - 1;
+
+	if (idx->len == 0 || *(slot = metaidx_slot(idx, key, sz)) == NULL)
+		return;
+	i = (size_t)(slot - idx->tab);
+	idx->tab[i] = NULL;
+	idx->len--;
+
+	/*
+	 * Move back any following entries that would no longer be found
+	 * by probing past the emptied slot.
+	 */
+
+	for (j = (i + 1) & mask; idx->tab[j] != NULL; j = (j + 1) & mask) {
+		k = metaidx_hash(idx->tab[j]->key,
+			strlen(idx->tab[j]->key)) & mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		idx->tab[i] = idx->tab[j];
+		idx->tab[j] = NULL;
+		i = j;
+	}
+}
+
+/*
+ * Replace the index with one of "mq".  If keys are repeated, the first
+ * is used, as it would be when searching the queue.  Returns zero on
+ * memory failure, non-zero on success.
+ */
+int
+metaidx_build(struct metaidx *idx, const struct lowdown_metaq *mq)
+{
+	const struct lowdown_meta	 *m, **slot;
+
+	metaidx_clear(idx);
+	TAILQ_FOREACH(m, mq, entries) {
+		if (!metaidx_grow(idx))
+			return 0;
+		slot = metaidx_slot(idx, m->key, strlen(m->key));
+		if (*slot == NULL) {
+			*slot = m;
+			idx->len++;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Remove all keys from the index, keeping its memory.
+ */
+void
+metaidx_clear(struct metaidx *idx)
+{
+
+	if (idx->tab != NULL)
+		memset(idx->tab, 0, idx->tabsz * sizeof(*idx->tab));
+	idx->len = 0;
+}
+
+/*
+ * Release the index's memory.  It may be used again afterward.
+ */
+void
+metaidx_free(struct metaidx *idx)
+{
+
+	free(idx->tab);
+	memset(idx, 0, sizeof(struct metaidx));
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lowdown.h"
+#include "extern.h"
+#include "parse.h"
+
+/*
+ * On x86 with a GNU-compatible compiler, use SSSE3 or AVX2 when the
+ * running CPU supports them.  Everything else uses the scalar scan.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define CHARSET_X86 1
+# include <immintrin.h>
+#endif
+
+/*
+ * Scalar scan: one table lookup per byte.
+ */
+static size_t
+charset_find_scalar(const struct charset *cs, const char *data,
+    size_t i, size_t size)
+{
+
+	while (i < size && cs->map[(unsigned char)data[i]] == 0)
+		i++;
+	return i;
+}
+
+#if CHARSET_X86
+/*
+ * The vector scans classify each byte with two table lookups: one by
+ * its low nibble, one by its high nibble.  The byte is in the set if
+ * the results have a bit in common.  See charset_init().
+ */
+
+__attribute__((target("ssse3")))
+static size_t
+charset_find_ssse3(const struct charset *cs, const char *data,
+    size_t i, size_t size)
+{
+	__m128i	 lo, hi, nib, v, m;
+	int	 mask;
+
+	lo = _mm_loadu_si128((const __m128i *)cs->lo);
+	hi = _mm_loadu_si128((const __m128i *)cs->hi);
+	nib = _mm_set1_epi8(0x0f);
+
+	for ( ; size - i >= 16; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(data + i));
+		m = _mm_and_si128
+			(_mm_shuffle_epi8(lo, _mm_and_si128(v, nib)),
+			 _mm_shuffle_epi8(hi, _mm_and_si128
+			  (_mm_srli_epi16(v, 4), nib)));
+		mask = _mm_movemask_epi8
+			(_mm_cmpeq_epi8(m, _mm_setzero_si128())) ^ 0xffff;
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return charset_find_scalar(cs, data, i, size);
+}
+
+__attribute__((target("avx2")))
+static size_t
+charset_find_avx2(const struct charset *cs, const char *data,
+    size_t i, size_t size)
+{
+	__m256i		 lo, hi, nib, v, m;
+	unsigned int	 mask;
+
+	lo = _mm256_broadcastsi128_si256
+		(_mm_loadu_si128((const __m128i *)cs->lo));
+	hi = _mm256_broadcastsi128_si256
+		(_mm_loadu_si128((const __m128i *)cs->hi));
+	nib = _mm256_set1_epi8(0x0f);
+
+	for ( ; size - i >= 32; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(data + i));
+		m = _mm256_and_si256
+			(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nib)),
+			 _mm256_shuffle_epi8(hi, _mm256_and_si256
+			  (_mm256_srli_epi16(v, 4), nib)));
+		mask = ~(unsigned int)_mm256_movemask_epi8
+			(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return charset_find_ssse3(cs, data, i, size);
+}
+#endif
+
+/*
+ * Initialise a character set from a 256-entry table whose non-zero
+ * entries are in the set, then select the fastest scan the CPU allows.
+ *
+ * For the vector scans, each ASCII high nibble is given its own bit.
+ * The high-nibble table maps a high nibble to its bit; the low-nibble
+ * table maps a low nibble to the bits of all high nibbles that form a
+ * character in the set with it.  This is exact for any set of ASCII
+ * characters, and bytes with the high bit set are never matched.  Sets
+ * with non-ASCII characters use the scalar scan.
+ */
+void
+charset_init(struct charset *cs, const int *table)
+{
+	size_t	 i;
+
+	memset(cs, 0, sizeof(struct charset));
+	for (i = 0; i < 256; i++) {
+		if (table[i] == 0)
+			continue;
+		cs->map[i] = 1;
+		if (i < 0x80) {
+			cs->hi[i >> 4] = 1 << (i >> 4);
+			cs->lo[i & 0x0f] |= 1 << (i >> 4);
+		}
+	}
+
+	cs->find = charset_find_scalar;
+#if CHARSET_X86
+	for (i = 0x80; i < 256; i++)
+		if (cs->map[i])
+			return;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		cs->find = charset_find_avx2;
+	else if (__builtin_cpu_supports("ssse3"))
+		cs->find = charset_find_ssse3;
+#endif
+}
@@ -24,11 +24,13 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "lowdown.h"
 #include "extern.h"
@@ -47,49 +49,221 @@
 			 HLIST_FL_UNORDERED)
 
 /*
- * Reference to a link.
+ * With lowdown_doc_feed(), how much input may be held back for
+ * unresolved references or an unterminated metadata block before it's
+ * parsed as-is.
+ */
+#define	STREAM_HOLD_MAX	(1024 * 1024)
+
+/*
+ * With LOWDOWN_PARALLEL, the most threads to use, the smallest input to
+ * put in a segment, and the most segments per thread (which are
+ * smaller, so that threads finishing early can take on more).
+ */
+#define	PARALLEL_THREADS	64
+#define	PARALLEL_SEGMENT	(64 * 1024)
+#define	PARALLEL_SEGMENTS	4
+
+/*
+ * How many scratch buffers a parser keeps for reuse: see scratch_get().
+ */
+#define	SCRATCH_MAX	16
+
+/*
+ * Reference to a link.  These are hashed by their normalised name: see
+ * label_fold().
  */
 struct	link_ref {
-	struct lowdown_buf	*name; /* id of link (or NULL) */
+	struct lowdown_buf	*name; /* normalised id of link */
 	struct lowdown_buf	*link; /* link address */
 	struct lowdown_buf	*title; /* optional title */
 	struct lowdown_buf	*attrs; /* optional attributes */
-	TAILQ_ENTRY(link_ref)	 entries;
+	uint32_t		 hash; /* hash of name */
+	struct link_ref		*next; /* next in hash bucket */
 };
 
-TAILQ_HEAD(link_refq, link_ref);
+/*
+ * Range of input kept for the block parser, i.e., not a reference or
+ * footnote definition.
+ */
+struct	text_range {
+	size_t			 beg; /* start of range */
+	size_t			 end; /* end of range (exclusive) */
+};
 
 /*
  * Reference to a footnote.  This keeps track of all footnotes
  * definitions and whether there's both a definition and reference.
+ * These are hashed by their name.
  */
 struct	foot_ref {
 	size_t			 num; /* if used, the order */
 	struct lowdown_node	*ref; /* if used, the reference */
 	struct lowdown_buf	 name; /* identifier */
 	struct lowdown_buf	 contents; /* definition */
-	TAILQ_ENTRY(foot_ref)	 entries;
+	uint32_t		 hash; /* hash of name */
+	struct foot_ref		*next; /* next in hash bucket */
+};
+
+/*
+ * A top-level block as seen by lowdown_doc_reparse() and
+ * lowdown_doc_feed(): its extent in the block parser's input, how far
+ * the parser looked to delimit it, and the top-level nodes it produced.
+ * Blocks without nodes (blank lines) have NULL "first" and "last".
+ */
+struct	reparse_block {
+	size_t			 beg; /* start of block */
+	size_t			 end; /* end of block (exclusive) */
+	size_t			 seen; /* end of examined input or SIZE_MAX */
+	size_t			 id; /* first node identifier */
+	size_t			 idend; /* one past last node identifier */
+	size_t			 foots; /* used footnotes before block */
+	int			 unres; /* has unresolved references */
+	struct lowdown_node	*prev; /* top-level node before block */
+	struct lowdown_node	*first; /* first top-level node */
+	struct lowdown_node	*last; /* last top-level node */
+};
+
+/*
+ * State retained from one parse to the next with LOWDOWN_REPARSE.  The
+ * link and footnote tables are kept as-is, so footnotes used in the
+ * last tree stay marked as used.
+ */
+struct	reparse {
+	struct lowdown_node	 *root; /* tree last returned */
+	size_t			  maxn; /* node count in root */
+	size_t			  foots; /* # of used footnotes */
+	char			 *src; /* caller's input */
+	size_t			  srcsz; /* size of src */
+	char			 *pre; /* BOM and metadata block */
+	size_t			  presz; /* size of pre */
+	size_t			  beg; /* start of body in input */
+	struct lowdown_buf	 *defs; /* reference, footnote definitions */
+	char			 *text; /* block parser's input */
+	size_t			  textsz; /* size of text */
+	struct lowdown_metaq	  metaq; /* copy of metadata */
+	struct link_ref		**refs; /* link references by hash */
+	size_t			  refsz; /* buckets in refs */
+	size_t			  refn; /* number of link references */
+	struct foot_ref		**footrefs; /* footnotes by hash */
+	size_t			  footrefsz; /* buckets in footrefs */
+	size_t			  footrefn; /* number of footnotes */
+	struct reparse_block	 *blocks; /* top-level blocks */
+	size_t			  blocksz; /* number of blocks */
+	size_t			  blockmax; /* allocated blocks */
+	int			  open; /* last block still open */
+	size_t			  seen; /* furthest input examined */
+	int			  glue; /* merge back to "glueid" */
+	size_t			  glueid; /* merge from block with this */
+	const char		 *base; /* input being parsed */
+	size_t			  basesz; /* size of base */
+	const struct reparse_block *old; /* blocks after the restart */
+	size_t			  oldsz; /* number of old blocks */
+	size_t			  oldpos; /* next old block to check */
+	size_t			  olddmg; /* end of old damaged input */
+	size_t			  newdmg; /* end of new damaged input */
+	int			  resync; /* stopped at an old block */
+	int			  foot; /* footnote reference seen */
+	int			  unres; /* unresolved reference seen */
+};
+
+/*
+ * Content of a list item or blockquote with line prefixes removed: see
+ * container_put().
+ */
+struct	container {
+	char			*data; /* content */
+	size_t			 size; /* size of content */
+	struct lowdown_buf	*buf; /* copy of content (or NULL) */
+};
+
+/*
+ * The result of find_emph_char() for "c" once it reaches the link or
+ * code span at "pos".
+ */
+struct	emph_skip {
+	const char		 *pos; /* skipped construct (or NULL) */
+	const char		 *res; /* result (or NULL if none) */
+	char			  c; /* character looked for */
+};
+
+/*
+ * What scans for closing delimiters have learnt about the inline span
+ * being parsed, so that scans from each of many unclosed emphases or
+ * links don't each run to the end of the span.  Each "no" pointer
+ * marks from where its scan is known to find nothing.
+ */
+struct	span_memo {
+	const char		 *end; /* end of span */
+	const char		 *nobrack; /* no ']' (or NULL) */
+	const char		 *noparen; /* no ')' (or NULL) */
+	const char		 *noquote[2]; /* no unescaped '\'' or '"' */
+	const char		 *notitle; /* no unescaped ')' or '=' */
+	const char		 *nodims; /* no unescaped '\'', '"', or ')' */
+	const char		 *linkbeg; /* unclosed link target (or NULL) */
+	const char		 *linkend; /* where it stopped */
+	const char		**linkopen; /* its unclosed '(' in order */
+	size_t			  linkopensz; /* entries in linkopen */
+	size_t			  linkopenmax; /* allocated linkopen */
+	size_t			  linkopenpos; /* next linkopen to check */
+	struct emph_skip	 *skips; /* find_emph_char() by construct */
+	size_t			  skipsz; /* buckets in skips (power of 2) */
+	size_t			  skipn; /* entries in skips */
+	const char		**seen; /* constructs seen by one search */
+	size_t			  seensz; /* entries in seen */
+	size_t			  seenmax; /* allocated seen */
 };
 
-TAILQ_HEAD(foot_refq, foot_ref);
+/*
+ * State of lowdown_doc_feed() between calls.  Input is first held in
+ * "in" until its lines can be checked for references and footnotes,
+ * then the rest is appended to "text" until its blocks are final.
+ */
+struct	stream {
+	struct lowdown_node	 *root; /* parent of blocks */
+	struct lowdown_metaq	  metaq; /* document metadata */
+	struct lowdown_buf	 *in; /* input not yet in text */
+	struct lowdown_buf	 *text; /* block parser's input */
+	struct lowdown_buf	 *work; /* copy of text being parsed */
+	struct reparse		  rp; /* blocks of the last parse */
+	int			  crlf; /* strip CR (<0 if unknown) */
+	int			  body; /* header has been parsed */
+	size_t			  next; /* size of text for next parse */
+	size_t			  defs; /* definitions at last parse */
+};
 
 struct 	lowdown_doc {
-	struct link_refq	  refq; /* all internal references */
-	struct foot_refq	  footq; /* all footnotes */
+	struct link_ref		**refs; /* link references by hash */
+	size_t			  refsz; /* buckets in refs (power of 2) */
+	size_t			  refn; /* number of link references */
+	struct foot_ref		**footrefs; /* footnotes by hash */
+	size_t			  footrefsz; /* buckets (power of 2) */
+	size_t			  footrefn; /* number of footnotes */
 	size_t			  foots; /* # of used footnotes */
 	int			  active_char[256]; /* jump table */
+	struct charset		  active_set; /* active_char as set */
 	unsigned int		  ext_flags; /* options */
 	int			  in_link_body; /* parsing link body */
 	int			  in_footnote; /* prevent nested */
 	size_t			  nodes; /* number of nodes */
 	struct lowdown_node	 *current; /* current node */
 	struct lowdown_metaq	 *metaq; /* raw metadata key/values */
+	struct metaidx		  metaidx; /* metaq by key */
 	size_t			  depth; /* current parse tree depth */
 	size_t			  maxdepth; /* max parse tree depth */
 	char			**meta; /* primer metadata */
 	size_t			  metasz; /* size of meta */
 	char			**metaovr; /* override metadata */
 	size_t			  metaovrsz; /* size of metaovr */
+	struct lowdown_arena	 *arena; /* node allocator (or NULL) */
+	const char		 *base; /* arena-owned input (or NULL) */
+	size_t			  basesz; /* size of base */
+	struct reparse		 *rp; /* LOWDOWN_REPARSE state (or NULL) */
+	struct stream		 *st; /* lowdown_doc_feed() state (or NULL) */
+	const char		 *stop; /* parse_parallel() boundary (or NULL) */
+	struct span_memo	  memo; /* inline span being parsed */
+	struct lowdown_buf	 *scratch[SCRATCH_MAX]; /* unused buffers */
+	size_t			  scratchsz; /* number in scratch */
 };
 
 /*
@@ -157,8 +331,52 @@ static int
 parse_block(struct lowdown_doc *, char *, size_t);
 
 static ssize_t
-parse_listitem(struct lowdown_buf *, struct lowdown_doc *,
-	char *, size_t, enum hlist_fl *, size_t);
+parse_listitem(struct lowdown_doc *, char *, size_t,
+	enum hlist_fl *, size_t);
+
+/*
+ * Get an empty buffer for temporary use while parsing, reusing one
+ * returned with scratch_put() if possible: these keep their memory
+ * across parses with the same parser.  Returns NULL on memory
+ * allocation failure.
+ */
+static struct lowdown_buf *
+scratch_get(struct lowdown_doc *doc)
+{
+	struct lowdown_buf	*buf;
+
+	if (doc->scratchsz == 0)
+		return hbuf_new(64);
+	buf = doc->scratch[--doc->scratchsz];
+	hbuf_truncate(buf);
+	return buf;
+}
+
+/*
+ * Return "buf" (which may be NULL) from scratch_get() for reuse.
+ */
+static void
+scratch_put(struct lowdown_doc *doc, struct lowdown_buf *buf)
+{
+
+	if (buf == NULL)
+		return;
+	if (doc->scratchsz < SCRATCH_MAX)
+		doc->scratch[doc->scratchsz++] = buf;
+	else
+		hbuf_free(buf);
+}
+
+/*
+ * Free the buffers kept by scratch_put().
+ */
+static void
+scratch_free(struct lowdown_doc *doc)
+{
+
+	while (doc->scratchsz > 0)
+		hbuf_free(doc->scratch[--doc->scratchsz]);
+}
 
 /*
  * Add a node to the parse stack or retrieve a current node if
@@ -194,11 +412,13 @@ pushnode_full(struct lowdown_doc *doc, enum lowdown_rndrt t, int fl)
 
 	if ((doc->depth++ > doc->maxdepth) && doc->maxdepth)
 		return NULL;
-	if ((n = calloc(1, sizeof(struct lowdown_node))) == NULL)
+	n = arena_calloc(doc->arena, 1, sizeof(struct lowdown_node));
+	if (n == NULL)
 		return NULL;
 
 	n->id = doc->nodes++;
 	n->type = t;
+	n->arena = doc->arena;
 	n->parent = doc->current;
 	TAILQ_INIT(&n->children);
 	if (n->parent != NULL)
@@ -227,24 +447,50 @@ pushtext(struct lowdown_doc *doc, int flags)
 	return pushnode_full(doc, LOWDOWN_NORMAL_TEXT, flags);
 }
 
+/*
+ * Whether "data" of size "datasz" lies entirely within the arena-owned
+ * input buffer, so it may be referenced instead of copied.
+ */
+static int
+hbuf_borrowable(const struct lowdown_doc *doc, const char *data,
+    size_t datasz)
+{
+
+	return doc->base != NULL &&
+		data >= doc->base &&
+		data <= doc->base + doc->basesz &&
+		datasz <= (size_t)(doc->base + doc->basesz - data);
+}
+
 /*
  * Sets a buffer with the contents of "data" of size "datasz".  The
- * buffer must be empty.  Return FALSE on failure, TRUE on success.
+ * buffer must be empty.  If "doc" is NULL or isn't using an arena, the
+ * contents are copied to the heap.  Otherwise, the buffer references
+ * the input if "data" lies within it, else the contents are copied into
+ * the arena.  Return FALSE on failure, TRUE on success.
  */
 static int
-hbuf_create(struct lowdown_buf *buf, const char *data, size_t datasz)
+hbuf_create(const struct lowdown_doc *doc, struct lowdown_buf *buf,
+    const char *data, size_t datasz)
 {
 
 	assert(buf->size == 0);
 	assert(buf->data == NULL);
 	memset(buf, 0, sizeof(struct lowdown_buf));
-	if (datasz) {
-		if ((buf->data = malloc(datasz)) == NULL)
-			return 0;
-		buf->unit = 1;
-		buf->size = buf->maxsize = datasz;
-		memcpy(buf->data, data, datasz);
+	if (datasz == 0)
+		return 1;
+	if (doc != NULL && hbuf_borrowable(doc, data, datasz)) {
+		buf->data = (char *)data;
+		buf->size = datasz;
+		return 1;
 	}
+	if (doc != NULL && doc->arena != NULL)
+		return arena_buf_put(doc->arena, buf, data, datasz);
+	if ((buf->data = malloc(datasz)) == NULL)
+		return 0;
+	buf->unit = 1;
+	buf->size = buf->maxsize = datasz;
+	memcpy(buf->data, data, datasz);
 	return 1;
 }
 
@@ -252,23 +498,36 @@ hbuf_create(struct lowdown_buf *buf, const char *data, size_t datasz)
  * See hbuf_create().
  */
 static int
-hbuf_createb(struct lowdown_buf *buf, const struct lowdown_buf *nbuf)
+hbuf_createb(const struct lowdown_doc *doc, struct lowdown_buf *buf,
+    const struct lowdown_buf *nbuf)
 {
 
-	return hbuf_create(buf, nbuf->data, nbuf->size);
+	return hbuf_create(doc, buf, nbuf->data, nbuf->size);
 }
 
 /*
- * Pushes data into the buffer, which is initialised if empty.  Return
- * FALSE on failure, TRUE on success.
+ * Pushes data into the buffer, which is initialised if empty.  The
+ * buffer must have been initialised with hbuf_create() on the same
+ * document.  A buffer referencing the input is simply extended if
+ * "data" immediately follows it.  Return FALSE on failure, TRUE on
+ * success.
  */
 static int
-hbuf_push(struct lowdown_buf *buf, const char *data, size_t datasz)
+hbuf_push(const struct lowdown_doc *doc, struct lowdown_buf *buf,
+    const char *data, size_t datasz)
 {
 
 	if (buf->size == 0 || buf->data == NULL)
-		return hbuf_create(buf, data, datasz);
-	return hbuf_put(buf, data, datasz);
+		return hbuf_create(doc, buf, data, datasz);
+	if (doc->arena == NULL)
+		return hbuf_put(buf, data, datasz);
+	if (buf->maxsize == 0 &&
+	    buf->data + buf->size == data &&
+	    hbuf_borrowable(doc, buf->data, buf->size + datasz)) {
+		buf->size += datasz;
+		return 1;
+	}
+	return arena_buf_put(doc->arena, buf, data, datasz);
 }
 
 
@@ -311,47 +570,210 @@ unscape_text(struct lowdown_buf *ob, struct lowdown_buf *src)
 	return 1;
 }
 
+/*
+ * Normalise a link label in-place for matching: strip leading and
+ * trailing white-space, collapse interior white-space into a single
+ * space, and case-fold.  Only ASCII letters are case-folded.
+ */
+static void
+label_fold(struct lowdown_buf *buf)
+{
+	size_t	 i, j;
+	int	 sp = 0;
+	char	 c;
+
+	for (i = j = 0; i < buf->size; i++) {
+		c = buf->data[i];
+		if (c == ' ' || c == '\n') {
+			sp = j > 0;
+			continue;
+		}
+		if (sp) {
+			buf->data[j++] = ' ';
+			sp = 0;
+		}
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		buf->data[j++] = c;
+	}
+	buf->size = j;
+}
+
+/*
+ * FNV-1a hash of a (normalised) label.
+ */
+static uint32_t
+label_hash(const struct lowdown_buf *buf)
+{
+	uint32_t	 h = 2166136261U;
+	size_t		 i;
+
+	for (i = 0; i < buf->size; i++) {
+		h ^= (unsigned char)buf->data[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Look up a link reference by its label "id", which is normalised
+ * in-place.  Returns NULL if not found.
+ */
 static struct link_ref *
-find_link_ref(struct link_refq *q, char *name, size_t length)
+find_link_ref(const struct lowdown_doc *doc, struct lowdown_buf *id)
 {
 	struct link_ref	*ref;
+	uint32_t	 h;
 
-	TAILQ_FOREACH(ref, q, entries)
-		if ((ref->name == NULL && length == 0) ||
-		    (ref->name != NULL &&
-		     ref->name->size == length &&
-		     memcmp(ref->name->data, name, length) == 0))
+	if (doc->refsz == 0)
+		return NULL;
+	label_fold(id);
+	h = label_hash(id);
+	for (ref = doc->refs[h & (doc->refsz - 1)];
+	     ref != NULL; ref = ref->next)
+		if (ref->hash == h && hbuf_eq(ref->name, id))
 			return ref;
-
 	return NULL;
 }
 
+/*
+ * Add a link reference whose name has been normalised and hashed,
+ * growing the table to keep chains short.  Return FALSE on failure
+ * (memory), TRUE on success.
+ */
+static int
+add_link_ref(struct lowdown_doc *doc, struct link_ref *ref)
+{
+	struct link_ref	**refs, *r;
+	size_t		  i, sz;
+
+	if (doc->refn >= doc->refsz) {
+		sz = doc->refsz == 0 ? 64 : doc->refsz * 2;
+		if ((refs = calloc(sz, sizeof(struct link_ref *))) == NULL)
+			return 0;
+		for (i = 0; i < doc->refsz; i++)
+			while ((r = doc->refs[i]) != NULL) {
+				doc->refs[i] = r->next;
+				r->next = refs[r->hash & (sz - 1)];
+				refs[r->hash & (sz - 1)] = r;
+			}
+		free(doc->refs);
+		doc->refs = refs;
+		doc->refsz = sz;
+	}
+
+	ref->next = doc->refs[ref->hash & (doc->refsz - 1)];
+	doc->refs[ref->hash & (doc->refsz - 1)] = ref;
+	doc->refn++;
+	return 1;
+}
+
+static void
+free_link_ref(struct link_ref *r)
+{
+
+	if (r == NULL)
+		return;
+	hbuf_free(r->link);
+	hbuf_free(r->name);
+	hbuf_free(r->title);
+	hbuf_free(r->attrs);
+	free(r);
+}
+
 static void
-free_link_refs(struct link_refq *q)
+free_link_refs(struct lowdown_doc *doc)
 {
 	struct link_ref	*r;
+	size_t		 i;
+
+	for (i = 0; i < doc->refsz; i++)
+		while ((r = doc->refs[i]) != NULL) {
+			doc->refs[i] = r->next;
+			free_link_ref(r);
+		}
+	free(doc->refs);
+	doc->refs = NULL;
+	doc->refsz = doc->refn = 0;
+}
+
+/*
+ * Look up a footnote definition by its exact name.  Returns NULL if not
+ * found.
+ */
+static struct foot_ref *
+find_foot_ref(const struct lowdown_doc *doc, const struct lowdown_buf *id)
+{
+	struct foot_ref	*ref;
+	uint32_t	 h;
+
+	if (doc->footrefsz == 0)
+		return NULL;
+	h = label_hash(id);
+	for (ref = doc->footrefs[h & (doc->footrefsz - 1)];
+	     ref != NULL; ref = ref->next)
+		if (ref->hash == h && hbuf_eq(&ref->name, id))
+			return ref;
+	return NULL;
+}
 
-	while ((r = TAILQ_FIRST(q)) != NULL) {
-		TAILQ_REMOVE(q, r, entries);
-		hbuf_free(r->link);
-		hbuf_free(r->name);
-		hbuf_free(r->title);
-		hbuf_free(r->attrs);
-		free(r);
+/*
+ * Add a footnote definition whose name has been hashed, growing the
+ * table to keep chains short.  Return FALSE on failure (memory), TRUE
+ * on success.
+ */
+static int
+add_foot_ref(struct lowdown_doc *doc, struct foot_ref *ref)
+{
+	struct foot_ref	**refs, *r;
+	size_t		  i, sz;
+
+	if (doc->footrefn >= doc->footrefsz) {
+		sz = doc->footrefsz == 0 ? 64 : doc->footrefsz * 2;
+		if ((refs = calloc(sz, sizeof(struct foot_ref *))) == NULL)
+			return 0;
+		for (i = 0; i < doc->footrefsz; i++)
+			while ((r = doc->footrefs[i]) != NULL) {
+				doc->footrefs[i] = r->next;
+				r->next = refs[r->hash & (sz - 1)];
+				refs[r->hash & (sz - 1)] = r;
+			}
+		free(doc->footrefs);
+		doc->footrefs = refs;
+		doc->footrefsz = sz;
 	}
+
+	ref->next = doc->footrefs[ref->hash & (doc->footrefsz - 1)];
+	doc->footrefs[ref->hash & (doc->footrefsz - 1)] = ref;
+	doc->footrefn++;
+	return 1;
+}
+
+static void
+free_foot_ref(struct foot_ref *ref)
+{
+
+	if (ref == NULL)
+		return;
+	hbuf_free(&ref->contents);
+	hbuf_free(&ref->name);
+	free(ref);
 }
 
 static void
-free_foot_refq(struct foot_refq *q)
+free_foot_refs(struct lowdown_doc *doc)
 {
 	struct foot_ref	*ref;
+	size_t		 i;
 
-	while ((ref = TAILQ_FIRST(q)) != NULL) {
-		TAILQ_REMOVE(q, ref, entries);
-		hbuf_free(&ref->contents);
-		hbuf_free(&ref->name);
-		free(ref);
-	}
+	for (i = 0; i < doc->footrefsz; i++)
+		while ((ref = doc->footrefs[i]) != NULL) {
+			doc->footrefs[i] = ref->next;
+			free_foot_ref(ref);
+		}
+	free(doc->footrefs);
+	doc->footrefs = NULL;
+	doc->footrefsz = doc->footrefn = 0;
 }
 
 /*
@@ -403,7 +825,7 @@ replace_spacing(struct lowdown_buf *ob, const char *data, size_t size)
 {
 	size_t	 i, mark;
 
-	if (!hbuf_grow(ob, size))
+	if (!hbuf_reserve(ob, size))
 		return 0;
 
 	for (i = 0; ; i++) {
@@ -565,25 +987,31 @@ parse_inline(struct lowdown_doc *doc, char *data, size_t size)
 	struct lowdown_buf	 work;
 	const int		*active_char = doc->active_char;
 	struct lowdown_node 	*n;
+	struct span_memo	 memo;
 
 	memset(&work, 0, sizeof(struct lowdown_buf));
-	
+
+	/* Scan memos are per span: save those of any enclosing. */
+
+	memo = doc->memo;
+	memset(&doc->memo, 0, sizeof(struct span_memo));
+	doc->memo.end = data + size;
+
 	while (i < size) {
 		/* Copying non-macro chars into the output. */
 
-		while (end < size &&
-		       active_char[(unsigned char)data[end]] == 0)
-			end++;
+		end = doc->active_set.find(&doc->active_set,
+			data, end, size);
 
 		/* Only allocate if non-empty... */
 
 		if (end - i > 0) {
 			n = pushnode(doc, LOWDOWN_NORMAL_TEXT);
 			if (n == NULL)
-				return 0;
-			if (!hbuf_push(&n->rndr_normal_text.text,
+				goto err;
+			if (!hbuf_push(doc, &n->rndr_normal_text.text,
 			    data + i, end - i))
-				return 0;
+				goto err;
 			popnode(doc, n);
 		}
 
@@ -597,7 +1025,7 @@ parse_inline(struct lowdown_doc *doc, char *data, size_t size)
 			active_char[(unsigned char)data[end]]]
 			(doc, data + i, i - consumed, size - i);
 		if (rc < 0)
-			return 0;
+			goto err;
 		end = rc;
 
 		/* Check if no action from the callback. */
@@ -611,7 +1039,17 @@ parse_inline(struct lowdown_doc *doc, char *data, size_t size)
 		end = consumed = i;
 	}
 
+	free(doc->memo.linkopen);
+	free(doc->memo.skips);
+	free(doc->memo.seen);
+	doc->memo = memo;
 	return 1;
+err:
+	free(doc->memo.linkopen);
+	free(doc->memo.skips);
+	free(doc->memo.seen);
+	doc->memo = memo;
+	return 0;
 }
 
 /*
@@ -716,13 +1154,122 @@ is_metadata_block_mmd(const char *data, size_t sz, int *is_yaml)
 }
 
 /*
- * Looks for the next emph char, skipping other constructs.
+ * Looks for "cc" in "data" from "i", returning its position or "size"
+ * if not found.  Within the inline span being parsed, remembers from
+ * where "cc" is known not to occur, so searches from each of many
+ * unclosed links don't each run to the end of the span.
+ */
+static size_t
+find_emph_closer(struct lowdown_doc *doc,
+	const char *data, size_t i, size_t size, char cc)
+{
+	const char	**no = NULL, *end = data + size, *cp;
+
+	if (end == doc->memo.end)
+		no = cc == ']' ? &doc->memo.nobrack : &doc->memo.noparen;
+	if (no != NULL && *no != NULL && *no < end)
+		end = *no;
+	if (data + i >= end)
+		return size;
+	if ((cp = memchr(data + i, cc, end - (data + i))) != NULL)
+		return cp - data;
+	if (no != NULL)
+		*no = data + i;
+	return size;
+}
+
+/*
+ * Look up the result of find_emph_char() for "c" from the construct at
+ * "pos", returning its bucket (with a NULL "pos" if not found).
+ */
+static struct emph_skip *
+emph_skip_get(const struct span_memo *m, const char *pos, char c)
+{
+	size_t	 h;
+
+	h = ((uintptr_t)pos * 31 + (unsigned char)c) & (m->skipsz - 1);
+	while (m->skips[h].pos != NULL &&
+	       (m->skips[h].pos != pos || m->skips[h].c != c))
+		h = (h + 1) & (m->skipsz - 1);
+	return &m->skips[h];
+}
+
+/*
+ * Note that a find_emph_char() search has reached the construct at
+ * "pos".  Memoisation is only an optimisation, so constructs that
+ * can't be noted for want of memory are left out.
+ */
+static void
+emph_skip_seen(struct span_memo *m, const char *pos)
+{
+	const char	**pp;
+
+	if (m->seensz == m->seenmax) {
+		pp = reallocarray(m->seen,
+			m->seenmax + 64, sizeof(char *));
+		if (pp == NULL)
+			return;
+		m->seen = pp;
+		m->seenmax += 64;
+	}
+	m->seen[m->seensz++] = pos;
+}
+
+/*
+ * Record "res" as the result of find_emph_char() for "c" from each
+ * construct its search reached, as a search reaching any of them
+ * continues the same way.  Gives up quietly if memory runs out.
+ */
+static void
+emph_skip_put(struct span_memo *m, const char *res, char c)
+{
+	struct emph_skip	*sk, *old;
+	size_t			 i, j, oldsz;
+
+	for (i = 0; i < m->seensz; i++) {
+		if (2 * (m->skipn + 1) > m->skipsz) {
+			old = m->skips;
+			oldsz = m->skipsz;
+			sk = calloc(oldsz == 0 ? 64 : oldsz * 2,
+				sizeof(struct emph_skip));
+			if (sk == NULL)
+				break;
+			m->skips = sk;
+			m->skipsz = oldsz == 0 ? 64 : oldsz * 2;
+			for (j = 0; j < oldsz; j++)
+				if (old[j].pos != NULL)
+					*emph_skip_get(m,
+					    old[j].pos, old[j].c) = old[j];
+			free(old);
+		}
+		sk = emph_skip_get(m, m->seen[i], c);
+		assert(sk->pos == NULL);
+		sk->pos = m->seen[i];
+		sk->res = res;
+		sk->c = c;
+		m->skipn++;
+	}
+	m->seensz = 0;
+}
+
+/*
+ * Looks for the next emph char, skipping other constructs.  Within the
+ * inline span being parsed, the result is remembered for each link or
+ * code span skipped: later searches reaching one of these (say, from
+ * each of many openers within a run of links) stop there.
  */
 static size_t
-find_emph_char(const char *data, size_t size, char c)
+find_emph_char(struct lowdown_doc *doc,
+	const char *data, size_t size, char c)
 {
-	size_t 	 i = 0, span_nb, bt, tmp_i;
-	char 	 cc;
+	size_t 	 	 i = 0, span_nb, bt, tmp_i, rc = 0;
+	char 	 	 cc;
+	const char	*cp;
+	struct span_memo *m = NULL;
+	struct emph_skip *sk;
+
+	if (data + size == doc->memo.end)
+		m = &doc->memo;
 
 	while (i < size) {
 		while (i < size && data[i] != c &&
@@ -730,7 +1277,7 @@ find_emph_char(const char *data, size_t size, char c)
 			i++;
 
 		if (i == size)
-			return 0;
+			break;
 
 		/* Not counting escaped chars. */
 
@@ -739,8 +1286,21 @@ find_emph_char(const char *data, size_t size, char c)
 			continue;
 		}
 
-		if (data[i] == c)
-			return i;
+		if (data[i] == c) {
+			rc = i;
+			break;
+		}
+
+		/* Have we been here before? */
+
+		if (m != NULL) {
+			if (m->skipsz > 0 &&
+			    (sk = emph_skip_get(m, data + i, c))->pos != NULL) {
+				rc = sk->res == NULL ? 0 : sk->res - data;
+				break;
+			}
+			emph_skip_seen(m, data + i);
+		}
 
 		/* Skipping a codespan. */
 
@@ -756,7 +1316,7 @@ find_emph_char(const char *data, size_t size, char c)
 			}
 
 			if (i >= size)
-				return 0;
+				break;
 
 			/* Finding the matching closing sequence. */
 
@@ -776,8 +1336,10 @@ find_emph_char(const char *data, size_t size, char c)
 			 * Not a well-formed codespan; use found
 			 * matching emph char.
 			 */
-			if (bt < span_nb && i >= size)
-				return tmp_i;
+			if (bt < span_nb && i >= size) {
+				rc = tmp_i;
+				break;
+			}
 		} else if (data[i] == '[') {
 			tmp_i = 0;
 
@@ -792,48 +1354,48 @@ find_emph_char(const char *data, size_t size, char c)
 			 */
 
 			i++;
-			while (i < size && data[i] != ']') {
-				if (!tmp_i && data[i] == c)
-					tmp_i = i;
-				i++;
-			}
+			bt = find_emph_closer(doc, data, i, size, ']');
+			if (c != ']' &&
+			    (cp = memchr(data + i, c, bt - i)) != NULL)
+				tmp_i = cp - data;
 
-			i++;
+			i = bt + 1;
 			while (i < size && xisspace(data[i]))
 				i++;
 
-			if (i >= size)
-				return tmp_i;
+			if (i >= size) {
+				rc = tmp_i;
+				break;
+			}
 
-			switch (data[i]) {
-			case '[':
+			if (data[i] == '[')
 				cc = ']';
-				break;
-			case '(':
+			else if (data[i] == '(')
 				cc = ')';
+			else if (tmp_i) {
+				rc = tmp_i;
 				break;
-			default:
-				if (tmp_i)
-					return tmp_i;
-				else
-					continue;
-			}
+			} else
+				continue;
 
 			i++;
-			while (i < size && data[i] != cc) {
-				if (!tmp_i && data[i] == c)
-					tmp_i = i;
-				i++;
-			}
+			bt = find_emph_closer(doc, data, i, size, cc);
+			if (!tmp_i && c != cc &&
+			    (cp = memchr(data + i, c, bt - i)) != NULL)
+				tmp_i = cp - data;
 
-			if (i >= size)
-				return tmp_i;
+			if (bt >= size) {
+				rc = tmp_i;
+				break;
+			}
 
-			i++;
+			i = bt + 1;
 		}
 	}
 
-	return 0;
+	if (m != NULL && m->seensz > 0)
+		emph_skip_put(m, rc == 0 ? NULL : data + rc, c);
+	return rc;
 }
 
 /*
@@ -854,7 +1416,7 @@ parse_emph1(struct lowdown_doc *doc, char *data, size_t size, char c)
 		i = 1;
 
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
+		len = find_emph_char(doc, data + i, size - i, c);
 		if (!len)
 			return 0;
 		i += len;
@@ -892,7 +1454,7 @@ parse_emph2(struct lowdown_doc *doc, char *data, size_t size, char c)
 	enum lowdown_rndrt	 t;
 
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
+		len = find_emph_char(doc, data + i, size - i, c);
 		if (len == 0)
 			return 0;
 		i += len;
@@ -933,7 +1495,7 @@ parse_emph3(struct lowdown_doc *doc, char *data, size_t size, char c)
 	struct lowdown_node	*n;
 
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
+		len = find_emph_char(doc, data + i, size - i, c);
 		if (len == 0)
 			return 0;
 		i += len;
@@ -1004,7 +1566,7 @@ parse_math(struct lowdown_doc *doc, char *data, size_t offset,
 		n = pushnode(doc, LOWDOWN_NORMAL_TEXT);
 		if (n == NULL)
 			return -1;
-		if (!hbuf_push(&n->rndr_normal_text.text, data, i))
+		if (!hbuf_push(doc, &n->rndr_normal_text.text, data, i))
 			return -1;
 		popnode(doc, n);
 		return i;
@@ -1013,7 +1575,7 @@ parse_math(struct lowdown_doc *doc, char *data, size_t offset,
 	n = pushnode(doc, LOWDOWN_MATH_BLOCK);
 	if (n == NULL)
 		return -1;
-  	if (!hbuf_create(&n->rndr_math.text,
+  	if (!hbuf_create(doc, &n->rndr_math.text,
 	    data + delimsz, i - 2 * delimsz))
 		return -1;
 	n->rndr_math.blockmode = blockmode;
@@ -1154,7 +1716,7 @@ char_codespan(struct lowdown_doc *doc,
 	if (f_begin < f_end) {
 		work.data = data + f_begin;
 		work.size = f_end - f_begin;
-		if (!hbuf_createb(&n->rndr_codespan.text, &work))
+		if (!hbuf_createb(doc, &n->rndr_codespan.text, &work))
 			return -1;
 	}
 
@@ -1214,14 +1776,15 @@ char_escape(struct lowdown_doc *doc,
 		if ((n = pushtext(doc, HTEXT_ESCAPED)) == NULL)
 			return -1;
 		n->rndr_normal_text.flags = HTEXT_ESCAPED;
-		if (!hbuf_push(&n->rndr_normal_text.text, data + 1, 1))
+		if (!hbuf_push(doc,
+		    &n->rndr_normal_text.text, data + 1, 1))
 			return -1;
 		popnode(doc, n);
 	} else if (size == 1) {
 		if ((n = pushtext(doc, HTEXT_ESCAPED)) == NULL)
 			return -1;
 		n->rndr_normal_text.flags = HTEXT_ESCAPED;
-		if (!hbuf_push(&n->rndr_normal_text.text, data, 1))
+		if (!hbuf_push(doc, &n->rndr_normal_text.text, data, 1))
 			return -1;
 		popnode(doc, n);
 	}
@@ -1253,7 +1816,7 @@ char_entity(struct lowdown_doc *doc,
 
 	if ((n = pushnode(doc, LOWDOWN_ENTITY)) == NULL)
 		return -1;
-	if (!hbuf_create(&n->rndr_entity.text, data, end))
+	if (!hbuf_create(doc, &n->rndr_entity.text, data, end))
 		return -1;
 	popnode(doc, n);
 	return end;
@@ -1280,7 +1843,7 @@ char_langle_tag(struct lowdown_doc *doc,
 
 	if (end > 2) {
 		if (altype != HALINK_NONE) {
-			if ((u_link = hbuf_new(64)) == NULL)
+			if ((u_link = scratch_get(doc)) == NULL)
 				goto err;
 			work.data = data + 1;
 			work.size = end - 2;
@@ -1291,7 +1854,8 @@ char_langle_tag(struct lowdown_doc *doc,
 			if (n == NULL)
 				goto err;
 			n->rndr_autolink.type = altype;
-			if (!hbuf_createb(&n->rndr_autolink.link, u_link))
+			if (!hbuf_createb(doc,
+			    &n->rndr_autolink.link, u_link))
 				goto err;
 			popnode(doc, n);
 		} else {
@@ -1299,17 +1863,17 @@ char_langle_tag(struct lowdown_doc *doc,
 			if (n == NULL)
 				goto err;
 			if (!hbuf_create
-			    (&n->rndr_raw_html.text, data, end))
+			    (doc, &n->rndr_raw_html.text, data, end))
 				goto err;
 			popnode(doc, n);
 		}
 		ret = 1;
 	}
 
-	hbuf_free(u_link);
+	scratch_put(doc, u_link);
 	return !ret ? 0 : end;
 err:
-	hbuf_free(u_link);
+	scratch_put(doc, u_link);
 	return -1;
 }
 
@@ -1327,7 +1891,7 @@ char_autolink_www(struct lowdown_doc *doc,
 
 	if (doc->in_link_body)
 		return 0;
-	if ((link = hbuf_new(64)) == NULL)
+	if ((link = scratch_get(doc)) == NULL)
 		goto err;
 	ret = halink_www(&rewind, link, data, offset, size);
 	if (ret < 0)
@@ -1335,7 +1899,7 @@ char_autolink_www(struct lowdown_doc *doc,
 	link_len = ret;
 
 	if (link_len > 0) {
-		if ((link_url = hbuf_new(64)) == NULL)
+		if ((link_url = scratch_get(doc)) == NULL)
 			goto err;
 		if (!HBUF_PUTSL(link_url, "http://"))
 			goto err;
@@ -1355,17 +1919,17 @@ char_autolink_www(struct lowdown_doc *doc,
 		if ((n = pushnode(doc, LOWDOWN_LINK_AUTO)) == NULL)
 			goto err;
 		n->rndr_autolink.type = HALINK_NORMAL;
-		if (!hbuf_createb(&n->rndr_autolink.link, link_url))
+		if (!hbuf_createb(doc, &n->rndr_autolink.link, link_url))
 			goto err;
 		popnode(doc, n);
 	}
 
-	hbuf_free(link);
-	hbuf_free(link_url);
+	scratch_put(doc, link);
+	scratch_put(doc, link_url);
 	return link_len;
 err:
-	hbuf_free(link);
-	hbuf_free(link_url);
+	scratch_put(doc, link);
+	scratch_put(doc, link_url);
 	return -1;
 }
 
@@ -1383,7 +1947,7 @@ char_autolink_email(struct lowdown_doc *doc,
 
 	if (doc->in_link_body)
 		return 0;
-	if ((link = hbuf_new(64)) == NULL)
+	if ((link = scratch_get(doc)) == NULL)
 		goto err;
 	ret = halink_email(&rewind, link, data, offset, size);
 	if (ret < 0)
@@ -1404,15 +1968,15 @@ char_autolink_email(struct lowdown_doc *doc,
 		if ((n = pushnode(doc, LOWDOWN_LINK_AUTO)) == NULL)
 			goto err;
 		n->rndr_autolink.type = HALINK_EMAIL;
-		if (!hbuf_createb(&n->rndr_autolink.link, link))
+		if (!hbuf_createb(doc, &n->rndr_autolink.link, link))
 			goto err;
 		popnode(doc, n);
 	}
 
-	hbuf_free(link);
+	scratch_put(doc, link);
 	return link_len;
 err:
-	hbuf_free(link);
+	scratch_put(doc, link);
 	return -1;
 }
 
@@ -1430,7 +1994,7 @@ char_autolink_url(struct lowdown_doc *doc,
 
 	if (doc->in_link_body)
 		return 0;
-	if ((link = hbuf_new(64)) == NULL)
+	if ((link = scratch_get(doc)) == NULL)
 		goto err;
 	ret = halink_url(&rewind, link, data, offset, size);
 	if (ret < 0)
@@ -1451,15 +2015,15 @@ char_autolink_url(struct lowdown_doc *doc,
 		if ((n = pushnode(doc, LOWDOWN_LINK_AUTO)) == NULL)
 			goto err;
 		n->rndr_autolink.type = HALINK_NORMAL;
-		if (!hbuf_createb(&n->rndr_autolink.link, link))
+		if (!hbuf_createb(doc, &n->rndr_autolink.link, link))
 			goto err;
 		popnode(doc, n);
 	}
 
-	hbuf_free(link);
+	scratch_put(doc, link);
 	return link_len;
 err:
-	hbuf_free(link);
+	scratch_put(doc, link);
 	return -1;
 }
 
@@ -1485,11 +2049,12 @@ char_image(struct lowdown_doc *doc,
  * on success.
  */
 static int
-parse_header_ext_attrs(struct lowdown_node *n)
+parse_header_ext_attrs(struct lowdown_doc *doc, struct lowdown_node *n)
 {
 	struct lowdown_node	*nn;
 	struct lowdown_buf	*b;
-	size_t			 i;
+	struct lowdown_attr	*attrs = NULL;
+	size_t			 i, attrsz = 0;
 	int			 rc = 0;
 
 	/*
@@ -1518,8 +2083,13 @@ parse_header_ext_attrs(struct lowdown_node *n)
 	/* Parse the extended attributes. */
 
 	if (!lowdown_attrs_parse(&b->data[i + 1], b->size - i - 2,
-	    &n->rndr_header.attrs, &n->rndr_header.attrsz))
+	    &attrs, &attrsz) ||
+	    !lowdown_attrs_adopt(doc->arena, &attrs, attrsz))
 		goto out;
+	n->rndr_header.attrs = attrs;
+	n->rndr_header.attrsz = attrsz;
+	attrs = NULL;
+	attrsz = 0;
 
 	b->size = i;
 	while (b->size && b->data[b->size - 1] == ' ')
@@ -1534,38 +2104,158 @@ parse_header_ext_attrs(struct lowdown_node *n)
 
 	rc = 1;
 out:
+	lowdown_attrs_free(attrs, attrsz);
 	return rc;
 }
 
 /*
- * '[': parsing a link, footnote, metadata, or image.
+ * Looks for any of "set" in "data" from "i", skipping characters
+ * escaped by a backslash, returning its position or "size" if not
+ * found.  Like find_emph_closer(), "no" (if not NULL) records from
+ * where the search is known to fail.  Searches start just after a
+ * character other than a backslash, so a later search escapes the
+ * same characters as an earlier one that ran past its start.
  */
-static ssize_t
-char_link(struct lowdown_doc *doc,
-	char *data, size_t offset, size_t size)
+static size_t
+find_link_stop(const char **no,
+	const char *data, size_t i, size_t size, const char *set)
 {
-	struct lowdown_buf	*content = NULL, *link = NULL,
-				*title = NULL, *u_link = NULL,
-				*dims = NULL, *idp = NULL,
-				*linkp = NULL, *titlep = NULL;
-	size_t			 i = 1, j, txt_e, link_b = 0, link_e = 0,
-				 title_b = 0, title_e = 0, nb_p,
-				 dims_b = 0, dims_e = 0;
-	int 	 		 ret = 0, in_title = 0, qtype = 0,
-				 is_img, is_footnote, is_metadata;
-	struct lowdown_attr	*attrs = NULL;
-	size_t			 attrsz = 0;
-	struct lowdown_buf	 id;
-	struct link_ref 	*lr = NULL;
-	struct foot_ref	 	*fr;
-	struct lowdown_node 	*n;
-	struct lowdown_meta	*m;
+	size_t	 beg = i;
 
-	is_img = offset && data[-1] == '!' &&
-		!is_escaped(data - offset, offset - 1);
-	is_footnote = (doc->ext_flags & LOWDOWN_FOOTNOTES) &&
-		data[1] == '^';
-	is_metadata = (doc->ext_flags & LOWDOWN_METADATA) &&
+	if (no != NULL && *no != NULL && data + i >= *no)
+		return size;
+	for ( ; i < size; i++)
+		if (data[i] == '\\')
+			i++;
+		else if (data[i] != '\0' && strchr(set, data[i]) != NULL)
+			return i;
+	if (no != NULL)
+		*no = data + beg;
+	return size;
+}
+
+/*
+ * If the link target opened by the parenthesis at data[paren] is known
+ * to end where an earlier scan of an unclosed target stopped, return
+ * that position (or "size" if at the end of the span); otherwise zero.
+ */
+static size_t
+link_end_known(struct lowdown_doc *doc,
+	const char *data, size_t paren, size_t size)
+{
+	struct span_memo	*m = &doc->memo;
+	const char		*cp = data + paren;
+
+	if (data + size != m->end || m->linkbeg == NULL ||
+	    cp < m->linkbeg || cp >= m->linkend)
+		return 0;
+	while (m->linkopenpos < m->linkopensz &&
+	       m->linkopen[m->linkopenpos] < cp)
+		m->linkopenpos++;
+	if (m->linkopenpos == m->linkopensz ||
+	    m->linkopen[m->linkopenpos] != cp)
+		return 0;
+	return m->linkend - data;
+}
+
+/*
+ * Remember that the scan for the end of a link target from data[beg]
+ * stopped at data[end] (or the end of the span) short of a closing
+ * parenthesis, along with the parentheses it left open: a target
+ * opened by one of these ends at the same place.  The parentheses are
+ * found by walking back from the stop.
+ * Return zero on memory failure, non-zero on success.
+ */
+static int
+link_end_save(struct lowdown_doc *doc,
+	const char *data, size_t beg, size_t end, size_t size)
+{
+	struct span_memo	*m = &doc->memo;
+	size_t			 i, j, nb = 0;
+	const char		*cp, **pp;
+
+	if (data + size != m->end)
+		return 1;
+	if (end > size)
+		end = size;
+
+	m->linkbeg = data + beg;
+	m->linkend = data + end;
+	m->linkopensz = m->linkopenpos = 0;
+
+	for (i = end; i > beg; i--) {
+		if ((data[i - 1] != '(' && data[i - 1] != ')') ||
+		    is_escaped(data + beg, i - 1 - beg))
+			continue;
+		if (data[i - 1] == ')') {
+			nb++;
+			continue;
+		} else if (nb > 0) {
+			nb--;
+			continue;
+		}
+		if (m->linkopensz == m->linkopenmax) {
+			pp = reallocarray(m->linkopen,
+				m->linkopenmax + 64, sizeof(char *));
+			if (pp == NULL)
+				return 0;
+			m->linkopen = pp;
+			m->linkopenmax += 64;
+		}
+		m->linkopen[m->linkopensz++] = data + i - 1;
+	}
+
+	/* Collected from the back: put in order. */
+
+	for (i = 0, j = m->linkopensz; i < j / 2; i++) {
+		cp = m->linkopen[i];
+		m->linkopen[i] = m->linkopen[j - i - 1];
+		m->linkopen[j - i - 1] = cp;
+	}
+	return 1;
+}
+
+/*
+ * Return the address of a scan memo of the inline span if "data" of
+ * "size" ends with the span, else NULL.
+ */
+static const char **
+link_memo(struct lowdown_doc *doc,
+	const char *data, size_t size, const char **p)
+{
+
+	return data + size == doc->memo.end ? p : NULL;
+}
+
+/*
+ * '[': parsing a link, footnote, metadata, or image.
+ */
+static ssize_t
+char_link(struct lowdown_doc *doc,
+	char *data, size_t offset, size_t size)
+{
+	struct lowdown_buf	*content = NULL, *link = NULL,
+				*title = NULL, *u_link = NULL,
+				*dims = NULL, *idp = NULL,
+				*linkp = NULL, *titlep = NULL;
+	size_t			 i = 1, j, txt_e, link_b = 0, link_e = 0,
+				 title_b = 0, title_e = 0, nb_p,
+				 dims_b = 0, dims_e = 0, paren;
+	int 	 		 ret = 0, qtype = 0,
+				 is_img, is_footnote, is_metadata;
+	struct lowdown_attr	*attrs = NULL;
+	size_t			 attrsz = 0;
+	struct lowdown_buf	 id;
+	struct link_ref 	*lr = NULL;
+	struct foot_ref	 	*fr;
+	struct lowdown_node 	*n;
+	const struct lowdown_meta *m;
+
+	is_img = offset && data[-1] == '!' &&
+		!is_escaped(data - offset, offset - 1);
+	is_footnote = (doc->ext_flags & LOWDOWN_FOOTNOTES) &&
+		data[1] == '^';
+	is_metadata = (doc->ext_flags & LOWDOWN_METADATA) &&
 		data[1] == '%';
 
 	/*
@@ -1582,7 +2272,7 @@ char_link(struct lowdown_doc *doc,
 
 	/* Looking for the matching closing bracket. */
 
-	i += find_emph_char(data + i, size - i, ']');
+	i += find_emph_char(doc, data + i, size - i, ']');
 	txt_e = i;
 
 	if (i < size && data[i] == ']')
@@ -1599,7 +2289,8 @@ char_link(struct lowdown_doc *doc,
 		n = pushnode(doc, LOWDOWN_NORMAL_TEXT);
 		if (n == NULL)
 			goto err;
-		if (!hbuf_push(&n->rndr_normal_text.text, &data[-1], 1))
+		if (!hbuf_push(doc,
+		    &n->rndr_normal_text.text, &data[-1], 1))
 			goto err;
 		popnode(doc, n);
 	}
@@ -1618,9 +2309,12 @@ char_link(struct lowdown_doc *doc,
 		id.data = data + 2;
 		id.size = txt_e - 2;
 
-		TAILQ_FOREACH(fr, &doc->footq, entries)
-			if (hbuf_eq(&fr->name, &id))
-				break;
+		fr = find_foot_ref(doc, &id);
+		if (doc->rp != NULL) {
+			doc->rp->foot = 1;
+			if (fr == NULL)
+				doc->rp->unres = 1;
+		}
 
 		/* Override. */
 
@@ -1652,7 +2346,7 @@ char_link(struct lowdown_doc *doc,
 			n = pushnode(doc, LOWDOWN_NORMAL_TEXT);
 			if (n == NULL)
 				goto err;
-			if (!hbuf_push(&n->rndr_normal_text.text,
+			if (!hbuf_push(doc, &n->rndr_normal_text.text,
 			    data, txt_e + 1))
 				goto err;
 		}
@@ -1675,20 +2369,21 @@ char_link(struct lowdown_doc *doc,
 		id.data = data + 2;
 		id.size = txt_e - 2;
 
-		/* FIXME: slow O(n). */
+		/*
+		 * Keys are normalised to lowercase, so the index (which
+		 * ignores case) has at most one candidate.
+		 */
 
-		TAILQ_FOREACH(m, doc->metaq, entries) {
-			if (!hbuf_streq(&id, m->key))
-				continue;
+		m = metaidx_get(&doc->metaidx, id.data, id.size);
+		if (m != NULL && hbuf_streq(&id, m->key)) {
 			assert(m->value != NULL);
 			n = pushnode(doc, LOWDOWN_NORMAL_TEXT);
 			if (n == NULL)
 				goto err;
-			if (!hbuf_push(&n->rndr_normal_text.text,
+			if (!hbuf_push(doc, &n->rndr_normal_text.text,
 			    m->value, strlen(m->value)))
 				goto err;
 			popnode(doc, n);
-			break;
 		}
 
 		ret = 1;
@@ -1706,7 +2401,7 @@ char_link(struct lowdown_doc *doc,
 	/* Different style of links (regular, reference, shortcut. */
 
 	if (i < size && data[i] == '(') {
-		i++;
+		paren = i++;
 		while (i < size && xisspace(data[i]))
 			i++;
 
@@ -1719,7 +2414,10 @@ char_link(struct lowdown_doc *doc,
 
 		nb_p = 0;
 
-		while (i < size) {
+		if ((j = link_end_known(doc, data, paren, size)) > 0)
+			i = j;
+
+		while (j == 0 && i < size) {
 			if (data[i] == '\\') {
 				i += 2;
 			} else if (data[i] == '(' && i != 0) {
@@ -1740,6 +2438,10 @@ char_link(struct lowdown_doc *doc,
 				i++;
 		}
 
+		if (j == 0 && (i >= size || data[i] != ')') &&
+		    !link_end_save(doc, data, link_b, i, size))
+			goto err;
+
 		if (i >= size)
 			goto cleanup;
 
@@ -1758,19 +2460,18 @@ again:
 			 */
 
 			qtype = data[i];
-			in_title = 1;
 			i++;
 			title_b = i;
 
-			for ( ; i < size; i++)
-				if (data[i] == '\\')
-					i++;
-				else if (data[i] == qtype)
-					in_title = 0;
-				else if ((data[i] == '=') && !in_title)
-					break;
-				else if ((data[i] == ')') && !in_title)
-					break;
+			/* The title ends at its quote, then ) or =. */
+
+			i = find_link_stop(link_memo(doc, data, size,
+			    &doc->memo.noquote[qtype == '"']),
+			    data, i, size, qtype == '"' ? "\"" : "'");
+			if (i < size)
+				i = find_link_stop(link_memo(doc, data, size,
+				    &doc->memo.notitle),
+				    data, i + 1, size, ")=");
 
 			if (i >= size)
 				goto cleanup;
@@ -1799,13 +2500,8 @@ again:
 				goto again;
 		} else if (data[i] == '=') {
 			dims_b = ++i;
-			for ( ; i < size; i++)
-				if (data[i] == '\\')
-					i++;
-				else if ('\'' == data[i] || '"' == data[i])
-					break;
-				else if (data[i] == ')')
-					break;
+			i = find_link_stop(link_memo(doc, data, size,
+			    &doc->memo.nodims), data, i, size, "'\")");
 
 			if (i >= size)
 				goto cleanup;
@@ -1840,7 +2536,7 @@ again:
 
 		/* building escaped link and title */
 		if (link_e > link_b) {
-			link = linkp = hbuf_new(64);
+			link = linkp = scratch_get(doc);
 			if (linkp == NULL)
 				goto err;
 			if (!hbuf_put(link,
@@ -1849,7 +2545,7 @@ again:
 		}
 
 		if (title_e > title_b) {
-			title = titlep = hbuf_new(64);
+			title = titlep = scratch_get(doc);
 			if (titlep == NULL)
 				goto err;
 			if (!hbuf_put(title,
@@ -1858,7 +2554,7 @@ again:
 		}
 
 		if (dims_e > dims_b) {
-			if ((dims = hbuf_new(64)) == NULL)
+			if ((dims = scratch_get(doc)) == NULL)
 				goto err;
 			if (!hbuf_put(dims,
 			    data + dims_b, dims_e - dims_b))
@@ -1867,15 +2563,14 @@ again:
 
 		i++;
 	} else if (i < size && data[i] == '[') {
-		if ((idp = hbuf_new(64)) == NULL)
+		if ((idp = scratch_get(doc)) == NULL)
 			goto err;
 
 		/* Looking for the id. */
 
 		i++;
 		link_b = i;
-		while (i < size && data[i] != ']')
-			i++;
+		i = find_emph_closer(doc, data, i, size, ']');
 		if (i >= size)
 			goto cleanup;
 		link_e = i;
@@ -1891,9 +2586,12 @@ again:
 			    data + link_b, link_e - link_b))
 				goto err;
 
-		lr = find_link_ref(&doc->refq, idp->data, idp->size);
-		if (lr == NULL)
+		lr = find_link_ref(doc, idp);
+		if (lr == NULL) {
+			if (doc->rp != NULL)
+				doc->rp->unres = 1;
 			goto cleanup;
+		}
 
 		/* Keeping link and title from link_ref. */
 
@@ -1909,7 +2607,7 @@ again:
 		/*
 		 * Shortcut reference style link.
 		 */
-		if ((idp = hbuf_new(64)) == NULL)
+		if ((idp = scratch_get(doc)) == NULL)
 			goto err;
 
 		/* Crafting the id. */
@@ -1919,9 +2617,12 @@ again:
 
 		/* Finding the link_ref. */
 
-		lr = find_link_ref(&doc->refq, idp->data, idp->size);
-		if (lr == NULL)
+		lr = find_link_ref(doc, idp);
+		if (lr == NULL) {
+			if (doc->rp != NULL)
+				doc->rp->unres = 1;
 			goto cleanup;
+		}
 
 		/* Keeping link and title from link_ref. */
 
@@ -1975,7 +2676,7 @@ again:
 				goto err;
 			doc->in_link_body = 0;
 		} else {
-			if ((content = hbuf_new(64)) == NULL)
+			if ((content = scratch_get(doc)) == NULL)
 				goto err;
 			if (!hbuf_put(content, data + 1, txt_e - 1))
 				goto err;
@@ -1983,7 +2684,7 @@ again:
 	}
 
 	if (link) {
-		if ((u_link = hbuf_new(64)) == NULL)
+		if ((u_link = scratch_get(doc)) == NULL)
 			goto err;
 		if (!unscape_text(u_link, link))
 			goto err;
@@ -1993,26 +2694,30 @@ again:
 
 	if (is_img) {
 		if (u_link != NULL &&
-		    !hbuf_createb(&n->rndr_image.link, u_link))
+		    !hbuf_createb(doc, &n->rndr_image.link, u_link))
 			goto err;
 		if (title != NULL &&
-		    !hbuf_createb(&n->rndr_image.title, title))
+		    !hbuf_createb(doc, &n->rndr_image.title, title))
 			goto err;
 		if (dims != NULL &&
-		    !hbuf_createb(&n->rndr_image.dims, dims))
+		    !hbuf_createb(doc, &n->rndr_image.dims, dims))
 			goto err;
 		if (content != NULL &&
-		    !hbuf_createb(&n->rndr_image.alt, content))
+		    !hbuf_createb(doc, &n->rndr_image.alt, content))
+			goto err;
+		if (!lowdown_attrs_adopt(doc->arena, &attrs, attrsz))
 			goto err;
 		n->rndr_image.attrs = attrs;
 		n->rndr_image.attrsz = attrsz;
 		ret = 1;
 	} else {
 		if (u_link != NULL &&
-		    !hbuf_createb(&n->rndr_link.link, u_link))
+		    !hbuf_createb(doc, &n->rndr_link.link, u_link))
 			goto err;
 		if (title != NULL &&
-		    !hbuf_createb(&n->rndr_link.title, title))
+		    !hbuf_createb(doc, &n->rndr_link.title, title))
+			goto err;
+		if (!lowdown_attrs_adopt(doc->arena, &attrs, attrsz))
 			goto err;
 		n->rndr_link.attrs = attrs;
 		n->rndr_link.attrsz = attrsz;
@@ -2028,12 +2733,12 @@ err:
 	ret = -1;
 cleanup:
 	lowdown_attrs_free(attrs, attrsz);
-	hbuf_free(linkp);
-	hbuf_free(titlep);
-	hbuf_free(dims);
-	hbuf_free(idp);
-	hbuf_free(content);
-	hbuf_free(u_link);
+	scratch_put(doc, linkp);
+	scratch_put(doc, titlep);
+	scratch_put(doc, dims);
+	scratch_put(doc, idp);
+	scratch_put(doc, content);
+	scratch_put(doc, u_link);
 	return ret > 0 ? (ssize_t)i : ret;
 }
 
@@ -2076,7 +2781,7 @@ char_supsubscript(struct lowdown_doc *doc, char *data, size_t offset,
 			return 2;
 	} else if (data[1] == '(') {
 		sup_start = 2;
-		sup_len = find_emph_char(data + 2, size - 2, ')') + 2;
+		sup_len = find_emph_char(doc, data + 2, size - 2, ')') + 2;
 		if (sup_len == size)
 			return 0;
 		end = sup_len + 1;
@@ -2127,6 +2832,33 @@ char_math(struct lowdown_doc *doc,
 		parse_math(doc, data, offset, size, "$", 1, 0);
 }
 
+/*
+ * Return the position of the newline at or after "i", or "size" if
+ * there's none.  Block parsing spends much of its time looking for line
+ * ends, so this uses memchr(3), which is vectorised on most systems.
+ */
+static size_t
+find_eol(const char *data, size_t i, size_t size)
+{
+	const char	*cp;
+
+	if (i >= size)
+		return size;
+	cp = memchr(data + i, '\n', size - i);
+	return cp == NULL ? size : (size_t)(cp - data);
+}
+
+/*
+ * Return the start of the line after the one containing "i", or "size"
+ * if it's the last line.
+ */
+static size_t
+next_line(const char *data, size_t i, size_t size)
+{
+
+	return (i = find_eol(data, i, size)) < size ? i + 1 : size;
+}
+
 /*
  * Returns the line length when it is empty, 0 otherwise.
  */
@@ -2142,6 +2874,23 @@ is_empty(const char *data, size_t size)
 	return i + 1;
 }
 
+/*
+ * With LOWDOWN_REPARSE, note that a top-level block looked at all of
+ * "data" of length "size" to find its end.  This is only needed where
+ * the look-ahead is unbounded: see block_close() for the usual case.
+ */
+static void
+block_seen(struct lowdown_doc *doc, const char *data, size_t size)
+{
+	size_t	 off;
+
+	if (doc->rp == NULL || doc->current->parent != NULL)
+		return;
+	off = (size_t)(data - doc->rp->base) + size;
+	if (off > doc->rp->seen)
+		doc->rp->seen = off;
+}
+
 /*
  * Returns whether a line is a horizontal rule.
  */
@@ -2232,7 +2981,7 @@ is_fencedcode(const struct lowdown_doc *doc, const char *data,
  * Returns TRUE if the fenced code exists, FALSE otherwise.
  */
 static size_t
-is_fencedcode_block(const struct lowdown_doc *doc, const char *data,
+is_fencedcode_block(struct lowdown_doc *doc, const char *data,
     size_t size)
 {
 	size_t	 i;
@@ -2250,10 +2999,13 @@ is_fencedcode_block(const struct lowdown_doc *doc, const char *data,
 			i++;
 		while (i < size && data[i] == '\n')
 			i++;
-		if (is_fencedcode(doc, data + i, size - i, NULL, NULL))
+		if (is_fencedcode(doc, data + i, size - i, NULL, NULL)) {
+			block_seen(doc, data, next_line(data, i, size));
 			return 1;
+		}
 	}
 
+	block_seen(doc, data, size);
 	return 0;
 }
 
@@ -2518,6 +3270,66 @@ prefix_uli(const struct lowdown_doc *doc,
 	return i + 2;
 }
 
+/*
+ * Append "sz" bytes of "data" to the content of a container.  Content
+ * is compacted in-place at the start of the container's input, which is
+ * possible because prefixes are only ever removed: the content never
+ * overtakes the input.  This way, nested containers are parsed without
+ * copies.  The exceptions are parallel parsers, which share their
+ * input, and LOWDOWN_REPARSE, which compares edits to the input of the
+ * last parse: these copy the content into a buffer instead.
+ * Returns zero on failure (memory), non-zero on success.
+ */
+static int
+container_put(const struct lowdown_doc *doc, struct container *c,
+    char *data, size_t sz)
+{
+
+	if (doc->stop != NULL || doc->rp != NULL) {
+		if (c->buf == NULL && (c->buf = hbuf_new(256)) == NULL)
+			return 0;
+		if (!hbuf_put(c->buf, data, sz))
+			return 0;
+	} else if (c->data == NULL)
+		c->data = data;
+	else if (data != c->data + c->size)
+		memmove(c->data + c->size, data, sz);
+	c->size += sz;
+	return 1;
+}
+
+/*
+ * Append a newline standing for empty lines in the input, which had at
+ * least one byte, to the content of a container.  Returns zero on
+ * failure (memory), non-zero on success.
+ */
+static int
+container_newline(struct container *c)
+{
+
+	if (c->buf != NULL) {
+		if (!hbuf_putc(c->buf, '\n'))
+			return 0;
+	} else {
+		assert(c->data != NULL);
+		c->data[c->size] = '\n';
+	}
+	c->size++;
+	return 1;
+}
+
+/*
+ * Finish collecting the content of a container, which may then be
+ * parsed from "data" of length "size".
+ */
+static void
+container_done(struct container *c)
+{
+
+	if (c->buf != NULL)
+		c->data = c->buf->data;
+}
+
 /*
  * Handles parsing of a blockquote fragment.
  * Return <0 on failure, otherwise the end offset.
@@ -2525,16 +3337,15 @@ prefix_uli(const struct lowdown_doc *doc,
 static ssize_t
 parse_blockquote(struct lowdown_doc *doc, char *data, size_t size)
 {
-	size_t			 beg = 0, end = 0, pre, work_size = 0;
-	char			*work_data = NULL;
+	size_t			 beg = 0, end = 0, pre;
+	struct container	 c;
 	struct lowdown_node	*n, *nn, *nnn;
+	int			 rc;
 
-	while (beg < size) {
-		for (end = beg + 1;
-		     end < size && data[end - 1] != '\n';
-		     end++)
-			continue;
+	memset(&c, 0, sizeof(struct container));
 
+	while (beg < size) {
+		end = next_line(data, beg, size);
 		pre = prefix_quote(data + beg, end - beg);
 
 		/* Skip prefix or empty line followed by non-quote. */
@@ -2547,21 +3358,19 @@ parse_blockquote(struct lowdown_doc *doc, char *data, size_t size)
 			   !is_empty(data + end, size - end))))
 			break;
 
-		if (beg < end) {
-			if (!work_data)
-				work_data = data + beg;
-			else if (data + beg != work_data + work_size)
-				memmove(work_data + work_size,
-					data + beg, end - beg);
-			work_size += end - beg;
+		if (beg < end &&
+		    !container_put(doc, &c, data + beg, end - beg)) {
+			hbuf_free(c.buf);
+			return -1;
 		}
 		beg = end;
 	}
 
+	container_done(&c);
 	n = pushnode(doc, LOWDOWN_BLOCKQUOTE);
-	if (n == NULL)
-		return -1;
-	if (!parse_block(doc, work_data, work_size))
+	rc = n != NULL && parse_block(doc, c.data, c.size);
+	hbuf_free(c.buf);
+	if (!rc)
 		return -1;
 	popnode(doc, n);
 
@@ -2640,9 +3449,7 @@ parse_paragraph(struct lowdown_doc *doc, char *data, size_t size)
 	while (i < size) {
 		/* Parse ahead to the next newline. */
 
-		for (end = i + 1;
-		     end < size && data[end - 1] != '\n'; end++)
-			continue;
+		end = next_line(data, i, size);
 
 		/*
 		 * Empty line: end of paragraph.
@@ -2735,7 +3542,7 @@ parse_paragraph(struct lowdown_doc *doc, char *data, size_t size)
 	popnode(doc, n);
 
 	if ((doc->ext_flags & LOWDOWN_ATTRS) &&
-	    !parse_header_ext_attrs(n))
+	    !parse_header_ext_attrs(doc, n))
 		return -1;
 
 	return end;
@@ -2765,8 +3572,7 @@ parse_fencedcode(struct lowdown_doc *doc, char *data, size_t size)
 
 	/* Parse codefence line. */
 
-	while (i < size && data[i] != '\n')
-		i++;
+	i = find_eol(data, i, size);
 	w = parse_fencedcode_line(doc, data, i, &lang, &width, &chr);
 	if (w == 0)
 		return 0;
@@ -2776,8 +3582,7 @@ parse_fencedcode(struct lowdown_doc *doc, char *data, size_t size)
 	i++;
 	text_start = i;
 	while ((line_start = i) < size) {
-		while (i < size && data[i] != '\n')
-			i++;
+		i = find_eol(data, i, size);
 		w2 = is_fencedcode(doc, data + line_start,
 			i - line_start, &width2, &chr2);
 		if (w == w2 &&
@@ -2795,8 +3600,8 @@ parse_fencedcode(struct lowdown_doc *doc, char *data, size_t size)
 	text.size = line_start - text_start;
 
 	if ((n = pushnode(doc, LOWDOWN_BLOCKCODE)) == NULL ||
-	    !hbuf_createb(&n->rndr_blockcode.text, &text) ||
-	    !hbuf_createb(&n->rndr_blockcode.lang, &lang))
+	    !hbuf_createb(doc, &n->rndr_blockcode.text, &text) ||
+	    !hbuf_createb(doc, &n->rndr_blockcode.lang, &lang))
 		return -1;
 
 	popnode(doc, n);
@@ -2810,15 +3615,11 @@ parse_blockcode(struct lowdown_doc *doc, char *data, size_t size)
 	struct lowdown_buf	*work = NULL;
 	struct lowdown_node 	*n;
 
-	if ((work = hbuf_new(256)) == NULL)
+	if ((work = scratch_get(doc)) == NULL)
 		goto err;
 
 	while (beg < size) {
-		for (end = beg + 1;
-		     end < size && data[end - 1] != '\n';
-		     end++)
-			continue;
-
+		end = next_line(data, beg, size);
 		pre = prefix_code(data + beg, end - beg);
 
 		/*
@@ -2857,13 +3658,13 @@ parse_blockcode(struct lowdown_doc *doc, char *data, size_t size)
 
 	if ((n = pushnode(doc, LOWDOWN_BLOCKCODE)) == NULL)
 		goto err;
-	if (!hbuf_createb(&n->rndr_blockcode.text, work))
+	if (!hbuf_createb(doc, &n->rndr_blockcode.text, work))
 		goto err;
 	popnode(doc, n);
-	hbuf_free(work);
+	scratch_put(doc, work);
 	return beg;
 err:
-	hbuf_free(work);
+	scratch_put(doc, work);
 	return -1;
 }
 
@@ -2872,10 +3673,10 @@ err:
  * removed.
  */
 static ssize_t
-parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
-    char *data, size_t size, enum hlist_fl *flags, size_t num)
+parse_listitem(struct lowdown_doc *doc, char *data, size_t size,
+    enum hlist_fl *flags, size_t num)
 {
-	struct lowdown_buf	*work = NULL;
+	struct container	 c;
 	size_t			 beg = 0, end, pre, sublist = 0,
 				 orgpre, i, has_next_uli = 0, dli_lines,
 				 has_next_oli = 0, has_next_dli = 0,
@@ -2904,14 +3705,10 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 	while (end < size && data[end - 1] != '\n')
 		end++;
 
-	/* Getting working buffers. */
-
-	if ((work = hbuf_new(64)) == NULL)
-		goto err;
-
-	/* Putting the first line into the working buffer. */
+	/* Putting the first line into the content. */
 
-	if (!hbuf_put(work, data + beg, end - beg))
+	memset(&c, 0, sizeof(struct container));
+	if (!container_put(doc, &c, data + beg, end - beg))
 		goto err;
 	beg = end;
 	dli_lines = 1;
@@ -2924,10 +3721,7 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 
 	while (beg < size) {
 		has_next_uli = has_next_oli = has_next_dli = 0;
-		end++;
-
-		while (end < size && data[end - 1] != '\n')
-			end++;
+		end = next_line(data, end, size);
 
 		/*
 		 * Process an empty line.  If this has followed text on
@@ -2982,7 +3776,8 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 		    NULL, NULL)) {
 			in_fence = !in_fence;
 			contains_fenced += in_fence;
-			if (!hbuf_put(work, data + beg + i, end - beg - i))
+			if (!container_put(doc, &c,
+			    data + beg + i, end - beg - i))
 				goto err;
 			beg = end;
 			in_empty = 0;
@@ -2990,9 +3785,10 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 		}
 		
 		if (in_fence) {
-			if (in_empty && !HBUF_PUTSL(work, "\n"))
+			if (in_empty && !container_newline(&c))
 				goto err;
-			if (!hbuf_put(work, data + beg + i, end - beg - i))
+			if (!container_put(doc, &c,
+			    data + beg + i, end - beg - i))
 				goto err;
 			beg = end;
 			in_empty = 0;
@@ -3071,7 +3867,7 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 			}
 
 			if (sublist == 0)
-				sublist = work->size;
+				sublist = c.size;
 		} else if (in_empty && pre == 0) {
 			/*
 			 * Joining only indented stuff after empty
@@ -3097,23 +3893,22 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 
 
 		if (in_empty) {
-			if (!hbuf_putc(work, '\n'))
+			if (!container_newline(&c))
 				goto err;
 			if (sublist == 0)
 				has_block = 1;
 			in_empty = 0;
 		}
 
-		/*
-		 * Adding the line without prefix into the working
-		 * buffer.
-		 */
+		/* Adding the line without prefix into the content. */
 
-		if (!hbuf_put(work, data + beg + i, end - beg - i))
+		if (!container_put(doc, &c, data + beg + i, end - beg - i))
 			goto err;
 		beg = end;
 	}
 
+	container_done(&c);
+
 	/* Contains a fence? Set that it's a block. */
 
 	if (contains_fenced)
@@ -3152,40 +3947,40 @@ parse_listitem(struct lowdown_buf *ob, struct lowdown_doc *doc,
 		n->rndr_listitem.flags |= HLIST_FL_UNCHECKED;
 
 	if (*flags & HLIST_FL_BLOCK) {
-		if (sublist && sublist < work->size) {
+		if (sublist && sublist < c.size) {
 			if (!parse_block(doc,
-			    work->data, sublist))
+			    c.data, sublist))
 				goto err;
 			if (!parse_block(doc,
-			    work->data + sublist,
-			    work->size - sublist))
+			    c.data + sublist,
+			    c.size - sublist))
 				goto err;
 		} else {
 			if (!parse_block(doc,
-			    work->data, work->size))
+			    c.data, c.size))
 				goto err;
 		}
 	} else {
-		if (sublist && sublist < work->size) {
+		if (sublist && sublist < c.size) {
 			if (!parse_inline(doc,
-			    work->data, sublist))
+			    c.data, sublist))
 				goto err;
 			if (!parse_block(doc,
-			    work->data + sublist,
-			    work->size - sublist))
+			    c.data + sublist,
+			    c.size - sublist))
 				goto err;
 		} else {
 			if (!parse_inline(doc,
-			    work->data, work->size))
+			    c.data, c.size))
 				goto err;
 		}
 	}
 
 	popnode(doc, n);
-	hbuf_free(work);
+	hbuf_free(c.buf);
 	return beg;
 err:
-	hbuf_free(work);
+	hbuf_free(c.buf);
 	return -1;
 }
 
@@ -3198,15 +3993,11 @@ err:
 static ssize_t
 parse_definition(struct lowdown_doc *doc, char *data, size_t size)
 {
-	struct lowdown_buf   	*work = NULL;
 	size_t			 i = 0, k = 1;
 	ssize_t			 ret;
 	enum hlist_fl		 flags = HLIST_FL_DEF;
 	struct lowdown_node	*n, *nn, *cur, *prev;
 
-	if ((work = hbuf_new(256)) == NULL)
-		goto err;
-
 	/* Record whether we want to start in block mode. */
 
 	cur = TAILQ_LAST(&doc->current->children, lowdown_nodeq);
@@ -3224,7 +4015,7 @@ parse_definition(struct lowdown_doc *doc, char *data, size_t size)
 	} else {
 		n = pushnode(doc, LOWDOWN_DEFINITION);
 		if (n == NULL)
-			goto err;
+			return -1;
 		n->rndr_definition.flags = flags;
 	}
 
@@ -3236,11 +4027,11 @@ parse_definition(struct lowdown_doc *doc, char *data, size_t size)
 	while (i < size) {
 		nn = pushnode(doc, LOWDOWN_DEFINITION_DATA);
 		if (nn == NULL)
-			goto err;
-		ret = parse_listitem(work, doc,
+			return -1;
+		ret = parse_listitem(doc,
 			data + i, size - i, &flags, k++);
 		if (ret < 0)
-			goto err;
+			return -1;
 		i += ret;
 		popnode(doc, nn);
 		if (ret == 0 || (flags & HLIST_LI_END))
@@ -3251,11 +4042,7 @@ parse_definition(struct lowdown_doc *doc, char *data, size_t size)
 		n->rndr_definition.flags |= HLIST_FL_BLOCK;
 
 	popnode(doc, n);
-	hbuf_free(work);
 	return i;
-err:
-	hbuf_free(work);
-	return -1;
 }
 
 /*
@@ -3267,7 +4054,6 @@ static ssize_t
 parse_list(struct lowdown_doc *doc,
 	char *data, size_t size, const char *oli_data)
 {
-	struct lowdown_buf	*work = NULL;
 	size_t	 	     	 i = 0, pos;
 	ssize_t			 ret;
 	enum hlist_fl	     	 flags;
@@ -3275,10 +4061,8 @@ parse_list(struct lowdown_doc *doc,
 
 	flags = oli_data != NULL ?
 		HLIST_FL_ORDERED : HLIST_FL_UNORDERED;
-	if ((work = hbuf_new(256)) == NULL)
-		goto err;
 	if ((n = pushnode(doc, LOWDOWN_LIST)) == NULL)
-		goto err;
+		return -1;
 	n->rndr_list.start = 1;
 	n->rndr_list.flags = flags;
 
@@ -3291,10 +4075,10 @@ parse_list(struct lowdown_doc *doc,
 
 	pos = n->rndr_list.start;
 	while (i < size) {
-		ret = parse_listitem(work, doc,
+		ret = parse_listitem(doc,
 			data + i, size - i, &flags, pos++);
 		if (ret < 0)
-			goto err;
+			return -1;
 		i += ret;
 		if (ret == 0 || (flags & HLIST_LI_END))
 			break;
@@ -3304,11 +4088,7 @@ parse_list(struct lowdown_doc *doc,
 		n->rndr_list.flags |= HLIST_FL_BLOCK;
 
 	popnode(doc, n);
-	hbuf_free(work);
 	return i;
-err:
-	hbuf_free(work);
-	return -1;
 }
 
 /*
@@ -3345,7 +4125,7 @@ parse_atxheader(struct lowdown_doc *doc, char *data, size_t size)
 			return -1;
 		popnode(doc, n);
 		if ((doc->ext_flags & LOWDOWN_ATTRS) &&
-		    !parse_header_ext_attrs(n))
+		    !parse_header_ext_attrs(doc, n))
 			return -1;
 	}
 
@@ -3568,6 +4348,7 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 			       data[i - 1] == '-' && data[i] == '>'))
 				i++;
 			i++;
+			block_seen(doc, data, i < size ? i : size);
 
 			if (i < size)
 				j = is_empty(data + i, size - i);
@@ -3578,7 +4359,7 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 					return -1;
 				work.size = i + j;
 				if (!hbuf_createb
-				    (&n->rndr_blockhtml.text, &work))
+				    (doc, &n->rndr_blockhtml.text, &work))
 					return -1;
 				popnode(doc, n);
 				return work.size;
@@ -3600,7 +4381,7 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 					return -1;
 				work.size = i + j;
 				if (!hbuf_createb
-				    (&n->rndr_blockhtml.text, &work))
+				    (doc, &n->rndr_blockhtml.text, &work))
 					return -1;
 				popnode(doc, n);
 				return work.size;
@@ -3617,6 +4398,8 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 	tag_len = strlen(curtag);
 	tag_end = html_find_end_strict
 		(curtag, tag_len, doc, data, size);
+	if (!tag_end)
+		block_seen(doc, data, size);
 
 	/*
 	 * If not found, trying a second pass looking for indented match
@@ -3639,7 +4422,7 @@ parse_htmlblock(struct lowdown_doc *doc, char *data, size_t size)
 		return -1;
 
 	work.size = tag_end;
-	if (!hbuf_createb(&n->rndr_blockhtml.text, &work))
+	if (!hbuf_createb(doc, &n->rndr_blockhtml.text, &work))
 		return -1;
 	popnode(doc, n);
 	return tag_end;
@@ -3670,7 +4453,7 @@ parse_table_row(struct lowdown_buf *ob, struct lowdown_doc *doc,
 
 		cell_start = i;
 
-		len = find_emph_char(data + i, size - i, '|');
+		len = find_emph_char(doc, data + i, size - i, '|');
 
 		/*
 		 * Two possibilities for len == 0:
@@ -3832,8 +4615,8 @@ parse_table_header(struct lowdown_node **np,
 	if (n == NULL)
 		return -1;
 
-	n->rndr_table_header.flags = calloc
-		(*columns, sizeof(enum htbl_flags));
+	n->rndr_table_header.flags = arena_calloc
+		(doc->arena, *columns, sizeof(enum htbl_flags));
 	if (n->rndr_table_header.flags == NULL)
 		return -1;
 
@@ -3868,8 +4651,8 @@ parse_table(struct lowdown_doc *doc, char *data, size_t size)
 	if (!(doc->ext_flags & LOWDOWN_TABLES))
 		return 0;
 
-	if ((header_work = hbuf_new(64)) == NULL ||
-	    (body_work = hbuf_new(256)) == NULL)
+	if ((header_work = scratch_get(doc)) == NULL ||
+	    (body_work = scratch_get(doc)) == NULL)
 		goto err;
 
 	ret = parse_table_header(&n, header_work,
@@ -3906,16 +4689,184 @@ parse_table(struct lowdown_doc *doc, char *data, size_t size)
 	}
 
 	free(col_data);
-	hbuf_free(header_work);
-	hbuf_free(body_work);
+	scratch_put(doc, header_work);
+	scratch_put(doc, body_work);
 	return i;
 err:
 	free(col_data);
-	hbuf_free(header_work);
-	hbuf_free(body_work);
+	scratch_put(doc, header_work);
+	scratch_put(doc, body_work);
 	return -1;
 }
 
+/*
+ * With LOWDOWN_REPARSE, note that the current top-level block (a
+ * definition list) takes over the paragraph "n" before it and, if it's
+ * being merged into one, the definition list before that.  The block
+ * will be merged with those that produced these nodes.
+ */
+static void
+block_glue(struct lowdown_doc *doc, const struct lowdown_node *n)
+{
+	const struct lowdown_node	*prev;
+
+	if (doc->rp == NULL || doc->current->parent != NULL)
+		return;
+	prev = TAILQ_PREV(n, lowdown_nodeq, entries);
+	if (prev != NULL && prev->type == LOWDOWN_DEFINITION)
+		n = prev;
+	doc->rp->glue = 1;
+	doc->rp->glueid = n->id;
+}
+
+/*
+ * Close the open top-level block, if any, at offset "off" of the input.
+ */
+static void
+block_close(struct lowdown_doc *doc, size_t off)
+{
+	struct reparse		*rp = doc->rp;
+	struct reparse_block	*b;
+	struct lowdown_node	*last;
+	size_t			 i, j, seen;
+	int			 unres;
+
+	if (!rp->open)
+		return;
+	rp->open = 0;
+	unres = rp->unres;
+	rp->unres = 0;
+
+	/*
+	 * Blocks usually look past blank lines and a line or two more
+	 * to find their end; anything further has been noted with
+	 * block_seen().  Blocks looking to the end of the input depend
+	 * on there being nothing after it.
+	 */
+
+	seen = off;
+	while (seen < rp->basesz &&
+	    is_empty(rp->base + seen, rp->basesz - seen))
+		seen = next_line(rp->base, seen, rp->basesz);
+	seen = next_line(rp->base, seen, rp->basesz);
+	seen = next_line(rp->base, seen, rp->basesz);
+	if (seen < rp->seen)
+		seen = rp->seen;
+	if (seen >= rp->basesz)
+		seen = SIZE_MAX;
+
+	/* Merge with the blocks whose nodes were taken over. */
+
+	i = rp->blocksz - 1;
+	if (rp->glue) {
+		rp->glue = 0;
+		while (i > 0 && rp->blocks[i].id > rp->glueid)
+			if (rp->blocks[--i].seen > seen)
+				seen = rp->blocks[i].seen;
+		for (j = i; j < rp->blocksz - 1; j++)
+			if (rp->blocks[j].unres)
+				unres = 1;
+		rp->blocksz = i + 1;
+	}
+
+	b = &rp->blocks[i];
+	b->end = off;
+	b->seen = seen;
+	b->idend = doc->nodes;
+	b->unres = unres;
+	last = TAILQ_LAST(&doc->current->children, lowdown_nodeq);
+	if (last != b->prev) {
+		b->first = b->prev == NULL ?
+			TAILQ_FIRST(&doc->current->children) :
+			TAILQ_NEXT(b->prev, entries);
+		b->last = last;
+	} else
+		b->first = b->last = NULL;
+}
+
+/*
+ * Open a top-level block at offset "off" of the input.  Returns FALSE
+ * on memory failure, TRUE on success.
+ */
+static int
+block_open(struct lowdown_doc *doc, size_t off)
+{
+	struct reparse		*rp = doc->rp;
+	struct reparse_block	*b;
+	void			*pp;
+
+	if (rp->blocksz == rp->blockmax) {
+		pp = reallocarray(rp->blocks, rp->blockmax + 256,
+			sizeof(struct reparse_block));
+		if (pp == NULL)
+			return 0;
+		rp->blocks = pp;
+		rp->blockmax += 256;
+	}
+	b = &rp->blocks[rp->blocksz++];
+	memset(b, 0, sizeof(struct reparse_block));
+	b->beg = off;
+	b->id = doc->nodes;
+	b->foots = doc->foots;
+	b->prev = TAILQ_LAST(&doc->current->children, lowdown_nodeq);
+	rp->open = 1;
+	rp->seen = 0;
+	return 1;
+}
+
+/*
+ * Whether the parse may stop at the old block "pos" and reuse the tree
+ * from there on.  Not if the next old block with nodes is or may become
+ * a definition list: whether it is one, or is merged into the one
+ * before, depends on the previous node.
+ */
+static int
+block_reusable(const struct lowdown_doc *doc, size_t pos)
+{
+	const struct reparse	*rp = doc->rp;
+	size_t			 off;
+
+	while (pos < rp->oldsz && rp->old[pos].first == NULL)
+		pos++;
+	if (pos == rp->oldsz)
+		return 1;
+	if (rp->old[pos].first->type == LOWDOWN_DEFINITION)
+		return 0;
+	off = rp->old[pos].beg - rp->olddmg + rp->newdmg;
+	return !prefix_dli(doc, rp->base + off, rp->basesz - off);
+}
+
+/*
+ * Start a new top-level block at "data" within the input.  When
+ * reparsing, first see if we've reached an old block past the damaged
+ * input, from which point the old tree may be reused.  Returns <0 on
+ * memory failure, 0 if the old tree may be reused, >0 otherwise.
+ */
+static int
+block_next(struct lowdown_doc *doc, const char *data)
+{
+	struct reparse	*rp = doc->rp;
+	size_t		 off, old;
+
+	off = (size_t)(data - rp->base);
+	block_close(doc, off);
+
+	if (rp->old != NULL && off >= rp->newdmg) {
+		old = off - rp->newdmg + rp->olddmg;
+		while (rp->oldpos < rp->oldsz &&
+		    rp->old[rp->oldpos].beg < old)
+			rp->oldpos++;
+		if (rp->oldpos < rp->oldsz &&
+		    rp->old[rp->oldpos].beg == old &&
+		    block_reusable(doc, rp->oldpos)) {
+			rp->resync = 1;
+			return 0;
+		}
+	}
+
+	return block_open(doc, off) ? 1 : -1;
+}
+
 /*
  * Parsing of one block, returning next char to parse.
  * We can assume, entering the block, that our output is newline
@@ -3930,16 +4881,33 @@ parse_block(struct lowdown_doc *doc, char *data, size_t size)
 	char			 oli_data[10];
 	struct lowdown_node	*n;
 	ssize_t			 rc;
+	int			 top, split;
 
 	/*
 	 * What kind of block are we?
 	 * Go through all types of blocks, one by one.
 	 */
 
+	top = doc->rp != NULL && doc->current->parent == NULL;
+	split = doc->stop != NULL && doc->current->parent == NULL;
+
 	while (beg < size) {
 		txt_data = data + beg;
 		end = size - beg;
 
+		/* Stop at the first top-level block past a boundary. */
+
+		if (split && txt_data >= doc->stop)
+			break;
+
+		/* Record top-level blocks for lowdown_doc_reparse(). */
+
+		if (top && (rc = block_next(doc, txt_data)) <= 0) {
+			if (rc < 0)
+				return 0;
+			break;
+		}
+
 		/* We are at a #header. */
 
 		if (is_atxheader(doc, txt_data, end)) {
@@ -4043,6 +5011,7 @@ parse_block(struct lowdown_doc *doc, char *data, size_t size)
 			if (n != NULL &&
 			    n->type == LOWDOWN_PARAGRAPH &&
 			    n->rndr_paragraph.lines == 1) {
+				block_glue(doc, n);
 				rc = parse_definition(doc, txt_data, end);
 				if (rc < 0)
 					return 0;
@@ -4068,13 +5037,17 @@ parse_block(struct lowdown_doc *doc, char *data, size_t size)
 		beg += rc;
 	}
 
+	if (top)
+		block_close(doc, (size_t)(data + beg - doc->rp->base));
+	if (split)
+		doc->stop = data + beg;
 	return 1;
 }
 
 /*
  * Returns >0 if a line is a footnote definition, 0 if not, <0 on
- * failure.  This gathers any footnote content into the footq footnote
- * queue.
+ * failure.  This gathers any footnote content into the footrefs footnote
+ * table.
  */
 static int
 is_footnote(struct lowdown_doc *doc, const char *data,
@@ -4179,15 +5152,26 @@ is_footnote(struct lowdown_doc *doc, const char *data,
 
 	if ((ref = calloc(1, sizeof(struct foot_ref))) == NULL)
 		goto err;
+	if (!hbuf_create(NULL, &ref->name, data + id_offs, id_end - id_offs))
+		goto err;
 
-	TAILQ_INSERT_TAIL(&doc->footq, ref, entries);
-	if (!hbuf_createb(&ref->contents, contents))
-		return -1;
-	if (!hbuf_create(&ref->name, data + id_offs, id_end - id_offs))
-		return -1;
+	/*
+	 * The first definition of a name wins: later definitions are
+	 * consumed but otherwise ignored.
+	 */
+
+	if (find_foot_ref(doc, &ref->name) == NULL) {
+		ref->hash = label_hash(&ref->name);
+		if (!hbuf_createb(NULL, &ref->contents, contents))
+			goto err;
+		if (!add_foot_ref(doc, ref))
+			goto err;
+	} else
+		free_foot_ref(ref);
 	hbuf_free(contents);
 	return 1;
 err:
+	free_foot_ref(ref);
 	hbuf_free(contents);
 	return -1;
 }
@@ -4358,54 +5342,67 @@ is_ref(struct lowdown_doc *doc, const char *data,
 
 	if ((ref = calloc(1, sizeof(struct link_ref))) == NULL)
 		return -1;
-	TAILQ_INSERT_TAIL(&doc->refq, ref, entries);
 
-	if (id_end - id_offset) {
-		ref->name = hbuf_new(id_end - id_offset);
-		if (ref->name == NULL)
-			return -1;
-		if (!hbuf_put(ref->name,
-		    data + id_offset, id_end - id_offset))
-			return -1;
+	/*
+	 * The first definition of a (normalised) name wins: later
+	 * definitions are consumed but otherwise ignored.
+	 */
+
+	if ((ref->name = hbuf_new(64)) == NULL)
+		goto err;
+	if (!hbuf_put(ref->name, data + id_offset, id_end - id_offset))
+		goto err;
+	if (find_link_ref(doc, ref->name) != NULL) {
+		free_link_ref(ref);
+		return 1;
 	}
+	ref->hash = label_hash(ref->name);
 
 	ref->link = hbuf_new(link_end - link_offset);
 	if (ref->link == NULL)
-		return -1;
+		goto err;
 
 	if (!hbuf_put(ref->link,
 	    data + link_offset, link_end - link_offset))
-		return -1;
+		goto err;
 
 	if (title_end > title_offset) {
 		ref->title = hbuf_new(title_end - title_offset);
 		if (ref->title == NULL)
-			return -1;
+			goto err;
 		if (!hbuf_put(ref->title,
 		    data + title_offset, title_end - title_offset))
-			return -1;
+			goto err;
 	}
 
 	if (attr_end > attr_offset) {
 		ref->attrs = hbuf_new(attr_end - attr_offset);
 		if (ref->attrs == NULL)
-			return -1;
+			goto err;
 		if (!hbuf_put(ref->attrs,
 		    data + attr_offset, attr_end - attr_offset))
-			return -1;
+			goto err;
 	}
 
+	if (!add_link_ref(doc, ref))
+		goto err;
 	return 1;
+err:
+	free_link_ref(ref);
+	return -1;
 }
 
 /*
- * Replace tabs with 4 spaces.
- * Return zero on failure (memory), non-zero on success.
+ * Replace tabs with spaces up to the next multiple of four columns,
+ * with columns starting at zero after each newline.  If "ob" is not
+ * NULL, the output is written there: it may overlap with "data" as
+ * long as the output never overtakes the input.  Return the output
+ * size (whether or not it's written).
  */
-static int
-expand_tabs(struct lowdown_buf *ob, const char *line, size_t size)
+static size_t
+expand_tabs(char *ob, const char *data, size_t size)
 {
-	size_t  i, tab = 0, org;
+	size_t  i, col = 0, org, osz = 0;
 
 	/*
 	 * This code makes two assumptions:
@@ -4417,27 +5414,38 @@ expand_tabs(struct lowdown_buf *ob, const char *line, size_t size)
 	 * characters should be skipped but are not.)
 	 */
 
+	/* Fast path: nothing to expand. */
+
+	if (memchr(data, '\t', size) == NULL) {
+		if (ob != NULL && ob != data)
+			memmove(ob, data, size);
+		return size;
+	}
+
 	for (i = 0; i < size; i++) {
 		org = i;
-		while (i < size && line[i] != '\t') {
-			/* ignore UTF-8 continuation bytes */
-			if ((line[i] & 0xc0) != 0x80)
-				tab++;
+		while (i < size && data[i] != '\t') {
+			if (data[i] == '\n')
+				col = 0;
+			else if ((data[i] & 0xc0) != 0x80)
+				col++;
 			i++;
 		}
-		if (i > org && !hbuf_put(ob, line + org, i - org))
-			return 0;
+		if (ob != NULL && i > org)
+			memmove(ob + osz, data + org, i - org);
+		osz += i - org;
 		if (i >= size)
 			break;
 
 		do {
-			if (!hbuf_putc(ob, ' '))
-				return 0;
-			tab++;
-		} while (tab % 4);
+			if (ob != NULL)
+				ob[osz] = ' ';
+			osz++;
+			col++;
+		} while (col % 4);
 	}
 
-	return 1;
+	return osz;
 }
 
 struct lowdown_doc *
@@ -4475,6 +5483,7 @@ lowdown_doc_new(const struct lowdown_opts *opts)
 		doc->active_char['~'] = MD_CHAR_EMPHASIS;
 	if (doc->ext_flags & LOWDOWN_MATH)
 		doc->active_char['$'] = MD_CHAR_MATH;
+	charset_init(&doc->active_set, doc->active_char);
 
 	if (opts != NULL && opts->metasz > 0) {
 		doc->meta = calloc(opts->metasz, sizeof(char *));
@@ -4522,29 +5531,36 @@ add_metadata(struct lowdown_doc *doc, const char *key,
 	nksz = strlen(key);
 	nvsz = vsz == 0 ? strlen(val) : vsz;
 
-	TAILQ_FOREACH(m, doc->metaq, entries)
-		if (strcmp(m->key, key) == 0) {
-			TAILQ_REMOVE(doc->metaq, m, entries);
-			free(m->key);
-			free(m->value);
-			free(m);
-			break;
-		}
-
 	assert(doc->current->type == LOWDOWN_DOC_HEADER);
 
-	TAILQ_FOREACH(n, &doc->current->children, entries) {
-		assert(n->type == LOWDOWN_META);
-		if (!hbuf_streq(&n->rndr_meta.key, key))
-			continue;
-		TAILQ_REMOVE(&doc->current->children, n, entries);
-		lowdown_node_free(n);
-		break;
+	/*
+	 * Only search for an entry to replace if the index has the key:
+	 * documents with many keys rarely repeat them.
+	 */
+
+	if (metaidx_get(&doc->metaidx, key, nksz) != NULL) {
+		metaidx_del(&doc->metaidx, key, nksz);
+		TAILQ_FOREACH(m, doc->metaq, entries)
+			if (strcmp(m->key, key) == 0) {
+				TAILQ_REMOVE(doc->metaq, m, entries);
+				free(m->key);
+				free(m->value);
+				free(m);
+				break;
+			}
+		TAILQ_FOREACH(n, &doc->current->children, entries) {
+			assert(n->type == LOWDOWN_META);
+			if (!hbuf_streq(&n->rndr_meta.key, key))
+				continue;
+			TAILQ_REMOVE(&doc->current->children, n, entries);
+			lowdown_node_free(n);
+			break;
+		}
 	}
 
 	if ((n = pushnode(doc, LOWDOWN_META)) == NULL)
 		return 0;
-	if (!hbuf_create(&n->rndr_meta.key, key, nksz))
+	if (!hbuf_create(doc, &n->rndr_meta.key, key, nksz))
 		return 0;
 	if ((m = calloc(1, sizeof(struct lowdown_meta))) == NULL)
 		return 0;
@@ -4554,6 +5570,8 @@ add_metadata(struct lowdown_doc *doc, const char *key,
 
 	if ((m->value = strndup(val, nvsz)) == NULL)
 		return 0;
+	if (!metaidx_put(&doc->metaidx, m))
+		return 0;
 
 	/* In case there are NUL values... */
 
@@ -4566,7 +5584,8 @@ add_metadata(struct lowdown_doc *doc, const char *key,
 	if (nvsz > 0) {
 		if ((nn = pushnode(doc, LOWDOWN_NORMAL_TEXT)) == NULL)
 			return 0;
-		if (!hbuf_push(&nn->rndr_normal_text.text, val, nvsz))
+		if (!hbuf_push(doc,
+		    &nn->rndr_normal_text.text, val, nvsz))
 			return 0;
 		popnode(doc, nn);
 	}
@@ -4980,201 +5999,1442 @@ err:
 }
 
 /*
- * Parse the buffer in data of length size.
- * If both mp and mszp are not NULL, set them with the meta information
- * instead of locally destroying it.
- * (Obviously only applicable if LOWDOWN_METADATA has been set.)
+ * Zeroth pass: skip a possible UTF-8 BOM, even though the Unicode
+ * standard discourages having these in UTF-8 documents, then add the
+ * document header with its metadata.  First process given metadata,
+ * then in-document metadata, then overriding metadata.  The in-document
+ * metadata is conditionally processed.  Sets "beg" to the start of the
+ * body.  Returns FALSE on failure (memory), TRUE on success.
  */
-struct lowdown_node *
-lowdown_doc_parse(struct lowdown_doc *doc, size_t *maxn,
-	const char *data, size_t size, struct lowdown_metaq *metaq)
+static int
+parse_header(struct lowdown_doc *doc, const char *data, size_t size,
+    size_t *beg)
 {
 	static const char 	 UTF8_BOM[] = { 0xEF, 0xBB, 0xBF };
-	char			*newbuf = NULL;
-	struct lowdown_buf	*text = NULL;
-	size_t		 	 beg, end, i, j;
-	struct lowdown_node 	*n, *root = NULL;
-	struct lowdown_metaq	 mq;
-	int			 c, rc = 0, is_yaml = 0;
-
-	/*
-	 * Have a temporary "mq" if "metaq" is not set.  We clear this
-	 * automatically at the tail of the function.
-	 */
-
-	TAILQ_INIT(&mq);
-
-	if (metaq == NULL)
-		metaq = &mq;
-
-	/* Initialise the parser. */
-
-	doc->nodes = 0;
-	doc->depth = 0;
-	doc->current = NULL;
-	doc->in_link_body = 0;
-	doc->foots = 0;
-	doc->metaq = metaq;
-
-	TAILQ_INIT(doc->metaq);
-	TAILQ_INIT(&doc->refq);
-	TAILQ_INIT(&doc->footq);
-
-	/* Strip out DOS CRLF, if detected at the first line. */
-
-	if ((newbuf = memchr(data, '\n', size)) != NULL &&
- 	    newbuf > data &&
-	    newbuf[-1] == '\r') {
-		if ((newbuf = malloc(size)) == NULL)
-			goto out;
-		for (i = j = 0; i < size; i++)
-			if (data[i] != '\r')
-				newbuf[j++] = data[i];
-		data = newbuf;
-		size = j;
-	} else
-		newbuf = NULL;
-
-	if ((text = hbuf_new(64)) == NULL)
-		goto out;
-	if (!hbuf_grow(text, size))
-		goto out;
-	if ((root = pushnode(doc, LOWDOWN_ROOT)) == NULL)
-		goto out;
-
-	/*
-	 * Skip a possible UTF-8 BOM, even though the Unicode standard
-	 * discourages having these in UTF-8 documents.
-	 */
+	struct lowdown_node	*n;
+	size_t			 end, i;
+	int			 c, is_yaml = 0;
 
-	beg = 0;
+	*beg = 0;
 	if (size >= 3 && memcmp(data, UTF8_BOM, 3) == 0)
-		beg += 3;
-
-	/*
-	 * Zeroth pass: metadata.  First process given metadata, then
-	 * in-document metadata, then overriding metadata.  The
-	 * in-document metadata is conditionally processed.
-	 */
+		*beg += 3;
 
 	if ((n = pushnode(doc, LOWDOWN_DOC_HEADER)) == NULL)
-		goto out;
+		return 0;
 
 	for (i = 0; i < doc->metasz; i++)
 		if (parse_metadata_mmd(doc,
 		    doc->meta[i], strlen(doc->meta[i]), 0) < 0)
-			goto out;
+			return 0;
 
 	if (doc->ext_flags & LOWDOWN_METADATA) {
 		c = 0;
 		if ((end = is_metadata_block_pandoc
-		    (&data[beg], size - beg)) > 0)
+		    (&data[*beg], size - *beg)) > 0)
 			c = parse_metadata_pandoc
-				(doc, &data[beg], end - beg);
+				(doc, &data[*beg], end - *beg);
 		else if ((end = is_metadata_block_mmd
-		    (&data[beg], size - beg, &is_yaml)) > 0)
+		    (&data[*beg], size - *beg, &is_yaml)) > 0)
 			c = parse_metadata_mmd
-				(doc, &data[beg], end - beg, is_yaml);
+				(doc, &data[*beg], end - *beg, is_yaml);
 		if (c > 0)
-			beg = end;
+			*beg = end;
 		else if (c < 0)
-			goto out;
+			return 0;
 	}
 
 	for (i = 0; i < doc->metaovrsz; i++)
 		if (parse_metadata_mmd(doc,
 		    doc->metaovr[i], strlen(doc->metaovr[i]), 0) < 0)
-			goto out;
+			return 0;
 
 	popnode(doc, n);
+	return 1;
+}
+
+/*
+ * Strip out DOS CRLF, if detected at the first line, into a newly
+ * allocated "text", which then replaces "data" and "size".  Returns
+ * FALSE on memory failure, TRUE on success.
+ */
+static int
+strip_crlf(const char **data, size_t *size, char **text)
+{
+	const char	*cp;
+	size_t		 i, j;
+
+	if ((cp = memchr(*data, '\n', *size)) == NULL ||
+	    cp == *data || cp[-1] != '\r')
+		return 1;
+	if ((*text = malloc(*size)) == NULL)
+		return 0;
+	for (i = j = 0; i < *size; i++)
+		if ((*data)[i] != '\r')
+			(*text)[j++] = (*data)[i];
+	*data = *text;
+	*size = j;
+	return 1;
+}
+
+/*
+ * Return the end of the BOM and (possible) metadata block at the start
+ * of "data", plus the byte after, which is also examined.  This is what
+ * must be unchanged for lowdown_doc_reparse() to reuse the header.
+ */
+static size_t
+pre_end(const struct lowdown_doc *doc, const char *data, size_t size)
+{
+	static const char 	 UTF8_BOM[] = { 0xEF, 0xBB, 0xBF };
+	size_t			 beg = 0, end = 0;
+	int			 is_yaml = 0;
+
+	if (size >= 3 && memcmp(data, UTF8_BOM, 3) == 0)
+		beg += 3;
+	if (doc->ext_flags & LOWDOWN_METADATA) {
+		end = is_metadata_block_pandoc(&data[beg], size - beg);
+		if (end == 0)
+			end = is_metadata_block_mmd
+				(&data[beg], size - beg, &is_yaml);
+	}
+	end = end > 0 ? beg + end + 1 : beg;
+	return end < size ? end : size;
+}
+
+/*
+ * First pass: looking for references and footnotes in "data" of length
+ * "size" from "beg", recording the ranges of everything else and, if
+ * "defs" is not NULL, appending the definitions to it.  Then fill in
+ * "text" (which may already hold a copy of the input, see strip_crlf())
+ * with the block parser's input, setting "textsz" to its size.  Returns
+ * FALSE on failure (memory), TRUE on success.
+ */
+static int
+parse_prep(struct lowdown_doc *doc, char **text, size_t *textsz,
+    const char *data, size_t size, size_t beg, struct lowdown_buf *defs)
+{
+	struct text_range	*ranges = NULL, *rp;
+	size_t			 end, i, bufsz, shift = 0, rangesz = 0,
+				 rangemax = 0, sz;
+	char			*pp;
+	int			 c, rc = 0;
 
 	/*
-	 * First pass: looking for references and footnotes, copying
-	 * everything else.
+	 * While here, compute the size of the tab-expanded output and
+	 * how far it may overtake the input, which is how far the input
+	 * must be shifted if it's to be expanded in-place.
 	 */
 
+	*textsz = 0;
 	while (beg < size) {
-		if (doc->ext_flags & LOWDOWN_FOOTNOTES) {
-		    c = is_footnote(doc, data, beg, size, &end);
-		    if (c > 0) {
-			    beg = end;
-			    continue;
-		    } else if (c < 0)
-			    goto out;
-		}
-
-		if ((c = is_ref(doc, data, beg, size, &end)) > 0) {
+		c = 0;
+		if (doc->ext_flags & LOWDOWN_FOOTNOTES)
+			c = is_footnote(doc, data, beg, size, &end);
+		if (c == 0)
+			c = is_ref(doc, data, beg, size, &end);
+		if (c < 0)
+			goto out;
+		if (c > 0) {
+			sz = end - beg;
+			if (defs != NULL &&
+			    (!hbuf_put(defs, (const char *)&sz, sizeof(sz)) ||
+			     !hbuf_put(defs, data + beg, sz)))
+				goto out;
 			beg = end;
 			continue;
-		} else if (c < 0)
-			goto out;
+		}
 
-		/* Skipping to the next line. */
+		/* Skipping to the next line and its trailing newlines. */
 
-		end = beg;
-		while (end < size && data[end] != '\n')
+		end = find_eol(data, beg, size);
+		while (end < size && data[end] == '\n')
 			end++;
 
-		/* Adding the line body if present. */
-
-		if (end > beg &&
-		    !expand_tabs(text, data + beg, end - beg))
-			goto out;
-
-		/* Add one \n per newline. */
+		/* Extend the last range or start a new one. */
 
-		while (end < size && data[end] == '\n') {
-			if (data[end] == '\n' ||
-			    (end + 1 < size && data[end + 1] != '\n'))
-				if (!hbuf_putc(text, '\n'))
+		if (rangesz > 0 && ranges[rangesz - 1].end == beg)
+			ranges[rangesz - 1].end = end;
+		else {
+			if (rangesz == rangemax) {
+				rp = reallocarray(ranges, rangemax + 16,
+					sizeof(struct text_range));
+				if (rp == NULL)
 					goto out;
-			end++;
+				ranges = rp;
+				rangemax += 16;
+			}
+			ranges[rangesz].beg = beg;
+			ranges[rangesz].end = end;
+			rangesz++;
 		}
 
+		*textsz += expand_tabs(NULL, data + beg, end - beg);
+		if (*textsz > end && *textsz - end > shift)
+			shift = *textsz - end;
 		beg = end;
 	}
 
 	/*
-	 * Second pass (after header): rendering the document body and
-	 * footnotes.
+	 * Fill in the block parser's input from the recorded ranges,
+	 * adding a final newline if not already present.  If the input
+	 * was already copied (CRLF), this happens in-place after
+	 * shifting the input to make room for expanded tabs.
 	 */
 
-	if (text->size) {
-		/* Adding a final newline if not already present. */
-		if (text->data[text->size - 1] != '\n')
-			if (!hbuf_putc(text, '\n'))
+	if (*textsz > 0) {
+		bufsz = *textsz;
+		if (data[ranges[rangesz - 1].end - 1] != '\n')
+			bufsz++;
+		if (*text == NULL) {
+			if ((*text = malloc(bufsz)) == NULL)
 				goto out;
-		if (!parse_block(doc, text->data, text->size))
-			goto out;
+		} else if (shift > 0 || bufsz > size) {
+			if ((pp = realloc(*text, bufsz > size + shift ?
+			    bufsz : size + shift)) == NULL)
+				goto out;
+			*text = pp;
+			memmove(*text + shift, *text, size);
+			data = *text + shift;
+		}
+		for (*textsz = i = 0; i < rangesz; i++)
+			*textsz += expand_tabs(*text + *textsz,
+				data + ranges[i].beg,
+				ranges[i].end - ranges[i].beg);
+		if (*textsz < bufsz)
+			(*text)[(*textsz)++] = '\n';
+		assert(*textsz == bufsz);
 	}
 
 	rc = 1;
 out:
-	hbuf_free(text);
-	free_link_refs(&doc->refq);
-	free_foot_refq(&doc->footq);
-	lowdown_metaq_free(&mq);
-	free(newbuf);
+	free(ranges);
+	return rc;
+}
 
-	if (rc) {
-		if (maxn != NULL)
-			*maxn = doc->nodes;
-		popnode(doc, root);
-		assert(doc->depth == 0);
+/*
+ * Exchange the link and footnote tables of the document with those
+ * retained for lowdown_doc_reparse().
+ */
+static void
+reparse_swap(struct lowdown_doc *doc)
+{
+	struct reparse	*rp = doc->rp;
+	struct link_ref	**refs;
+	struct foot_ref	**footrefs;
+	size_t		  sz, n;
+
+	refs = doc->refs;
+	sz = doc->refsz;
+	n = doc->refn;
+	doc->refs = rp->refs;
+	doc->refsz = rp->refsz;
+	doc->refn = rp->refn;
+	rp->refs = refs;
+	rp->refsz = sz;
+	rp->refn = n;
+
+	footrefs = doc->footrefs;
+	sz = doc->footrefsz;
+	n = doc->footrefn;
+	doc->footrefs = rp->footrefs;
+	doc->footrefsz = rp->footrefsz;
+	doc->footrefn = rp->footrefn;
+	rp->footrefs = footrefs;
+	rp->footrefsz = sz;
+	rp->footrefn = n;
+}
+
+/*
+ * Free the state retained for lowdown_doc_reparse(), if any.  The
+ * document's own link and footnote tables must be empty.
+ */
+static void
+reparse_free(struct lowdown_doc *doc)
+{
+	struct reparse	*rp = doc->rp;
+
+	if (rp == NULL)
+		return;
+	reparse_swap(doc);
+	free_link_refs(doc);
+	free_foot_refs(doc);
+	free(rp->src);
+	free(rp->pre);
+	hbuf_free(rp->defs);
+	free(rp->text);
+	lowdown_metaq_free(&rp->metaq);
+	free(rp->blocks);
+	free(rp);
+	doc->rp = NULL;
+}
+
+/*
+ * Free the lowdown_doc_feed() state, if any, with the tree nodes that
+ * haven't been handed out and the link and footnote tables.
+ */
+static void
+stream_free(struct lowdown_doc *doc)
+{
+	struct stream	*st = doc->st;
+
+	if (st == NULL)
+		return;
+	lowdown_node_free(st->root);
+	lowdown_metaq_free(&st->metaq);
+	hbuf_free(st->in);
+	hbuf_free(st->text);
+	hbuf_free(st->work);
+	free(st->rp.blocks);
+	free(st);
+	free_link_refs(doc);
+	free_foot_refs(doc);
+	doc->st = NULL;
+	doc->current = NULL;
+	doc->depth = 0;
+}
+
+/*
+ * After a successful parse, retain what lowdown_doc_reparse() needs:
+ * the block parser's input "text" (taken over unless it's owned by the
+ * arena), the link and footnote tables, and the metadata.  Returns
+ * FALSE on memory failure, TRUE on success.
+ */
+static int
+reparse_save(struct lowdown_doc *doc, struct lowdown_node *root,
+    char **text, size_t textsz)
+{
+	struct reparse		*rp = doc->rp;
+	struct lowdown_meta	*m, *mm;
+
+	if (doc->base == NULL) {
+		rp->text = *text;
+		*text = NULL;
 	} else {
-		lowdown_node_free(root);
-		root = NULL;
+		if ((rp->text = malloc(textsz)) == NULL)
+			return 0;
+		memcpy(rp->text, *text, textsz);
 	}
-	return root;
+	rp->textsz = textsz;
+	rp->base = NULL;
+	rp->root = root;
+	rp->maxn = doc->nodes;
+	rp->foots = doc->foots;
+	reparse_swap(doc);
+
+	TAILQ_FOREACH(m, doc->metaq, entries) {
+		if ((mm = calloc(1, sizeof(struct lowdown_meta))) == NULL)
+			return 0;
+		TAILQ_INSERT_TAIL(&rp->metaq, mm, entries);
+		if ((mm->key = strdup(m->key)) == NULL ||
+		    (mm->value = strdup(m->value)) == NULL)
+			return 0;
+	}
+	return 1;
 }
 
-void
-lowdown_node_free(struct lowdown_node *p)
+/*
+ * A segment of the block parser's input for parse_parallel().
+ */
+struct	segment {
+	size_t			 beg; /* offset of first block */
+	size_t			 end; /* offset past last block */
+	size_t			 nodes; /* number of nodes */
+	struct lowdown_nodeq	 nq; /* top-level nodes */
+	int			 rc; /* parse_block() result */
+};
+
+/*
+ * State shared by the parse_parallel() workers.
+ */
+struct	parallel {
+	pthread_mutex_t		 mutex; /* protects "next" */
+	const struct lowdown_doc *doc; /* parser to copy */
+	char			*text; /* block parser's input */
+	size_t			 textsz; /* size of text */
+	struct segment		*segs; /* segments */
+	size_t			 segsz; /* number of segments */
+	size_t			 next; /* next segment to parse */
+};
+
+/*
+ * A parse_parallel() worker thread with its node allocator.
+ */
+struct	worker {
+	struct parallel		*p; /* shared state */
+	struct lowdown_arena	*arena; /* allocator (or NULL) */
+	pthread_t		 thread; /* thread, if "started" */
+	int			 started; /* thread was created */
+};
+
+/*
+ * Find the start of a segment of the block parser's input at or after
+ * "off": an unindented line that starts with a letter or '#' and
+ * follows an empty line.  This usually starts a top-level block that
+ * doesn't depend on those before it.  If it doesn't (e.g., it's within
+ * fenced code), the misaligned segment will be parsed again.  Returns
+ * the offset or "size" if there's no such line.
+ */
+static size_t
+parallel_split(const char *data, size_t size, size_t off)
 {
-	struct lowdown_node *n;
+	const char	*cp;
+	size_t		 prev;
+
+	if ((cp = memchr(data + off, '\n', size - off)) == NULL)
+		return size;
+	prev = off;
+	off = (size_t)(cp - data) + 1;
+	while (off < size) {
+		if ((isalpha((unsigned char)data[off]) ||
+		     data[off] == '#') &&
+		    is_empty(data + prev, size - prev))
+			return off;
+		if ((cp = memchr(data + off, '\n', size - off)) == NULL)
+			break;
+		prev = off;
+		off = (size_t)(cp - data) + 1;
+	}
+	return size;
+}
 
-	if (p == NULL)
-		return;
+/*
+ * Parse segments with a copy of the parser until none are left.  Each
+ * segment is parsed from its start until the first top-level block at
+ * or after the next segment, with nodes numbered from zero under a
+ * temporary root.
+ */
+static void *
+parallel_worker(void *arg)
+{
+	struct worker		*w = arg;
+	struct parallel		*p = w->p;
+	struct segment		*seg;
+	struct lowdown_doc	 doc;
+	struct lowdown_node	 root;
+	size_t			 i;
+
+	for (;;) {
+		pthread_mutex_lock(&p->mutex);
+		i = p->next < p->segsz ? p->next++ : p->segsz;
+		pthread_mutex_unlock(&p->mutex);
+		if (i == p->segsz)
+			break;
+
+		seg = &p->segs[i];
+		memset(&root, 0, sizeof(struct lowdown_node));
+		root.type = LOWDOWN_ROOT;
+		TAILQ_INIT(&root.children);
+
+		doc = *p->doc;
+		doc.scratchsz = 0;
+		doc.nodes = 0;
+		doc.depth = 1;
+		doc.current = &root;
+		doc.arena = w->arena;
+		doc.stop = p->text +
+			(i + 1 < p->segsz ? p->segs[i + 1].beg : p->textsz);
+
+		seg->rc = parse_block(&doc,
+			p->text + seg->beg, p->textsz - seg->beg);
+		seg->end = (size_t)(doc.stop - p->text);
+		seg->nodes = doc.nodes;
+		TAILQ_CONCAT(&seg->nq, &root.children, entries);
+		scratch_free(&doc);
+	}
+	return NULL;
+}
+
+/*
+ * Add "delta" to the identifier of all nodes in "n" and have them use
+ * the arena "arena" (if not NULL).
+ */
+static void
+parallel_adopt(struct lowdown_node *n, size_t delta,
+    struct lowdown_arena *arena)
+{
+	struct lowdown_node	*nn;
+
+	n->id += delta;
+	if (arena != NULL)
+		n->arena = arena;
+	TAILQ_FOREACH(nn, &n->children, entries)
+		parallel_adopt(nn, delta, arena);
+}
+
+/*
+ * Like parse_block() at the top level, but split "data" into segments
+ * parsed by a pool of threads, then append their nodes in order to the
+ * current node.  A segment is only used if its first block starts
+ * where the blocks of the one before ended (and it doesn't begin with a
+ * definition list that would have been merged into the one before),
+ * otherwise the input up to the next segment is parsed again in order.
+ * This gives the same tree and node identifiers as parse_block().
+ * Returns zero on failure, non-zero on success.
+ */
+static int
+parse_parallel(struct lowdown_doc *doc, char *data, size_t size)
+{
+	struct parallel		 p;
+	struct worker		*w = NULL;
+	struct segment		*seg;
+	struct lowdown_node	*n, *last;
+	long			 ncpu;
+	size_t			 i, nw, pos, end;
+	int			 rc = 0;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nw = ncpu < 1 ? 1 :
+		(size_t)ncpu > PARALLEL_THREADS ?
+		PARALLEL_THREADS : (size_t)ncpu;
+
+	memset(&p, 0, sizeof(struct parallel));
+	p.doc = doc;
+	p.text = data;
+	p.textsz = size;
+	p.segsz = size / PARALLEL_SEGMENT;
+	if (p.segsz > nw * PARALLEL_SEGMENTS)
+		p.segsz = nw * PARALLEL_SEGMENTS;
+	if (nw < 2 || p.segsz < 2)
+		return parse_block(doc, data, size);
+
+	/* Segment the input, skipping empty segments. */
+
+	if ((p.segs = calloc(p.segsz, sizeof(struct segment))) == NULL)
+		return 0;
+	for (pos = i = 0; i < p.segsz; i++) {
+		if (i > 0) {
+			end = size / p.segsz * i;
+			if (end <= pos)
+				end = pos + 1;
+			if ((pos = parallel_split(data, size, end)) == size)
+				break;
+		}
+		p.segs[i].beg = pos;
+		TAILQ_INIT(&p.segs[i].nq);
+	}
+	p.segsz = i;
+	if (nw > p.segsz)
+		nw = p.segsz;
+
+	/* Run the workers, the first of which is this thread. */
+
+	if ((w = calloc(nw, sizeof(struct worker))) == NULL)
+		goto out;
+	for (i = 0; i < nw; i++) {
+		w[i].p = &p;
+		if (doc->arena != NULL &&
+		    (w[i].arena = arena_new(size / nw)) == NULL)
+			goto out;
+	}
+	if (pthread_mutex_init(&p.mutex, NULL) != 0)
+		goto out;
+	for (i = 1; i < nw; i++)
+		if (pthread_create(&w[i].thread,
+		    NULL, parallel_worker, &w[i]) == 0)
+			w[i].started = 1;
+	parallel_worker(&w[0]);
+	for (i = 1; i < nw; i++)
+		if (w[i].started)
+			pthread_join(w[i].thread, NULL);
+	pthread_mutex_destroy(&p.mutex);
+
+	/* Append the segments in order or parse again. */
+
+	for (pos = i = 0; i < p.segsz; i++) {
+		seg = &p.segs[i];
+		end = i + 1 < p.segsz ? p.segs[i + 1].beg : size;
+		last = TAILQ_LAST(&doc->current->children, lowdown_nodeq);
+		n = TAILQ_FIRST(&seg->nq);
+		if (seg->beg == pos && !(last != NULL && n != NULL &&
+		    last->type == LOWDOWN_DEFINITION &&
+		    n->type == LOWDOWN_DEFINITION)) {
+			if (!seg->rc)
+				goto out;
+			while ((n = TAILQ_FIRST(&seg->nq)) != NULL) {
+				TAILQ_REMOVE(&seg->nq, n, entries);
+				parallel_adopt(n, doc->nodes, doc->arena);
+				n->parent = doc->current;
+				TAILQ_INSERT_TAIL(&doc->current->children,
+					n, entries);
+			}
+			doc->nodes += seg->nodes;
+			pos = seg->end;
+		} else if (pos < end) {
+			doc->stop = data + end;
+			if (!parse_block(doc, data + pos, size - pos))
+				goto out;
+			pos = (size_t)(doc->stop - data);
+		}
+	}
+
+	rc = 1;
+out:
+	doc->stop = NULL;
+	for (i = 0; w != NULL && i < nw; i++)
+		if (w[i].arena != NULL)
+			arena_merge(doc->arena, w[i].arena);
+	for (i = 0; i < p.segsz; i++)
+		while ((n = TAILQ_FIRST(&p.segs[i].nq)) != NULL) {
+			TAILQ_REMOVE(&p.segs[i].nq, n, entries);
+			lowdown_node_free(n);
+		}
+	free(p.segs);
+	free(w);
+	return rc;
+}
+
+/*
+ * Parse the buffer in data of length size.
+ * If both mp and mszp are not NULL, set them with the meta information
+ * instead of locally destroying it.
+ * (Obviously only applicable if LOWDOWN_METADATA has been set.)
+ */
+struct lowdown_node *
+lowdown_doc_parse(struct lowdown_doc *doc, size_t *maxn,
+	const char *data, size_t size, struct lowdown_metaq *metaq)
+{
+	char			*text = NULL;
+	size_t		 	 beg, textsz = 0;
+	struct lowdown_node 	*root = NULL;
+	struct lowdown_metaq	 mq;
+	struct reparse		*rp;
+	int			 rc = 0;
+
+	/*
+	 * Have a temporary "mq" if "metaq" is not set.  We clear this
+	 * automatically at the tail of the function.
+	 */
+
+	TAILQ_INIT(&mq);
+
+	if (metaq == NULL)
+		metaq = &mq;
+
+	/* Initialise the parser. */
+
+	doc->nodes = 0;
+	doc->depth = 0;
+	doc->current = NULL;
+	doc->in_link_body = 0;
+	doc->foots = 0;
+	doc->metaq = metaq;
+
+	TAILQ_INIT(doc->metaq);
+	metaidx_clear(&doc->metaidx);
+
+	/*
+	 * If requested, keep a copy of the input and more for
+	 * lowdown_doc_reparse().  This replaces any earlier state.
+	 */
+
+	stream_free(doc);
+	reparse_free(doc);
+	if (doc->ext_flags & LOWDOWN_REPARSE) {
+		if ((rp = doc->rp = calloc(1, sizeof(struct reparse))) == NULL)
+			goto out;
+		TAILQ_INIT(&rp->metaq);
+		if ((rp->defs = hbuf_new(64)) == NULL ||
+		    (rp->src = malloc(size + 1)) == NULL)
+			goto out;
+		memcpy(rp->src, data, size);
+		rp->srcsz = size;
+	}
+
+	/*
+	 * Strip out DOS CRLF, if detected at the first line.  The copy
+	 * is later reused in-place as the block parser's input.
+	 */
+
+	if (!strip_crlf(&data, &size, &text))
+		goto out;
+
+	/*
+	 * If requested, allocate the tree from an arena sized by the
+	 * input.  The root node owns the arena.
+	 */
+
+	if ((doc->ext_flags & LOWDOWN_ARENA) &&
+	    (doc->arena = arena_new(size)) == NULL)
+		goto out;
+	if ((root = pushnode(doc, LOWDOWN_ROOT)) == NULL)
+		goto out;
+
+	/* Zeroth pass: BOM and metadata. */
+
+	if (!parse_header(doc, data, size, &beg))
+		goto out;
+
+	if ((rp = doc->rp) != NULL) {
+		rp->beg = beg;
+		rp->presz = pre_end(doc, data, size);
+		if ((rp->pre = malloc(rp->presz + 1)) == NULL)
+			goto out;
+		memcpy(rp->pre, data, rp->presz);
+	}
+
+	/* First pass: references and footnotes. */
+
+	if (!parse_prep(doc, &text, &textsz, data, size, beg,
+	    doc->rp != NULL ? doc->rp->defs : NULL))
+		goto out;
+
+	/*
+	 * Second pass (after header): rendering the document body and
+	 * footnotes.  If using an arena, hand the input over to it so
+	 * that leaf nodes may reference the input instead of copying.
+	 * Footnotes are numbered as they're used, so documents with
+	 * footnote definitions aren't parsed in parallel.
+	 */
+
+	if (textsz > 0) {
+		if (doc->arena != NULL) {
+			if (!arena_adopt(doc->arena, text))
+				goto out;
+			doc->base = text;
+			doc->basesz = textsz;
+		}
+		if (doc->rp != NULL) {
+			doc->rp->base = text;
+			doc->rp->basesz = textsz;
+		}
+		if ((doc->ext_flags & LOWDOWN_PARALLEL) &&
+		    doc->rp == NULL && doc->footrefn == 0) {
+			if (!parse_parallel(doc, text, textsz))
+				goto out;
+		} else if (!parse_block(doc, text, textsz))
+			goto out;
+	}
+
+	rc = doc->rp == NULL || reparse_save(doc, root, &text, textsz);
+out:
+	if (doc->base == NULL)
+		free(text);
+	free_link_refs(doc);
+	free_foot_refs(doc);
+	lowdown_metaq_free(&mq);
+	if (!rc)
+		reparse_free(doc);
+
+	if (rc) {
+		if (maxn != NULL)
+			*maxn = doc->nodes;
+		popnode(doc, root);
+		assert(doc->depth == 0);
+	} else if (root != NULL) {
+		lowdown_node_free(root);
+		root = NULL;
+	} else
+		arena_free(doc->arena);
+	doc->arena = NULL;
+	doc->base = NULL;
+	doc->basesz = 0;
+	return root;
+}
+
+/*
+ * Whether any node in the tree "n" is a footnote reference.
+ */
+static int
+has_footnote(const struct lowdown_node *n)
+{
+	const struct lowdown_node	*nn;
+
+	if (n->type == LOWDOWN_FOOTNOTE)
+		return 1;
+	TAILQ_FOREACH(nn, &n->children, entries)
+		if (has_footnote(nn))
+			return 1;
+	return 0;
+}
+
+/*
+ * Add "delta" (modulo) to the identifier of all nodes in "n".
+ */
+static void
+shift_ids(struct lowdown_node *n, size_t delta)
+{
+	struct lowdown_node	*nn;
+
+	n->id += delta;
+	TAILQ_FOREACH(nn, &n->children, entries)
+		shift_ids(nn, delta);
+}
+
+/*
+ * Length of the common prefix of "a" and "b", both of at least "sz".
+ */
+static size_t
+common_prefix(const char *a, const char *b, size_t sz)
+{
+	size_t	 i = 0;
+
+	while (i + 64 <= sz && memcmp(a + i, b + i, 64) == 0)
+		i += 64;
+	while (i < sz && a[i] == b[i])
+		i++;
+	return i;
+}
+
+/*
+ * Length of the common suffix of "a" of "asz" and "b" of "bsz", not
+ * exceeding "sz".
+ */
+static size_t
+common_suffix(const char *a, size_t asz, const char *b, size_t bsz,
+    size_t sz)
+{
+	size_t	 i = 0;
+
+	while (i + 64 <= sz &&
+	    memcmp(a + asz - i - 64, b + bsz - i - 64, 64) == 0)
+		i += 64;
+	while (i < sz && a[asz - i - 1] == b[bsz - i - 1])
+		i++;
+	return i;
+}
+
+/*
+ * Apply an edit to the input of the tree "root" last returned from
+ * lowdown_doc_parse() or lowdown_doc_reparse(), reparsing only the
+ * top-level blocks affected by the edit.  Blocks are reparsed from the
+ * first whose parse looked at the edited input until the parse again
+ * reaches the start of an old block after it; the tree from there on
+ * is reused.  Edits to the metadata block, to reference or footnote
+ * definitions, or of blocks having footnote references cause a full
+ * parse, as do any with LOWDOWN_REPARSE unset.
+ */
+struct lowdown_node *
+lowdown_doc_reparse(struct lowdown_doc *doc, struct lowdown_node *root,
+    size_t *maxn, size_t off, size_t del, const char *ins, size_t insz)
+{
+	struct reparse		*rp = doc->rp;
+	struct reparse_block	*old = NULL, *blocks, *b;
+	struct lowdown_nodeq	 oldq;
+	struct lowdown_node	*n, *prev, *keep = NULL;
+	struct lowdown_buf	*defs = NULL;
+	char			*src = NULL, *text = NULL;
+	const char		*data;
+	size_t			 srcsz, size, textsz = 0, min, p, s, r,
+				 i, oldsz, nid, oid, beg;
+	int			 rc = 0, stop;
+
+	TAILQ_INIT(&oldq);
+
+	if (rp == NULL || rp->root != root ||
+	    off > rp->srcsz || del > rp->srcsz - off)
+		return NULL;
+
+	/* Apply the edit to the retained input. */
+
+	srcsz = rp->srcsz - del + insz;
+	if ((src = malloc(srcsz + 1)) == NULL)
+		goto err;
+	memcpy(src, rp->src, off);
+	if (insz > 0)
+		memcpy(src + off, ins, insz);
+	memcpy(src + off + insz, rp->src + off + del,
+		rp->srcsz - off - del);
+
+	/*
+	 * Prepare the block parser's input as in lowdown_doc_parse(),
+	 * stopping if the metadata or definitions have changed.
+	 */
+
+	data = src;
+	size = srcsz;
+	if (!strip_crlf(&data, &size, &text))
+		goto err;
+	if (pre_end(doc, data, size) != rp->presz ||
+	    memcmp(data, rp->pre, rp->presz) != 0)
+		goto full;
+
+	if ((defs = hbuf_new(64)) == NULL)
+		goto err;
+	rc = parse_prep(doc, &text, &textsz, data, size, rp->beg, defs);
+	free_link_refs(doc);
+	free_foot_refs(doc);
+	if (!rc)
+		goto err;
+	rc = 0;
+	if (defs->size != rp->defs->size || (defs->size > 0 &&
+	    memcmp(defs->data, rp->defs->data, defs->size) != 0))
+		goto full;
+
+	/* Find the changed input and the first block that saw it. */
+
+	min = textsz < rp->textsz ? textsz : rp->textsz;
+	p = min == 0 ? 0 : common_prefix(text, rp->text, min);
+	s = min == 0 ? 0 : common_suffix
+		(text, textsz, rp->text, rp->textsz, min - p);
+	if (p == min && textsz == rp->textsz)
+		goto done;
+
+	for (r = 0; r < rp->blocksz; r++)
+		if (rp->blocks[r].seen > p)
+			break;
+
+	prev = r < rp->blocksz ? rp->blocks[r].prev :
+		TAILQ_LAST(&root->children, lowdown_nodeq);
+
+	/* Replace the blocks from there on: save the old ones. */
+
+	blocks = reallocarray(NULL, rp->blockmax > 0 ?
+		rp->blockmax : 1, sizeof(struct reparse_block));
+	if (blocks == NULL)
+		goto err;
+	if (r > 0)
+		memcpy(blocks, rp->blocks, r * sizeof(struct reparse_block));
+	old = rp->blocks;
+	oldsz = rp->blocksz;
+	rp->blocks = blocks;
+	rp->blockmax = rp->blockmax > 0 ? rp->blockmax : 1;
+	rp->blocksz = r;
+	rp->old = old + r;
+	rp->oldsz = oldsz - r;
+	rp->oldpos = 0;
+	rp->olddmg = rp->textsz - s;
+	rp->newdmg = textsz - s;
+	rp->resync = rp->foot = rp->open = rp->glue = 0;
+	rp->base = text;
+	rp->basesz = textsz;
+
+	while ((n = TAILQ_NEXT(prev, entries)) != NULL) {
+		TAILQ_REMOVE(&root->children, n, entries);
+		TAILQ_INSERT_TAIL(&oldq, n, entries);
+	}
+
+	/* Reparse from the first affected block as if at the top. */
+
+	doc->nodes = r < oldsz ? old[r].id : rp->maxn;
+	doc->depth = 1;
+	doc->current = root;
+	doc->in_link_body = 0;
+	doc->in_footnote = 0;
+	doc->foots = rp->foots;
+	doc->metaq = &rp->metaq;
+	reparse_swap(doc);
+
+	beg = r < oldsz ? old[r].beg : 0;
+	rc = metaidx_build(&doc->metaidx, doc->metaq) &&
+		(textsz <= beg ||
+		 parse_block(doc, text + beg, textsz - beg));
+
+	reparse_swap(doc);
+	doc->depth = 0;
+	doc->current = NULL;
+	if (!rc)
+		goto err;
+	rc = 0;
+
+	/* Find the old nodes to reuse, if any. */
+
+	if (rp->resync)
+		for (i = rp->oldpos; i < rp->oldsz; i++)
+			if ((keep = rp->old[i].first) != NULL)
+				break;
+
+	/*
+	 * Footnote numbering is document-wide: if the replaced or new
+	 * blocks have footnote references, start over.
+	 */
+
+	if (rp->foot)
+		goto full;
+	TAILQ_FOREACH(n, &oldq, entries) {
+		if (n == keep)
+			break;
+		if (has_footnote(n))
+			goto full;
+	}
+
+	/*
+	 * Splice the reused nodes back into the tree, renumbering them
+	 * and their blocks to follow the new ones.
+	 */
+
+	if (rp->resync) {
+		oid = rp->old[rp->oldpos].id;
+		nid = doc->nodes;
+		stop = 0;
+		for (i = rp->oldpos; i < rp->oldsz; i++) {
+			if (rp->blocksz == rp->blockmax) {
+				b = reallocarray(rp->blocks,
+					rp->blockmax + 256,
+					sizeof(struct reparse_block));
+				if (b == NULL)
+					goto err;
+				rp->blocks = b;
+				rp->blockmax += 256;
+			}
+			b = &rp->blocks[rp->blocksz++];
+			*b = rp->old[i];
+			b->beg = b->beg - rp->olddmg + rp->newdmg;
+			b->end = b->end - rp->olddmg + rp->newdmg;
+			if (b->seen != SIZE_MAX)
+				b->seen = b->seen - rp->olddmg + rp->newdmg;
+			b->id = b->id - oid + nid;
+			b->idend = b->idend - oid + nid;
+			/*
+			 * Blocks up to the first with nodes were
+			 * preceded by replaced nodes.
+			 */
+			if (!stop)
+				b->prev = TAILQ_LAST(&root->children,
+					lowdown_nodeq);
+			if (b->first != NULL)
+				stop = 1;
+		}
+		while (keep != NULL) {
+			n = TAILQ_NEXT(keep, entries);
+			TAILQ_REMOVE(&oldq, keep, entries);
+			TAILQ_INSERT_TAIL(&root->children, keep, entries);
+			if (nid != oid)
+				shift_ids(keep, nid - oid);
+			keep = n;
+		}
+		rp->maxn = rp->maxn - oid + nid;
+	} else
+		rp->maxn = doc->nodes;
+
+	rp->foots = doc->foots;
+	while ((n = TAILQ_FIRST(&oldq)) != NULL) {
+		TAILQ_REMOVE(&oldq, n, entries);
+		lowdown_node_free(n);
+	}
+done:
+	free(old);
+	free(rp->src);
+	free(rp->text);
+	rp->src = src;
+	rp->srcsz = srcsz;
+	rp->text = text;
+	rp->textsz = textsz;
+	rp->old = NULL;
+	rp->base = NULL;
+	hbuf_free(defs);
+	if (maxn != NULL)
+		*maxn = rp->maxn;
+	return root;
+full:
+	rc = 1;
+err:
+	/*
+	 * Discard the tree and state.  If the edit can't be reparsed
+	 * incrementally, parse the edited input in full.
+	 */
+
+	TAILQ_CONCAT(&root->children, &oldq, entries);
+	lowdown_node_free(root);
+	free(old);
+	free(text);
+	hbuf_free(defs);
+	reparse_free(doc);
+	root = rc ? lowdown_doc_parse(doc, maxn, src, srcsz, NULL) : NULL;
+	free(src);
+	return root;
+}
+
+/*
+ * Whether the line at "beg" of "data" with "size" bytes of complete
+ * lines can be checked for being a reference or footnote definition.
+ * References take up to three lines; footnotes continue until an
+ * unindented line.
+ */
+static int
+stream_decided(const char *data, size_t beg, size_t size)
+{
+	size_t	 i, lines = 0;
+	int	 unind = 0;
+
+	i = countspaces(data, beg, size, 3);
+	if (i >= size || data[i] != '[')
+		return 1;
+	for (i = next_line(data, i, size); i < size && !unind;
+	     i = next_line(data, i, size)) {
+		lines++;
+		unind = data[i] != ' ' &&
+			!is_empty(data + i, size - i);
+	}
+	return unind && lines >= 3;
+}
+
+/*
+ * Whether the header may be parsed from the complete lines "data" of
+ * length "size": that is, whether the metadata block (if any) is
+ * known to end.
+ */
+static int
+stream_meta(const struct lowdown_doc *doc, const char *data, size_t size)
+{
+	size_t	 i = 0;
+	int	 is_yaml = 0;
+
+	if (!(doc->ext_flags & LOWDOWN_METADATA))
+		return 1;
+	if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+		data += 3;
+		size -= 3;
+	}
+	if (size > 0 && data[0] == '%')
+		return is_metadata_block_pandoc(data, size) < size;
+	if (is_metadata_block_mmd(data, size, &is_yaml) > 0)
+		return 1;
+
+	/* Not yet a metadata block: might it become one? */
+
+	if (size > 4 && strncmp(data, "---\n", 4) == 0)
+		i = 4;
+	else if (size <= 4 && strncmp(data, "---\n", size) == 0)
+		return 0;
+	if (i == size)
+		return 0;
+	if (!isalnum((unsigned char)data[i]))
+		return 1;
+	while (i < size && data[i] != '\n' && data[i] != ':')
+		i++;
+	return i < size && data[i] == '\n';
+}
+
+/*
+ * First pass over the pending input: as in parse_prep(), consume
+ * references and footnotes and append the rest to the block parser's
+ * input, but only as far as each line is known to be one or not.  If
+ * "fin", this is the end of the input.  Returns FALSE on failure
+ * (memory), TRUE on success.
+ */
+static int
+stream_prep(struct lowdown_doc *doc, int fin)
+{
+	struct stream	*st = doc->st;
+	const char	*data = st->in->data, *cp;
+	size_t		 beg = 0, end, size, sz;
+	int		 c;
+
+	if (fin)
+		size = st->in->size;
+	else if ((cp = memrchr(data, '\n', st->in->size)) != NULL)
+		size = (size_t)(cp - data) + 1;
+	else
+		size = 0;
+
+	while (beg < size) {
+		if (!fin && !stream_decided(data, beg, size))
+			break;
+		c = 0;
+		if (doc->ext_flags & LOWDOWN_FOOTNOTES)
+			c = is_footnote(doc, data, beg, size, &end);
+		if (c == 0)
+			c = is_ref(doc, data, beg, size, &end);
+		if (c < 0)
+			return 0;
+		if (c > 0) {
+			/* An unterminated last line may overshoot. */
+			beg = end < size ? end : size;
+			continue;
+		}
+		end = find_eol(data, beg, size);
+		while (end < size && data[end] == '\n')
+			end++;
+		sz = expand_tabs(NULL, data + beg, end - beg);
+		if (!hbuf_grow(st->text, st->text->size + sz + 1))
+			return 0;
+		st->text->size += expand_tabs
+			(st->text->data + st->text->size,
+			 data + beg, end - beg);
+		beg = end;
+	}
+
+	if (fin && st->text->size > 0 &&
+	    st->text->data[st->text->size - 1] != '\n')
+		st->text->data[st->text->size++] = '\n';
+
+	st->in->size -= beg;
+	memmove(st->in->data, st->in->data + beg, st->in->size);
+	return 1;
+}
+
+/*
+ * Forget the use of footnotes after the first "foots", whose nodes are
+ * being discarded.
+ */
+static void
+stream_unfoot(struct lowdown_doc *doc, size_t foots)
+{
+	struct foot_ref	*fr;
+	size_t		 i;
+
+	for (i = 0; i < doc->footrefsz; i++)
+		for (fr = doc->footrefs[i]; fr != NULL; fr = fr->next)
+			if (fr->num > foots) {
+				fr->num = 0;
+				fr->ref = NULL;
+			}
+	doc->foots = foots;
+}
+
+/*
+ * Whether the nodes of the final block "i" may be handed out.  Not if a
+ * later definition list may take them over: there must be a later final
+ * block with nodes that couldn't be taken over along with them, or two.
+ */
+static int
+stream_sealed(const struct reparse *rp, size_t i)
+{
+	const struct lowdown_node	*n;
+	size_t				 j;
+
+	for (j = i + 1; j < rp->blocksz; j++)
+		if (rp->blocks[j].first != NULL)
+			break;
+	if (j == rp->blocksz || rp->blocks[j].seen == SIZE_MAX)
+		return 0;
+	n = rp->blocks[j].first;
+	if (n != rp->blocks[j].last || n->type != LOWDOWN_PARAGRAPH ||
+	    n->rndr_paragraph.lines != 1)
+		return 1;
+	for (j++; j < rp->blocksz; j++)
+		if (rp->blocks[j].first != NULL)
+			break;
+	return j < rp->blocksz && rp->blocks[j].seen != SIZE_MAX;
+}
+
+/*
+ * Second pass over the block parser's input, handing final top-level
+ * blocks to "fp" and discarding the rest to parse again when there's
+ * more input.  Blocks with unresolved references are held, with those
+ * after them, in case the definitions come later.  If "fin", this is
+ * the end of the input.  Returns FALSE on failure, TRUE on success.
+ */
+static int
+stream_emit(struct lowdown_doc *doc,
+    int (*fp)(struct lowdown_node *, void *), void *arg, int fin)
+{
+	struct stream		*st = doc->st;
+	struct reparse		*rp = &st->rp;
+	struct lowdown_node	*n, *nn;
+	size_t			 i, k, defs, beg;
+	int			 rc;
+
+	/*
+	 * Parsing again has a cost linear in the held input, so only do
+	 * so when it has doubled or definitions have been added.
+	 */
+
+	defs = doc->refn + doc->footrefn;
+	if (st->text->size == 0 || (!fin &&
+	    st->text->size < st->next && defs == st->defs))
+		return 1;
+
+	/*
+	 * Parse a copy, as the block parser may modify its input (see
+	 * parse_blockquote()) and the text may need to be parsed again.
+	 */
+
+	hbuf_truncate(st->work);
+	if (!hbuf_putb(st->work, st->text))
+		return 0;
+
+	rp->blocksz = 0;
+	rp->open = rp->glue = rp->unres = 0;
+	rp->seen = 0;
+	rp->base = st->work->data;
+	rp->basesz = st->work->size;
+	doc->rp = rp;
+	rc = parse_block(doc, st->work->data, st->work->size);
+	doc->rp = NULL;
+	if (!rc)
+		return 0;
+
+	for (k = 0; k < rp->blocksz && !fin; k++) {
+		if (rp->blocks[k].seen == SIZE_MAX)
+			break;
+		if (rp->blocks[k].unres &&
+		    st->text->size < STREAM_HOLD_MAX)
+			break;
+		if (rp->blocks[k].first != NULL &&
+		    !stream_sealed(rp, k))
+			break;
+	}
+	if (fin)
+		k = rp->blocksz;
+
+	/* Hand out the final blocks' nodes. */
+
+	for (i = 0; i < k; i++) {
+		n = rp->blocks[i].first;
+		while (n != NULL) {
+			nn = n == rp->blocks[i].last ? NULL :
+				TAILQ_NEXT(n, entries);
+			TAILQ_REMOVE(&st->root->children, n, entries);
+			n->parent = NULL;
+			if (!fp(n, arg))
+				return 0;
+			n = nn;
+		}
+	}
+
+	/* Discard the rest, resetting node and footnote numbering. */
+
+	while ((n = TAILQ_FIRST(&st->root->children)) != NULL) {
+		TAILQ_REMOVE(&st->root->children, n, entries);
+		lowdown_node_free(n);
+	}
+	if (k < rp->blocksz) {
+		doc->nodes = rp->blocks[k].id;
+		stream_unfoot(doc, rp->blocks[k].foots);
+		beg = rp->blocks[k].beg;
+	} else
+		beg = st->text->size;
+
+	st->text->size -= beg;
+	memmove(st->text->data, st->text->data + beg, st->text->size);
+	st->next = st->text->size * 2;
+	st->defs = defs;
+	return 1;
+}
+
+/*
+ * Process as much of the pending input as possible: first the header,
+ * then the body.  If "fin", this is the end of the input.  Returns
+ * FALSE on failure, TRUE on success.
+ */
+static int
+stream_run(struct lowdown_doc *doc,
+    int (*fp)(struct lowdown_node *, void *), void *arg, int fin)
+{
+	struct stream		*st = doc->st;
+	struct lowdown_node	*n;
+	const char		*cp;
+	size_t			 i, j, beg;
+
+	/* Strip out DOS CRLF, if detected at the first line. */
+
+	if (st->crlf < 0) {
+		cp = memchr(st->in->data, '\n', st->in->size);
+		if (cp == NULL && !fin)
+			return 1;
+		st->crlf = cp != NULL && cp > st->in->data && cp[-1] == '\r';
+	}
+	if (st->crlf) {
+		for (i = j = 0; i < st->in->size; i++)
+			if (st->in->data[i] != '\r')
+				st->in->data[j++] = st->in->data[i];
+		st->in->size = j;
+	}
+
+	if (!st->body) {
+		cp = memrchr(st->in->data, '\n', st->in->size);
+		if (!fin && st->in->size < STREAM_HOLD_MAX &&
+		    !stream_meta(doc, st->in->data, cp == NULL ? 0 :
+		    (size_t)(cp - st->in->data) + 1))
+			return 1;
+		if (!parse_header(doc, st->in->data, st->in->size, &beg))
+			return 0;
+		st->in->size -= beg;
+		memmove(st->in->data, st->in->data + beg, st->in->size);
+		st->body = 1;
+		n = TAILQ_FIRST(&st->root->children);
+		TAILQ_REMOVE(&st->root->children, n, entries);
+		n->parent = NULL;
+		if (!fp(n, arg))
+			return 0;
+	}
+
+	return stream_prep(doc, fin) && stream_emit(doc, fp, arg, fin);
+}
+
+/*
+ * Parse the next "size" bytes of input "data", handing each top-level
+ * node of the document to "fp" as soon as it's final.
+ */
+int
+lowdown_doc_feed(struct lowdown_doc *doc, const char *data, size_t size,
+    int (*fp)(struct lowdown_node *, void *), void *arg)
+{
+	struct stream	*st;
+
+	/* Start a new document, replacing any lowdown_doc_parse() state. */
+
+	if (doc->st == NULL) {
+		reparse_free(doc);
+		if ((st = doc->st = calloc(1, sizeof(struct stream))) == NULL)
+			return 0;
+		TAILQ_INIT(&st->metaq);
+		st->crlf = -1;
+		doc->nodes = 0;
+		doc->depth = 0;
+		doc->current = NULL;
+		doc->in_link_body = 0;
+		doc->in_footnote = 0;
+		doc->foots = 0;
+		doc->metaq = &st->metaq;
+		metaidx_clear(&doc->metaidx);
+		if ((st->in = hbuf_new(4096)) == NULL ||
+		    (st->text = hbuf_new(4096)) == NULL ||
+		    (st->work = hbuf_new(4096)) == NULL ||
+		    (st->root = pushnode(doc, LOWDOWN_ROOT)) == NULL)
+			goto err;
+	}
+
+	if (!hbuf_put(doc->st->in, data, size) ||
+	    !stream_run(doc, fp, arg, 0))
+		goto err;
+	return 1;
+err:
+	stream_free(doc);
+	return 0;
+}
+
+/*
+ * Finish the document given to lowdown_doc_feed(), handing any
+ * remaining top-level nodes to "fp".  If not NULL, "maxn" is set as in
+ * lowdown_doc_parse() and "metaq" filled in with the metadata.
+ */
+int
+lowdown_doc_finish(struct lowdown_doc *doc, size_t *maxn,
+    struct lowdown_metaq *metaq,
+    int (*fp)(struct lowdown_node *, void *), void *arg)
+{
+	if (doc->st == NULL && !lowdown_doc_feed(doc, NULL, 0, fp, arg))
+		return 0;
+	if (!stream_run(doc, fp, arg, 1)) {
+		stream_free(doc);
+		return 0;
+	}
+	if (maxn != NULL)
+		*maxn = doc->nodes;
+	if (metaq != NULL)
+		TAILQ_CONCAT(metaq, &doc->st->metaq, entries);
+	stream_free(doc);
+	return 1;
+}
+
+void
+lowdown_node_free(struct lowdown_node *p)
+{
+	struct lowdown_node *n;
+
+	if (p == NULL)
+		return;
+
+	/*
+	 * Arena-allocated trees are released all at once when the root
+	 * is freed.  Freeing any other node in the tree does nothing:
+	 * its memory is reclaimed along with the root.  Top-level blocks
+	 * from lowdown_doc_reparse() are on the heap, so are freed
+	 * first.
+	 */
+
+	if (p->arena != NULL) {
+		if (p->parent != NULL || p->type != LOWDOWN_ROOT)
+			return;
+		while ((n = TAILQ_FIRST(&p->children)) != NULL) {
+			TAILQ_REMOVE(&p->children, n, entries);
+			if (n->arena == NULL)
+				lowdown_node_free(n);
+		}
+		arena_free(p->arena);
+		return;
+	}
 
 	switch (p->type) {
 	case LOWDOWN_BLOCKCODE:
@@ -5262,6 +7522,10 @@ lowdown_doc_free(struct lowdown_doc *doc)
 	if (doc == NULL)
 		return;
 
+	stream_free(doc);
+	reparse_free(doc);
+	scratch_free(doc);
+	metaidx_free(&doc->metaidx);
 	for (i = 0; i < doc->metasz; i++)
 		free(doc->meta[i]);
 	for (i = 0; i < doc->metaovrsz; i++)
@@ -163,6 +163,62 @@ lowdown_attrs_add(struct lowdown_attr **attrs, size_t *attrsz,
 	return 1;
 }
 
+/*
+ * Copy "attrsz" attributes "attrs" into the arena "a", setting "na" to
+ * the copy (or NULL if "attrsz" is zero).  Return FALSE on failure
+ * (memory), TRUE on success.
+ */
+int
+lowdown_attrs_clone(struct lowdown_arena *a, struct lowdown_attr **na,
+    const struct lowdown_attr *attrs, size_t attrsz)
+{
+	struct lowdown_attr	*p;
+	struct lowdown_buf	*b;
+	size_t			 i;
+
+	*na = NULL;
+	if (attrsz == 0)
+		return 1;
+	if ((p = arena_calloc(a, attrsz, sizeof(struct lowdown_attr))) == NULL)
+		return 0;
+	for (i = 0; i < attrsz; i++) {
+		if (attrs[i].key != NULL &&
+		    (p[i].key = arena_strndup(a, attrs[i].key,
+		     strlen(attrs[i].key))) == NULL)
+			return 0;
+		if (attrs[i].value == NULL)
+			continue;
+		if ((b = arena_calloc(a, 1, sizeof(struct lowdown_buf))) == NULL)
+			return 0;
+		if (!arena_buf_put(a, b, attrs[i].value->data,
+		    attrs[i].value->size))
+			return 0;
+		p[i].value = b;
+	}
+	*na = p;
+	return 1;
+}
+
+/*
+ * Move attributes from the heap into the arena "a", freeing the heap
+ * copies.  Does nothing if "a" is NULL.  On failure, the attributes are
+ * left untouched.  Return FALSE on failure (memory), TRUE on success.
+ */
+int
+lowdown_attrs_adopt(struct lowdown_arena *a, struct lowdown_attr **attrs,
+    size_t attrsz)
+{
+	struct lowdown_attr	*na;
+
+	if (a == NULL || attrsz == 0)
+		return 1;
+	if (!lowdown_attrs_clone(a, &na, *attrs, attrsz))
+		return 0;
+	lowdown_attrs_free(*attrs, attrsz);
+	*attrs = na;
+	return 1;
+}
+
 /*
  * Parse attributes from the buffer "data".  The buffer should not have
  * any enclosing characters, e.g., { foo }.  Return 0 on failure or
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lowdown.h"
+#include "extern.h"
+#include "parse.h"
+
+/*
+ * Where the type-specific union of a node begins and how large it is.
+ */
+#define	FLAT_UNION_OFF	offsetof(struct lowdown_node, rndr_meta)
+#define	FLAT_UNION_SZ	(offsetof(struct lowdown_node, parent) - \
+			 FLAT_UNION_OFF)
+
+/*
+ * Alignment of the type-specific fields in "exts".
+ */
+#define	FLAT_ALIGN	8
+#define	FLAT_ALIGNUP(sz) (((sz) + FLAT_ALIGN - 1) & ~(size_t)(FLAT_ALIGN - 1))
+
+/*
+ * Return the buffer of node types whose type-specific fields are just
+ * that buffer and flags that fit into the flat node, or NULL for other
+ * types.  These are the common leaf nodes, which need no "ext".
+ */
+static struct lowdown_buf *
+flat_buf(const struct lowdown_node *n)
+{
+	struct lowdown_node	*nn = (struct lowdown_node *)n;
+
+	switch (n->type) {
+	case LOWDOWN_BLOCKHTML:
+		return &nn->rndr_blockhtml.text;
+	case LOWDOWN_CODESPAN:
+		return &nn->rndr_codespan.text;
+	case LOWDOWN_ENTITY:
+		return &nn->rndr_entity.text;
+	case LOWDOWN_MATH_BLOCK:
+		return &nn->rndr_math.text;
+	case LOWDOWN_META:
+		return &nn->rndr_meta.key;
+	case LOWDOWN_NORMAL_TEXT:
+		return &nn->rndr_normal_text.text;
+	case LOWDOWN_RAW_HTML:
+		return &nn->rndr_raw_html.text;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Return the flags kept along with a flat_buf().
+ */
+static int
+flat_flags(const struct lowdown_node *n)
+{
+
+	if (n->type == LOWDOWN_NORMAL_TEXT)
+		return n->rndr_normal_text.flags;
+	if (n->type == LOWDOWN_MATH_BLOCK)
+		return n->rndr_math.blockmode;
+	return 0;
+}
+
+/*
+ * Whether a node without a flat_buf() has any type-specific fields set,
+ * so it needs an "ext".  Most container nodes (emphasis, table rows,
+ * and so on) don't have any.
+ */
+static int
+flat_has_ext(const struct lowdown_node *n)
+{
+	static const struct lowdown_node	 zero;
+
+	return memcmp((const char *)n + FLAT_UNION_OFF,
+	    (const char *)&zero + FLAT_UNION_OFF, FLAT_UNION_SZ) != 0;
+}
+
+/*
+ * Size of the type-specific fields of a node without a flat_buf().
+ */
+static size_t
+flat_ext_size(enum lowdown_rndrt type)
+{
+
+	switch (type) {
+	case LOWDOWN_BLOCKCODE:
+		return sizeof(struct rndr_blockcode);
+	case LOWDOWN_BLOCKQUOTE:
+		return sizeof(struct rndr_blockquote);
+	case LOWDOWN_DEFINITION:
+		return sizeof(struct rndr_definition);
+	case LOWDOWN_HEADER:
+		return sizeof(struct rndr_header);
+	case LOWDOWN_IMAGE:
+		return sizeof(struct rndr_image);
+	case LOWDOWN_LINK:
+		return sizeof(struct rndr_link);
+	case LOWDOWN_LINK_AUTO:
+		return sizeof(struct rndr_autolink);
+	case LOWDOWN_LIST:
+		return sizeof(struct rndr_list);
+	case LOWDOWN_LISTITEM:
+		return sizeof(struct rndr_listitem);
+	case LOWDOWN_PARAGRAPH:
+		return sizeof(struct rndr_paragraph);
+	case LOWDOWN_TABLE_BLOCK:
+		return sizeof(struct rndr_table);
+	case LOWDOWN_TABLE_HEADER:
+		return sizeof(struct rndr_table_header);
+	case LOWDOWN_TABLE_CELL:
+		return sizeof(struct rndr_table_cell);
+	default:
+		return FLAT_UNION_SZ;
+	}
+}
+
+/*
+ * Copy the buffer "src" into "dst" within the arena "a".  Return FALSE
+ * on failure (memory), TRUE on success.
+ */
+static int
+flat_buf_copy(struct lowdown_arena *a, struct lowdown_buf *dst,
+    const struct lowdown_buf *src)
+{
+
+	memset(dst, 0, sizeof(struct lowdown_buf));
+	return arena_buf_put(a, dst, src->data, src->size);
+}
+
+/*
+ * Copy the type-specific fields of "src" into "dst", which has the same
+ * type, with what they point to copied into the arena "a".  This is for
+ * node types without a flat_buf().  Return FALSE on failure (memory),
+ * TRUE on success.
+ */
+static int
+flat_copy(struct lowdown_arena *a, struct lowdown_node *dst,
+    const struct lowdown_node *src)
+{
+	enum htbl_flags	*fl;
+	size_t		 cols;
+
+	memcpy((char *)dst + FLAT_UNION_OFF,
+	    (const char *)src + FLAT_UNION_OFF, FLAT_UNION_SZ);
+
+	switch (src->type) {
+	case LOWDOWN_BLOCKCODE:
+		return flat_buf_copy(a, &dst->rndr_blockcode.text,
+			&src->rndr_blockcode.text) &&
+		    flat_buf_copy(a, &dst->rndr_blockcode.lang,
+			&src->rndr_blockcode.lang);
+	case LOWDOWN_HEADER:
+		return lowdown_attrs_clone(a, &dst->rndr_header.attrs,
+			src->rndr_header.attrs, src->rndr_header.attrsz);
+	case LOWDOWN_IMAGE:
+		return flat_buf_copy(a, &dst->rndr_image.link,
+			&src->rndr_image.link) &&
+		    flat_buf_copy(a, &dst->rndr_image.title,
+			&src->rndr_image.title) &&
+		    flat_buf_copy(a, &dst->rndr_image.dims,
+			&src->rndr_image.dims) &&
+		    flat_buf_copy(a, &dst->rndr_image.alt,
+			&src->rndr_image.alt) &&
+		    lowdown_attrs_clone(a, &dst->rndr_image.attrs,
+			src->rndr_image.attrs, src->rndr_image.attrsz);
+	case LOWDOWN_LINK:
+		return flat_buf_copy(a, &dst->rndr_link.link,
+			&src->rndr_link.link) &&
+		    flat_buf_copy(a, &dst->rndr_link.title,
+			&src->rndr_link.title) &&
+		    lowdown_attrs_clone(a, &dst->rndr_link.attrs,
+			src->rndr_link.attrs, src->rndr_link.attrsz);
+	case LOWDOWN_LINK_AUTO:
+		return flat_buf_copy(a, &dst->rndr_autolink.link,
+			&src->rndr_autolink.link);
+	case LOWDOWN_TABLE_HEADER:
+		if (src->rndr_table_header.flags == NULL)
+			break;
+		cols = src->rndr_table_header.columns;
+		if ((fl = arena_calloc(a, cols, sizeof(*fl))) == NULL)
+			return 0;
+		memcpy(fl, src->rndr_table_header.flags, cols * sizeof(*fl));
+		dst->rndr_table_header.flags = fl;
+		break;
+	default:
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Add the number of nodes, bytes of flat_buf() text, and bytes of exts
+ * of "n" and its descendants to "f".
+ */
+static void
+flat_count(struct lowdown_flat *f, const struct lowdown_node *n)
+{
+	const struct lowdown_buf	*b;
+	const struct lowdown_node	*nn;
+
+	f->nodesz++;
+	if ((b = flat_buf(n)) != NULL)
+		f->textsz += b->size;
+	else if (flat_has_ext(n))
+		f->extsz += FLAT_ALIGNUP(flat_ext_size(n->type));
+	TAILQ_FOREACH(nn, &n->children, entries)
+		flat_count(f, nn);
+}
+
+/*
+ * Append "n" and its descendants to "f", whose arrays have been sized
+ * by flat_count() and whose sizes are used as cursors.  Return FALSE on
+ * failure (memory or a value too large), TRUE on success.
+ */
+static int
+flat_fill(struct lowdown_flat *f, const struct lowdown_node *n,
+    unsigned int parent)
+{
+	struct lowdown_flat_node	*fn;
+	struct lowdown_node		 tmp;
+	const struct lowdown_buf	*b;
+	const struct lowdown_node	*nn;
+	unsigned int			 i;
+	int				 fl;
+
+	if (n->id >= LOWDOWN_FLAT_NONE)
+		return 0;
+
+	i = (unsigned int)f->nodesz++;
+	fn = &f->nodes[i];
+	fn->id = (unsigned int)n->id;
+	fn->parent = parent;
+	fn->type = n->type;
+	fn->chng = n->chng;
+	fn->ext = LOWDOWN_FLAT_NONE;
+
+	if ((b = flat_buf(n)) != NULL) {
+		if ((fl = flat_flags(n)) < 0 || fl > UCHAR_MAX)
+			return 0;
+		fn->flags = (unsigned char)fl;
+		fn->text = (unsigned int)f->textsz;
+		fn->textsz = (unsigned int)b->size;
+		if (b->size > 0)
+			memcpy(f->text + f->textsz, b->data, b->size);
+		f->textsz += b->size;
+	} else if (flat_has_ext(n)) {
+		memset(&tmp, 0, sizeof(struct lowdown_node));
+		tmp.type = n->type;
+		if (!flat_copy(f->arena, &tmp, n))
+			return 0;
+		fn->ext = (unsigned int)f->extsz;
+		memcpy((char *)f->exts + f->extsz,
+		    (char *)&tmp + FLAT_UNION_OFF, flat_ext_size(n->type));
+		f->extsz += FLAT_ALIGNUP(flat_ext_size(n->type));
+	}
+
+	TAILQ_FOREACH(nn, &n->children, entries)
+		if (!flat_fill(f, nn, i))
+			return 0;
+
+	f->nodes[i].end = (unsigned int)f->nodesz;
+	return 1;
+}
+
+struct lowdown_flat *
+lowdown_flat_new(const struct lowdown_node *root)
+{
+	struct lowdown_flat	*f;
+	size_t			 nodesz, textsz, extsz;
+
+	if (root->type != LOWDOWN_ROOT)
+		return NULL;
+	if ((f = calloc(1, sizeof(struct lowdown_flat))) == NULL)
+		return NULL;
+
+	/* Size everything, then fill it in with one pass. */
+
+	flat_count(f, root);
+	nodesz = f->nodesz;
+	textsz = f->textsz;
+	extsz = f->extsz;
+	if (nodesz >= LOWDOWN_FLAT_NONE || textsz >= LOWDOWN_FLAT_NONE ||
+	    extsz >= LOWDOWN_FLAT_NONE)
+		goto err;
+
+	f->nodes = calloc(nodesz, sizeof(struct lowdown_flat_node));
+	if (f->nodes == NULL)
+		goto err;
+	if (textsz > 0 && (f->text = malloc(textsz)) == NULL)
+		goto err;
+	if (extsz > 0 && (f->exts = calloc(1, extsz)) == NULL)
+		goto err;
+	if ((f->arena = arena_new(0)) == NULL)
+		goto err;
+
+	f->nodesz = f->textsz = f->extsz = 0;
+	if (!flat_fill(f, root, LOWDOWN_FLAT_NONE))
+		goto err;
+	assert(f->nodesz == nodesz);
+	assert(f->textsz == textsz);
+	assert(f->extsz == extsz);
+	return f;
+err:
+	lowdown_flat_free(f);
+	return NULL;
+}
+
+/*
+ * Create the node at index "i" of "f" and its descendants in the arena
+ * "a", raising "maxn" to above its identifier.  Returns the node or
+ * NULL on failure (memory).
+ */
+static struct lowdown_node *
+flat_expand(const struct lowdown_flat *f, struct lowdown_arena *a,
+    size_t i, struct lowdown_node *parent, size_t *maxn)
+{
+	const struct lowdown_flat_node	*fn = &f->nodes[i];
+	struct lowdown_node		*n, *nn, tmp;
+	struct lowdown_buf		*b;
+	size_t				 j;
+
+	if ((n = arena_calloc(a, 1, sizeof(struct lowdown_node))) == NULL)
+		return NULL;
+	TAILQ_INIT(&n->children);
+	n->type = fn->type;
+	n->chng = fn->chng;
+	n->id = fn->id;
+	n->parent = parent;
+	n->arena = a;
+	if (*maxn < n->id + 1)
+		*maxn = n->id + 1;
+
+	if ((b = flat_buf(n)) != NULL) {
+		if (n->type == LOWDOWN_NORMAL_TEXT)
+			n->rndr_normal_text.flags = fn->flags;
+		else if (n->type == LOWDOWN_MATH_BLOCK)
+			n->rndr_math.blockmode = fn->flags;
+		if (!arena_buf_put(a, b, f->text + fn->text, fn->textsz))
+			return NULL;
+	} else if (fn->ext != LOWDOWN_FLAT_NONE) {
+		memset(&tmp, 0, sizeof(struct lowdown_node));
+		tmp.type = n->type;
+		memcpy((char *)&tmp + FLAT_UNION_OFF,
+		    (const char *)f->exts + fn->ext, flat_ext_size(n->type));
+		if (!flat_copy(a, n, &tmp))
+			return NULL;
+	}
+
+	for (j = i + 1; j < fn->end; j = f->nodes[j].end) {
+		if ((nn = flat_expand(f, a, j, n, maxn)) == NULL)
+			return NULL;
+		TAILQ_INSERT_TAIL(&n->children, nn, entries);
+	}
+	return n;
+}
+
+struct lowdown_node *
+lowdown_flat_tree(const struct lowdown_flat *f, size_t *maxn)
+{
+	struct lowdown_arena	*a;
+	struct lowdown_node	*root;
+	size_t			 max = 0;
+
+	a = arena_new(f->nodesz * sizeof(struct lowdown_node) + f->textsz);
+	if (a == NULL)
+		return NULL;
+	if ((root = flat_expand(f, a, 0, NULL, &max)) == NULL) {
+		arena_free(a);
+		return NULL;
+	}
+	if (maxn != NULL)
+		*maxn = max;
+	return root;
+}
+
+void
+lowdown_flat_free(struct lowdown_flat *f)
+{
+
+	if (f == NULL)
+		return;
+	arena_free(f->arena);
+	free(f->nodes);
+	free(f->text);
+	free(f->exts);
+	free(f);
+}
@@ -16,9 +16,31 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+/*
+ * A set of bytes to scan for.  See charset_init().
+ */
+struct	charset {
+	unsigned char	  lo[16]; /* classes by low nibble */
+	unsigned char	  hi[16]; /* classes by high nibble */
+	unsigned char	  map[256]; /* non-zero if in the set */
+	size_t		(*find)(const struct charset *, const char *,
+				size_t, size_t); /* scanner */
+};
+
+void
+charset_init(struct charset *, const int *);
+
 void
 lowdown_attrs_free(struct lowdown_attr *, size_t);
 
+int
+lowdown_attrs_clone(struct lowdown_arena *, struct lowdown_attr **,
+    const struct lowdown_attr *, size_t);
+
+int
+lowdown_attrs_adopt(struct lowdown_arena *, struct lowdown_attr **,
+    size_t);
+
 size_t
 lowdown_attrs_parse(const char *, size_t, struct lowdown_attr **,
     size_t *);
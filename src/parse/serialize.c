@@ -0,0 +1,665 @@
+/*
+ * Copyright (c) Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lowdown.h"
+#include "extern.h"
+
+/*
+ * The binary format is a header, the metadata, then the nodes in
+ * preorder.  All numbers are unsigned LEB128 ("varints"), so the format
+ * doesn't depend on the host's word size or byte order.  Strings are a
+ * varint length, the bytes, then a NUL, so loading can point into a
+ * single copy of the input without fixing up anything but pointers.
+ *
+ *   header:   magic (4 bytes), version (1 byte), metadata count,
+ *             node count
+ *   metadata: key (string), value (string)
+ *   node:     type, chng, id, distance back to parent (zero for the
+ *             root), then the type-specific fields in the order of
+ *             their structure
+ *
+ * Attributes are a count, then each as a byte of present fields (1 for
+ * the key, 2 for the value) followed by those present as strings.
+ * Table header flags are a byte of whether they're present, then one
+ * per column.
+ */
+#define	BIN_MAGIC	"\177LDB"
+#define	BIN_MAGICSZ	4
+#define	BIN_VERSION	1
+
+/*
+ * Input being loaded: the current position and end.
+ */
+struct	bin_in {
+	const char	*pos;
+	const char	*end;
+};
+
+/*
+ * Append "v" as a varint.  Return FALSE on failure (memory), TRUE on
+ * success.
+ */
+static int
+bin_put_num(struct lowdown_buf *ob, uint64_t v)
+{
+	char	 b[10];
+	size_t	 sz = 0;
+
+	do {
+		b[sz] = v & 0x7f;
+		if ((v >>= 7) != 0)
+			b[sz] |= 0x80;
+		sz++;
+	} while (v != 0);
+	return hbuf_put(ob, b, sz);
+}
+
+/*
+ * Append a string "data" of length "sz".  Return FALSE on failure
+ * (memory), TRUE on success.
+ */
+static int
+bin_put_str(struct lowdown_buf *ob, const char *data, size_t sz)
+{
+
+	return bin_put_num(ob, sz) &&
+	    (sz == 0 || hbuf_put(ob, data, sz)) &&
+	    hbuf_putc(ob, '\0');
+}
+
+static int
+bin_put_buf(struct lowdown_buf *ob, const struct lowdown_buf *b)
+{
+
+	return bin_put_str(ob, b->data, b->size);
+}
+
+static int
+bin_put_attrs(struct lowdown_buf *ob, const struct lowdown_attr *attrs,
+    size_t attrsz)
+{
+	size_t	 i;
+
+	if (!bin_put_num(ob, attrsz))
+		return 0;
+	for (i = 0; i < attrsz; i++) {
+		if (!hbuf_putc(ob, (attrs[i].key != NULL ? 1 : 0) |
+		    (attrs[i].value != NULL ? 2 : 0)))
+			return 0;
+		if (attrs[i].key != NULL && !bin_put_str(ob,
+		    attrs[i].key, strlen(attrs[i].key)))
+			return 0;
+		if (attrs[i].value != NULL &&
+		    !bin_put_buf(ob, attrs[i].value))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Append the type-specific fields of "n".  Return FALSE on failure
+ * (memory), TRUE on success.
+ */
+static int
+bin_put_fields(struct lowdown_buf *ob, const struct lowdown_node *n)
+{
+	size_t	 i;
+
+	switch (n->type) {
+	case LOWDOWN_BLOCKCODE:
+		return bin_put_buf(ob, &n->rndr_blockcode.text) &&
+		    bin_put_buf(ob, &n->rndr_blockcode.lang);
+	case LOWDOWN_BLOCKHTML:
+		return bin_put_buf(ob, &n->rndr_blockhtml.text);
+	case LOWDOWN_BLOCKQUOTE:
+		return bin_put_num(ob, n->rndr_blockquote.type) &&
+		    bin_put_num(ob, n->rndr_blockquote.admonition);
+	case LOWDOWN_CODESPAN:
+		return bin_put_buf(ob, &n->rndr_codespan.text);
+	case LOWDOWN_DEFINITION:
+		return bin_put_num(ob, n->rndr_definition.flags);
+	case LOWDOWN_ENTITY:
+		return bin_put_buf(ob, &n->rndr_entity.text);
+	case LOWDOWN_HEADER:
+		return bin_put_num(ob, n->rndr_header.level) &&
+		    bin_put_attrs(ob, n->rndr_header.attrs,
+			n->rndr_header.attrsz);
+	case LOWDOWN_IMAGE:
+		return bin_put_buf(ob, &n->rndr_image.link) &&
+		    bin_put_buf(ob, &n->rndr_image.title) &&
+		    bin_put_buf(ob, &n->rndr_image.dims) &&
+		    bin_put_buf(ob, &n->rndr_image.alt) &&
+		    bin_put_attrs(ob, n->rndr_image.attrs,
+			n->rndr_image.attrsz);
+	case LOWDOWN_LINK:
+		return bin_put_buf(ob, &n->rndr_link.link) &&
+		    bin_put_buf(ob, &n->rndr_link.title) &&
+		    bin_put_attrs(ob, n->rndr_link.attrs,
+			n->rndr_link.attrsz);
+	case LOWDOWN_LINK_AUTO:
+		return bin_put_buf(ob, &n->rndr_autolink.link) &&
+		    bin_put_num(ob, n->rndr_autolink.type);
+	case LOWDOWN_LIST:
+		return bin_put_num(ob, n->rndr_list.flags) &&
+		    bin_put_num(ob, n->rndr_list.start) &&
+		    bin_put_num(ob, n->rndr_list.items);
+	case LOWDOWN_LISTITEM:
+		return bin_put_num(ob, n->rndr_listitem.flags) &&
+		    bin_put_num(ob, n->rndr_listitem.num);
+	case LOWDOWN_MATH_BLOCK:
+		return bin_put_buf(ob, &n->rndr_math.text) &&
+		    bin_put_num(ob, (unsigned int)n->rndr_math.blockmode);
+	case LOWDOWN_META:
+		return bin_put_buf(ob, &n->rndr_meta.key);
+	case LOWDOWN_NORMAL_TEXT:
+		return bin_put_num(ob,
+			(unsigned int)n->rndr_normal_text.flags) &&
+		    bin_put_buf(ob, &n->rndr_normal_text.text);
+	case LOWDOWN_PARAGRAPH:
+		return bin_put_num(ob, n->rndr_paragraph.lines) &&
+		    bin_put_num(ob, (unsigned int)n->rndr_paragraph.beoln);
+	case LOWDOWN_RAW_HTML:
+		return bin_put_buf(ob, &n->rndr_raw_html.text);
+	case LOWDOWN_TABLE_BLOCK:
+		return bin_put_num(ob, n->rndr_table.columns);
+	case LOWDOWN_TABLE_CELL:
+		return bin_put_num(ob, n->rndr_table_cell.flags) &&
+		    bin_put_num(ob, n->rndr_table_cell.col) &&
+		    bin_put_num(ob, n->rndr_table_cell.columns);
+	case LOWDOWN_TABLE_HEADER:
+		if (!bin_put_num(ob, n->rndr_table_header.columns) ||
+		    !hbuf_putc(ob, n->rndr_table_header.flags != NULL))
+			return 0;
+		if (n->rndr_table_header.flags == NULL)
+			return 1;
+		for (i = 0; i < n->rndr_table_header.columns; i++)
+			if (!bin_put_num(ob, n->rndr_table_header.flags[i]))
+				return 0;
+		return 1;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Count "n" and its descendants.
+ */
+static size_t
+bin_count(const struct lowdown_node *n)
+{
+	const struct lowdown_node	*nn;
+	size_t				 sz = 1;
+
+	TAILQ_FOREACH(nn, &n->children, entries)
+		sz += bin_count(nn);
+	return sz;
+}
+
+/*
+ * Append "n", which is at preorder index "i" and whose parent is at
+ * "parent", and its descendants.  Set "i" past the last of them.
+ * Return FALSE on failure (memory), TRUE on success.
+ */
+static int
+bin_put_node(struct lowdown_buf *ob, const struct lowdown_node *n,
+    size_t *i, size_t parent)
+{
+	const struct lowdown_node	*nn;
+	size_t				 self = (*i)++;
+
+	if (!bin_put_num(ob, n->type) ||
+	    !bin_put_num(ob, n->chng) ||
+	    !bin_put_num(ob, n->id) ||
+	    !bin_put_num(ob, n->parent == NULL ? 0 : self - parent) ||
+	    !bin_put_fields(ob, n))
+		return 0;
+	TAILQ_FOREACH(nn, &n->children, entries)
+		if (!bin_put_node(ob, nn, i, self))
+			return 0;
+	return 1;
+}
+
+int
+lowdown_node_serialize(struct lowdown_buf *ob,
+    const struct lowdown_node *root, const struct lowdown_metaq *mq)
+{
+	const struct lowdown_meta	*m;
+	size_t				 i = 0, metasz = 0;
+
+	if (root->type != LOWDOWN_ROOT || root->parent != NULL)
+		return 0;
+	if (mq != NULL)
+		TAILQ_FOREACH(m, mq, entries)
+			metasz++;
+
+	if (!hbuf_put(ob, BIN_MAGIC, BIN_MAGICSZ) ||
+	    !hbuf_putc(ob, BIN_VERSION) ||
+	    !bin_put_num(ob, metasz) ||
+	    !bin_put_num(ob, bin_count(root)))
+		return 0;
+	if (mq != NULL)
+		TAILQ_FOREACH(m, mq, entries)
+			if (!bin_put_str(ob, m->key, strlen(m->key)) ||
+			    !bin_put_str(ob, m->value, strlen(m->value)))
+				return 0;
+	return bin_put_node(ob, root, &i, 0);
+}
+
+/*
+ * Read a varint into "v".  Return FALSE on failure (truncated or too
+ * large), TRUE on success.
+ */
+static int
+bin_get_num(struct bin_in *in, size_t *v)
+{
+	uint64_t	 val = 0;
+	unsigned int	 shift = 0;
+	unsigned char	 c;
+
+	do {
+		if (in->pos == in->end || shift > 63)
+			return 0;
+		c = (unsigned char)*in->pos++;
+		if (shift == 63 && (c & 0x7e))
+			return 0;
+		val |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	if (val > SIZE_MAX)
+		return 0;
+	*v = (size_t)val;
+	return 1;
+}
+
+/*
+ * Read a varint into "v", which may be at most "max".  Return FALSE on
+ * failure (truncated or too large), TRUE on success.
+ */
+static int
+bin_get_max(struct bin_in *in, size_t max, size_t *v)
+{
+
+	return bin_get_num(in, v) && *v <= max;
+}
+
+/*
+ * Read a varint into an enumeration or integer "v", which may be at
+ * most "max".  Return FALSE on failure, TRUE on success.
+ */
+static int
+bin_get_int(struct bin_in *in, unsigned int max, int *v)
+{
+	size_t	 val;
+
+	if (!bin_get_max(in, max, &val))
+		return 0;
+	*v = (int)val;
+	return 1;
+}
+
+/*
+ * Read a string, setting "data" to point into the input and "sz" to
+ * its length.  Return FALSE on failure (truncated or not terminated),
+ * TRUE on success.
+ */
+static int
+bin_get_str(struct bin_in *in, const char **data, size_t *sz)
+{
+
+	if (!bin_get_num(in, sz) || *sz >= (size_t)(in->end - in->pos) ||
+	    in->pos[*sz] != '\0')
+		return 0;
+	*data = in->pos;
+	in->pos += *sz + 1;
+	return 1;
+}
+
+/*
+ * Read a string into "b", which references the input.  Return FALSE
+ * on failure, TRUE on success.
+ */
+static int
+bin_get_buf(struct bin_in *in, struct lowdown_buf *b)
+{
+	const char	*data;
+	size_t		 sz;
+
+	if (!bin_get_str(in, &data, &sz))
+		return 0;
+	memset(b, 0, sizeof(struct lowdown_buf));
+	if (sz > 0) {
+		b->data = (char *)data;
+		b->size = sz;
+	}
+	return 1;
+}
+
+static int
+bin_get_attrs(struct bin_in *in, struct lowdown_arena *a,
+    struct lowdown_attr **attrs, size_t *attrsz)
+{
+	struct lowdown_attr	*p;
+	const char		*key;
+	size_t			 i, sz;
+	unsigned char		 fl;
+
+	*attrs = NULL;
+	if (!bin_get_max(in, (size_t)(in->end - in->pos), attrsz))
+		return 0;
+	if (*attrsz == 0)
+		return 1;
+	p = arena_calloc(a, *attrsz, sizeof(struct lowdown_attr));
+	if (p == NULL)
+		return 0;
+	for (i = 0; i < *attrsz; i++) {
+		if (in->pos == in->end)
+			return 0;
+		fl = (unsigned char)*in->pos++;
+		if (fl & ~3)
+			return 0;
+		if (fl & 1) {
+			if (!bin_get_str(in, &key, &sz))
+				return 0;
+			p[i].key = (char *)key;
+		}
+		if (fl & 2) {
+			p[i].value = arena_calloc(a, 1,
+				sizeof(struct lowdown_buf));
+			if (p[i].value == NULL ||
+			    !bin_get_buf(in, p[i].value))
+				return 0;
+		}
+	}
+	*attrs = p;
+	return 1;
+}
+
+/*
+ * Read the type-specific fields of "n".  Return FALSE on failure,
+ * TRUE on success.
+ */
+static int
+bin_get_fields(struct bin_in *in, struct lowdown_arena *a,
+    struct lowdown_node *n)
+{
+	enum htbl_flags	*fl;
+	size_t		 i, cols;
+	int		 v;
+	unsigned char	 c;
+
+	switch (n->type) {
+	case LOWDOWN_BLOCKCODE:
+		return bin_get_buf(in, &n->rndr_blockcode.text) &&
+		    bin_get_buf(in, &n->rndr_blockcode.lang);
+	case LOWDOWN_BLOCKHTML:
+		return bin_get_buf(in, &n->rndr_blockhtml.text);
+	case LOWDOWN_BLOCKQUOTE:
+		if (!bin_get_int(in, BLOCKQUOTE_ADMONITION_BLOCK, &v))
+			return 0;
+		n->rndr_blockquote.type = v;
+		if (!bin_get_int(in, ADMONITION_WARNING, &v))
+			return 0;
+		n->rndr_blockquote.admonition = v;
+		return 1;
+	case LOWDOWN_CODESPAN:
+		return bin_get_buf(in, &n->rndr_codespan.text);
+	case LOWDOWN_DEFINITION:
+		if (!bin_get_int(in, INT_MAX, &v))
+			return 0;
+		n->rndr_definition.flags = v;
+		return 1;
+	case LOWDOWN_ENTITY:
+		return bin_get_buf(in, &n->rndr_entity.text);
+	case LOWDOWN_HEADER:
+		return bin_get_num(in, &n->rndr_header.level) &&
+		    bin_get_attrs(in, a, &n->rndr_header.attrs,
+			&n->rndr_header.attrsz);
+	case LOWDOWN_IMAGE:
+		return bin_get_buf(in, &n->rndr_image.link) &&
+		    bin_get_buf(in, &n->rndr_image.title) &&
+		    bin_get_buf(in, &n->rndr_image.dims) &&
+		    bin_get_buf(in, &n->rndr_image.alt) &&
+		    bin_get_attrs(in, a, &n->rndr_image.attrs,
+			&n->rndr_image.attrsz);
+	case LOWDOWN_LINK:
+		return bin_get_buf(in, &n->rndr_link.link) &&
+		    bin_get_buf(in, &n->rndr_link.title) &&
+		    bin_get_attrs(in, a, &n->rndr_link.attrs,
+			&n->rndr_link.attrsz);
+	case LOWDOWN_LINK_AUTO:
+		if (!bin_get_buf(in, &n->rndr_autolink.link) ||
+		    !bin_get_int(in, HALINK_EMAIL, &v))
+			return 0;
+		n->rndr_autolink.type = v;
+		return 1;
+	case LOWDOWN_LIST:
+		if (!bin_get_int(in, INT_MAX, &v))
+			return 0;
+		n->rndr_list.flags = v;
+		return bin_get_num(in, &n->rndr_list.start) &&
+		    bin_get_num(in, &n->rndr_list.items);
+	case LOWDOWN_LISTITEM:
+		if (!bin_get_int(in, INT_MAX, &v))
+			return 0;
+		n->rndr_listitem.flags = v;
+		return bin_get_num(in, &n->rndr_listitem.num);
+	case LOWDOWN_MATH_BLOCK:
+		return bin_get_buf(in, &n->rndr_math.text) &&
+		    bin_get_int(in, INT_MAX, &n->rndr_math.blockmode);
+	case LOWDOWN_META:
+		return bin_get_buf(in, &n->rndr_meta.key);
+	case LOWDOWN_NORMAL_TEXT:
+		return bin_get_int(in, INT_MAX,
+			&n->rndr_normal_text.flags) &&
+		    bin_get_buf(in, &n->rndr_normal_text.text);
+	case LOWDOWN_PARAGRAPH:
+		return bin_get_num(in, &n->rndr_paragraph.lines) &&
+		    bin_get_int(in, INT_MAX, &n->rndr_paragraph.beoln);
+	case LOWDOWN_RAW_HTML:
+		return bin_get_buf(in, &n->rndr_raw_html.text);
+	case LOWDOWN_TABLE_BLOCK:
+		return bin_get_num(in, &n->rndr_table.columns);
+	case LOWDOWN_TABLE_CELL:
+		if (!bin_get_int(in, INT_MAX, &v))
+			return 0;
+		n->rndr_table_cell.flags = v;
+		return bin_get_num(in, &n->rndr_table_cell.col) &&
+		    bin_get_num(in, &n->rndr_table_cell.columns);
+	case LOWDOWN_TABLE_HEADER:
+		if (!bin_get_max(in, (size_t)(in->end - in->pos), &cols) ||
+		    in->pos == in->end)
+			return 0;
+		n->rndr_table_header.columns = cols;
+		if ((c = (unsigned char)*in->pos++) == 0)
+			return 1;
+		if (c != 1 || cols == 0)
+			return 0;
+		if ((fl = arena_calloc(a, cols, sizeof(*fl))) == NULL)
+			return 0;
+		for (i = 0; i < cols; i++) {
+			if (!bin_get_int(in, INT_MAX, &v))
+				return 0;
+			fl[i] = v;
+		}
+		n->rndr_table_header.flags = fl;
+		return 1;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Read the metadata "metasz" pairs into "mq", which may be NULL to
+ * skip them.  Return FALSE on failure, TRUE on success.
+ */
+static int
+bin_get_meta(struct bin_in *in, size_t metasz, struct lowdown_metaq *mq)
+{
+	struct lowdown_meta	*m;
+	const char		*key, *val;
+	size_t			 i, keysz, valsz;
+
+	for (i = 0; i < metasz; i++) {
+		if (!bin_get_str(in, &key, &keysz) ||
+		    !bin_get_str(in, &val, &valsz))
+			return 0;
+		if (mq == NULL)
+			continue;
+		if ((m = calloc(1, sizeof(struct lowdown_meta))) == NULL)
+			return 0;
+		TAILQ_INSERT_TAIL(mq, m, entries);
+		if ((m->key = strndup(key, keysz)) == NULL ||
+		    (m->value = strndup(val, valsz)) == NULL)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Check that "n", whose parent and fields are loaded, fits the table
+ * structure the renderers rely upon: table blocks contain headers and
+ * bodies, which contain rows, which contain cells, and cells and
+ * headers agree with the table's column count.  Return FALSE if not,
+ * TRUE otherwise.
+ */
+static int
+bin_check_table(const struct lowdown_node *n)
+{
+	const struct lowdown_node	*p = n->parent, *t;
+
+	if (p != NULL) {
+		if ((p->type == LOWDOWN_TABLE_BLOCK) !=
+		    (n->type == LOWDOWN_TABLE_HEADER ||
+		     n->type == LOWDOWN_TABLE_BODY))
+			return 0;
+		if ((p->type == LOWDOWN_TABLE_HEADER ||
+		     p->type == LOWDOWN_TABLE_BODY) !=
+		    (n->type == LOWDOWN_TABLE_ROW))
+			return 0;
+		if ((p->type == LOWDOWN_TABLE_ROW) !=
+		    (n->type == LOWDOWN_TABLE_CELL))
+			return 0;
+	}
+
+	switch (n->type) {
+	case LOWDOWN_TABLE_HEADER:
+		return n->rndr_table_header.columns ==
+		    p->rndr_table.columns;
+	case LOWDOWN_TABLE_CELL:
+		t = p->parent->parent;
+		return n->rndr_table_cell.col <
+		    t->rndr_table.columns &&
+		    n->rndr_table_cell.columns ==
+		    t->rndr_table.columns;
+	default:
+		return 1;
+	}
+}
+
+struct lowdown_node *
+lowdown_node_deserialize(const char *data, size_t datasz, size_t *maxn,
+    struct lowdown_metaq *mq)
+{
+	struct lowdown_arena	*a;
+	struct lowdown_node	*nodes, *n;
+	struct bin_in		 in;
+	const char		*copy;
+	size_t			 i, metasz, nodesz, type, chng, back,
+				 max = 0;
+
+	if (datasz < BIN_MAGICSZ + 1 ||
+	    memcmp(data, BIN_MAGIC, BIN_MAGICSZ) != 0 ||
+	    data[BIN_MAGICSZ] != BIN_VERSION)
+		return NULL;
+
+	/*
+	 * Each node takes at least four bytes, which bounds the node
+	 * count before allocating for it.  Buffers reference a single
+	 * copy of the input owned by the arena.
+	 */
+
+	in.pos = data + BIN_MAGICSZ + 1;
+	in.end = data + datasz;
+	if (!bin_get_num(&in, &metasz) ||
+	    !bin_get_max(&in, (size_t)(in.end - in.pos) / 4, &nodesz) ||
+	    nodesz == 0)
+		return NULL;
+
+	if ((a = arena_new(nodesz * sizeof(struct lowdown_node) +
+	    datasz)) == NULL)
+		return NULL;
+	if ((copy = arena_strndup(a, data, datasz)) == NULL)
+		goto err;
+	in.pos = copy + (in.pos - data);
+	in.end = copy + datasz;
+
+	if (!bin_get_meta(&in, metasz, mq))
+		goto err;
+	nodes = arena_calloc(a, nodesz, sizeof(struct lowdown_node));
+	if (nodes == NULL)
+		goto err;
+
+	for (i = 0; i < nodesz; i++) {
+		n = &nodes[i];
+		TAILQ_INIT(&n->children);
+		n->arena = a;
+		if (!bin_get_max(&in, LOWDOWN__MAX - 1, &type) ||
+		    !bin_get_max(&in, LOWDOWN_CHNG_DELETE, &chng) ||
+		    !bin_get_num(&in, &n->id) ||
+		    !bin_get_max(&in, i, &back))
+			goto err;
+		n->type = type;
+		n->chng = chng;
+
+		/* Only the first node is the root. */
+
+		if ((i == 0) != (n->type == LOWDOWN_ROOT) ||
+		    (i == 0) != (back == 0))
+			goto err;
+		if (i > 0) {
+			n->parent = &nodes[i - back];
+			TAILQ_INSERT_TAIL(&n->parent->children,
+				n, entries);
+		}
+		if (n->id == SIZE_MAX)
+			goto err;
+		if (max < n->id + 1)
+			max = n->id + 1;
+		if (!bin_get_fields(&in, a, n) || !bin_check_table(n))
+			goto err;
+	}
+
+	if (in.pos != in.end)
+		goto err;
+	if (maxn != NULL)
+		*maxn = max;
+	return nodes;
+err:
+	arena_free(a);
+	return NULL;
+}
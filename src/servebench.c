@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Load generator for "lowdown --serve=socket".  Each of the clients
+ * opens a connection and sends requests for the input files in turn,
+ * timing each response.  See main.c for the frame format.  This isn't
+ * installed: it's used by the "bench" and "regress" targets.
+ */
+
+/*
+ * An input file encoded as a request frame.
+ */
+struct	req {
+	const char	*fn; /* file name */
+	char		*buf; /* request frame */
+	size_t		 bufsz; /* length of buf */
+};
+
+/*
+ * State of one client thread.
+ */
+struct	client {
+	const char	*path; /* socket */
+	const struct req *reqs; /* requests */
+	size_t		 reqsz; /* number of requests */
+	size_t		 first; /* first request to send */
+	size_t		 n; /* number of requests to send */
+	int		 print; /* write outputs to stdout */
+	double		*lat; /* latency of each request */
+	int		 rc; /* zero on failure */
+	pthread_t	 thread; /* thread, if not the first */
+};
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+put32(char *buf, uint32_t v)
+{
+
+	buf[0] = (v >> 24) & 0xff;
+	buf[1] = (v >> 16) & 0xff;
+	buf[2] = (v >> 8) & 0xff;
+	buf[3] = v & 0xff;
+	return buf + 4;
+}
+
+static uint32_t
+get32(const char *buf)
+{
+	const unsigned char	*cp = (const unsigned char *)buf;
+
+	return (uint32_t)cp[0] << 24 | (uint32_t)cp[1] << 16 |
+		(uint32_t)cp[2] << 8 | (uint32_t)cp[3];
+}
+
+/*
+ * Make the request frame for the document in "fn" with the options
+ * "opts" of size "optsz".  Exits on failure.
+ */
+static void
+req_new(struct req *r, const char *fn, char **opts, size_t optsz)
+{
+	struct stat	 st;
+	char		*cp;
+	size_t		 i, sz, docsz;
+	ssize_t		 ssz;
+	int		 fd;
+
+	if ((fd = open(fn, O_RDONLY)) == -1)
+		err(1, "%s", fn);
+	if (fstat(fd, &st) == -1)
+		err(1, "%s", fn);
+	if (st.st_size > INT32_MAX)
+		errx(1, "%s: file too long", fn);
+	docsz = (size_t)st.st_size;
+
+	sz = 4 + 4 + 4 + docsz;
+	for (i = 0; i < optsz; i++)
+		sz += 4 + strlen(opts[i]);
+	if ((r->buf = cp = malloc(sz)) == NULL)
+		err(1, NULL);
+	r->bufsz = sz;
+	r->fn = fn;
+
+	cp = put32(cp, sz - 4);
+	cp = put32(cp, optsz);
+	for (i = 0; i < optsz; i++) {
+		cp = put32(cp, strlen(opts[i]));
+		memcpy(cp, opts[i], strlen(opts[i]));
+		cp += strlen(opts[i]);
+	}
+	cp = put32(cp, docsz);
+	while (docsz > 0) {
+		if ((ssz = read(fd, cp, docsz)) == -1)
+			err(1, "%s", fn);
+		if (ssz == 0)
+			errx(1, "%s: short file", fn);
+		cp += ssz;
+		docsz -= (size_t)ssz;
+	}
+	close(fd);
+}
+
+static int
+writeall(int fd, const char *buf, size_t sz)
+{
+	ssize_t	 ssz;
+
+	while (sz > 0) {
+		if ((ssz = write(fd, buf, sz)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		buf += ssz;
+		sz -= (size_t)ssz;
+	}
+	return 1;
+}
+
+static int
+readall(int fd, char *buf, size_t sz)
+{
+	ssize_t	 ssz;
+
+	while (sz > 0) {
+		if ((ssz = read(fd, buf, sz)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		if (ssz == 0) {
+			errno = EPIPE;
+			return 0;
+		}
+		buf += ssz;
+		sz -= (size_t)ssz;
+	}
+	return 1;
+}
+
+/*
+ * Check the response "buf" of length "sz" to the request "r" and, if
+ * "print" is set, write its output to standard output.  Returns zero
+ * on failure, non-zero on success.
+ */
+static int
+response(const struct req *r, const char *buf, size_t sz, int print)
+{
+	size_t	 pos = 8, i, n, len;
+
+	if (sz < 8)
+		goto bad;
+	if (get32(buf) != 0) {
+		len = get32(buf + 4);
+		if (len > sz - 8)
+			goto bad;
+		warnx("%s: %.*s", r->fn, (int)len, buf + 8);
+		return 0;
+	}
+
+	/* Skip the metadata. */
+
+	n = get32(buf + 4);
+	for (i = 0; i < n * 2; i++) {
+		if (sz - pos < 4 || (len = get32(buf + pos)) > sz - pos - 4)
+			goto bad;
+		pos += 4 + len;
+	}
+	if (sz - pos < 4 || (len = get32(buf + pos)) != sz - pos - 4)
+		goto bad;
+	if (print && fwrite(buf + pos + 4, 1, len, stdout) != len)
+		err(1, "stdout");
+	return 1;
+bad:
+	warnx("%s: malformed response", r->fn);
+	return 0;
+}
+
+static void *
+client_run(void *arg)
+{
+	struct client		*c = arg;
+	const struct req	*r;
+	struct sockaddr_un	 sun;
+	char			 head[4], *buf = NULL, *nbuf;
+	size_t			 i, sz, bufsz = 0;
+	double			 start;
+	int			 fd;
+
+	memset(&sun, 0, sizeof(struct sockaddr_un));
+	sun.sun_family = AF_UNIX;
+	strlcpy(sun.sun_path, c->path, sizeof(sun.sun_path));
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		warn("socket");
+		return NULL;
+	}
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		warn("%s", c->path);
+		close(fd);
+		return NULL;
+	}
+
+	c->rc = 1;
+	for (i = 0; i < c->n; i++) {
+		r = &c->reqs[(c->first + i) % c->reqsz];
+		start = now();
+		if (!writeall(fd, r->buf, r->bufsz) ||
+		    !readall(fd, head, sizeof(head))) {
+			warn("%s", c->path);
+			c->rc = 0;
+			break;
+		}
+		if ((sz = get32(head)) > bufsz) {
+			if ((nbuf = realloc(buf, sz)) == NULL)
+				err(1, NULL);
+			buf = nbuf;
+			bufsz = sz;
+		}
+		if (!readall(fd, buf, sz)) {
+			warn("%s", c->path);
+			c->rc = 0;
+			break;
+		}
+		c->lat[i] = now() - start;
+		if (!response(r, buf, sz, c->print))
+			c->rc = 0;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static int
+dblcmp(const void *p1, const void *p2)
+{
+	double	 d1 = *(const double *)p1, d2 = *(const double *)p2;
+
+	return d1 < d2 ? -1 : d1 > d2;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct client	*cs;
+	struct req	*reqs;
+	char		**opts = NULL;
+	double		 start, elapsed, *lat;
+	const char	*er, *path;
+	size_t		 i, optsz = 0, clients = 1, n = 1000, total = 0;
+	int		 c, print = 0, rc = 1;
+
+	while ((c = getopt(argc, argv, "c:n:o:p")) != -1)
+		switch (c) {
+		case 'c':
+			clients = strtonum(optarg, 1, 1024, &er);
+			if (er != NULL)
+				errx(1, "-c: %s", er);
+			break;
+		case 'n':
+			n = strtonum(optarg, 1, INT_MAX, &er);
+			if (er != NULL)
+				errx(1, "-n: %s", er);
+			break;
+		case 'o':
+			opts = reallocarray(opts, optsz + 1, sizeof(char *));
+			if (opts == NULL)
+				err(1, NULL);
+			opts[optsz++] = optarg;
+			break;
+		case 'p':
+			print = 1;
+			break;
+		default:
+			goto usage;
+		}
+
+	argc -= optind;
+	argv += optind;
+	if (argc < 2)
+		goto usage;
+	path = argv[0];
+
+	if ((reqs = calloc(argc - 1, sizeof(struct req))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < (size_t)argc - 1; i++)
+		req_new(&reqs[i], argv[i + 1], opts, optsz);
+
+	/* Printing sends each input once, in order. */
+
+	if (print) {
+		clients = 1;
+		n = argc - 1;
+	}
+
+	if ((cs = calloc(clients, sizeof(struct client))) == NULL ||
+	    (lat = calloc(clients * n, sizeof(double))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < clients; i++) {
+		cs[i].path = path;
+		cs[i].reqs = reqs;
+		cs[i].reqsz = argc - 1;
+		cs[i].first = i;
+		cs[i].n = n;
+		cs[i].print = print;
+		cs[i].lat = &lat[i * n];
+	}
+
+	start = now();
+	for (i = 1; i < clients; i++)
+		if (pthread_create(&cs[i].thread,
+		    NULL, client_run, &cs[i]) != 0)
+			errx(1, "pthread_create");
+	client_run(&cs[0]);
+	for (i = 1; i < clients; i++)
+		pthread_join(cs[i].thread, NULL);
+	elapsed = now() - start;
+
+	for (i = 0; i < clients; i++)
+		if (!cs[i].rc)
+			rc = 0;
+
+	if (!print && rc) {
+		total = clients * n;
+		qsort(lat, total, sizeof(double), dblcmp);
+		printf("%zu requests, %zu clients: %.3fs, %.0f/s, "
+		    "latency p50 %.3fms p99 %.3fms\n", total, clients,
+		    elapsed, total / elapsed, lat[total / 2] * 1e3,
+		    lat[total * 99 / 100] * 1e3);
+	}
+
+	for (i = 0; i < (size_t)argc - 1; i++)
+		free(reqs[i].buf);
+	free(reqs);
+	free(cs);
+	free(lat);
+	free(opts);
+	return rc ? 0 : 1;
+usage:
+	fprintf(stderr, "usage: servebench [-p] [-c clients] "
+	    "[-n requests] [-o option] socket file ...\n");
+	return 1;
+}